@@ -0,0 +1,294 @@
+#include<unistd.h>
+#include<fcntl.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<getopt.h>
+#include<poll.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include<sys/types.h>
+#include<linux/fs.h>
+#include<scsi/scsi_ioctl.h>
+#include<scsi/sg.h>
+#include "../sata/sat_layer.h"
+/* streams LBAs of a SATA disk behind a SAS HBA/SAT layer to a file or stdout */
+/* compile: gcc ata_pass_through_16_read.c test_sas.c ../sata/sat_layer.c -lpthread -o ata_pass_through_16_read */
+/* execute: sudo ./ata_pass_through_16_read /dev/sg<> [-s lba] [-n blocks] [-b blocks per request] [-q depth, at most 16] [-o file] */
+
+#define LBA_SIZE 512
+#define CMD_LEN 16
+#define BLOCK_MAX 65536			/* sector count 0 of READ DMA EXT */
+#define LBA_MAX (1ULL<<48)
+#define BLOCK_MAX_28 256		/* sector count 0 of READ DMA, the only read ATA PASS-THROUGH(12) takes */
+#define LBA_MAX_28 (1ULL<<28)
+#define DEFAULT_BLOCKS 2048		/* 1 MB per request */
+#define DEFAULT_DEPTH 4
+#define MAX_DEPTH SG_MAX_QUEUE		/* 16, commands one sg fd takes before write() fails with EDOM */
+#define TIMEOUT 60000
+
+struct request {
+	unsigned long long lba;
+	unsigned int blocks;
+	int cmd_len;
+	int busy;			/* queued to the sg driver */
+	int done;			/* data read, waiting for its turn to be written */
+	unsigned char cmd[CMD_LEN];
+	unsigned char sense[32];
+	unsigned char *buf;
+	sg_io_hdr_t io_hdr;
+};
+
+static SAT_TRANSPORT transport;
+
+/*
+ * READ DMA EXT (48-bit lba, up to 65536 sectors) in ATA PASS-THROUGH(16), READ DMA (28-bit lba, up to 256
+ * sectors) where the sat layer only gives ATA PASS-THROUGH(12).
+ * @return the cdb length, -1 when the request does not fit the transport
+ */
+static int build_read_dma(unsigned char *cmd, unsigned long long lba, unsigned int blocks)
+{
+	struct ata_tf tf;
+
+	memset(&tf, 0, sizeof(tf));
+	tf.lba = lba;
+	tf.device = 0x40;		/* lba mode */
+	if(transport == SAT_PT16){
+		tf.command = 0x25;	/* READ DMA EXT */
+		tf.ext = 1;
+		tf.count = blocks == BLOCK_MAX ? 0 : blocks;
+	}else{
+		tf.command = 0xc8;	/* READ DMA */
+		tf.count = blocks == BLOCK_MAX_28 ? 0 : blocks;
+	}
+	return sat_build_cdb(transport, &tf, ATA_PROT_DMA, cmd);
+}
+
+/* READ CAPACITY(16) is translated by the SAT layer */
+static unsigned long long get_capacity(int fd)
+{
+	int i;
+	unsigned long long last = 0;
+	unsigned char cmd[16] = {0x9e, 0x10, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0};
+	unsigned char buf[32];
+	unsigned char sense[32];
+	sg_io_hdr_t io_hdr;
+
+	memset(&io_hdr, 0, sizeof(io_hdr));
+	io_hdr.interface_id = 'S';
+	io_hdr.cmd_len = sizeof(cmd);
+	io_hdr.mx_sb_len = sizeof(sense);
+	io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+	io_hdr.dxfer_len = sizeof(buf);
+	io_hdr.dxferp = buf;
+	io_hdr.cmdp = cmd;
+	io_hdr.sbp = sense;
+	io_hdr.timeout = TIMEOUT;
+	if(ioctl(fd, SG_IO, &io_hdr) < 0 || (io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+		return 0;
+	for(i = 0 ; i < 8 ; i++)
+		last = (last << 8) | buf[i];
+	return last + 1;
+}
+
+static int submit(int fd, struct request *req, int id, unsigned long long lba, unsigned int blocks)
+{
+	req->lba = lba;
+	req->blocks = blocks;
+	req->busy = 1;
+	req->done = 0;
+	if((req->cmd_len = build_read_dma(req->cmd, lba, blocks)) < 0){
+		fprintf(stderr, "lba %llu, %u blocks do not fit the ATA PASS-THROUGH form\n", lba, blocks);
+		return -1;
+	}
+	memset(&req->io_hdr, 0, sizeof(sg_io_hdr_t));
+	req->io_hdr.interface_id = 'S';
+	req->io_hdr.cmd_len = req->cmd_len;
+	req->io_hdr.mx_sb_len = sizeof(req->sense);
+	req->io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+	req->io_hdr.dxfer_len = LBA_SIZE * blocks;
+	req->io_hdr.dxferp = req->buf;
+	req->io_hdr.cmdp = req->cmd;
+	req->io_hdr.sbp = req->sense;
+	req->io_hdr.timeout = TIMEOUT;
+	req->io_hdr.pack_id = id;
+	if(write(fd, &req->io_hdr, sizeof(sg_io_hdr_t)) < 0){
+		perror("sg write");
+		return -1;
+	}
+	return 0;
+}
+
+static int write_all(int out, unsigned char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while(len > 0){
+		ret = write(out, buf, len);
+		if(ret < 0){
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]){
+	int fd, out = STDOUT_FILENO;
+	int i, c;
+	int max_bytes = 0;
+	int depth = DEFAULT_DEPTH;
+	int inflight = 0;
+	int next_write = 0;		/* request whose data goes out next, output stays in lba order */
+	int next_submit = 0;
+	unsigned int blocks = DEFAULT_BLOCKS;
+	unsigned int block_max;
+	unsigned long long lba = 0, end, count = 0;
+	unsigned long long lba_max;
+	unsigned long long written = 0;
+	char* file_name = 0;
+	struct request reqs[MAX_DEPTH];
+	sg_io_hdr_t io_hdr;
+	double start;
+
+	while((c = getopt(argc, argv, "s:n:b:q:o:")) != -1){
+		switch(c){
+		case 's': lba = strtoull(optarg, NULL, 0); break;
+		case 'n': count = strtoull(optarg, NULL, 0); break;
+		case 'b': blocks = strtoul(optarg, NULL, 0); break;
+		case 'q': depth = atoi(optarg); break;
+		case 'o':
+			if((out = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0){
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: %s /dev/sg<> [-s lba] [-n blocks] [-b blocks per request] [-q depth, at most %d] [-o file]\n", argv[0], MAX_DEPTH);
+			return 1;
+		}
+	}
+	if(optind >= argc){
+		printf("please enter a device file\n");
+		return 1;
+	}
+	file_name = argv[optind];
+
+	/////////opening the device file/////////////
+
+	if((fd = open(file_name,O_RDWR))<0){
+		printf("device file opening failed\n");
+		return 1;
+	}
+	if(ioctl(fd, SG_GET_VERSION_NUM, &c) < 0 || c < 30000){
+		printf("%s is not an sg device\n", file_name);
+		return 1;
+	}
+	/* PT16 or PT12 by the sat layer, with the quirks of USB bridges */
+	transport = sat_detect(file_name);
+	if(transport != SAT_PT16 && transport != SAT_PT12){
+		printf("%s takes no ATA PASS-THROUGH\n", file_name);
+		return 1;
+	}
+	block_max = transport == SAT_PT16 ? BLOCK_MAX : BLOCK_MAX_28;
+	lba_max = transport == SAT_PT16 ? LBA_MAX : LBA_MAX_28;
+
+	/* the HBA limit, a larger request would be split or rejected */
+	if(ioctl(fd, BLKSECTGET, &max_bytes) == 0 && max_bytes >= LBA_SIZE && blocks > (unsigned int) max_bytes / LBA_SIZE)
+		blocks = max_bytes / LBA_SIZE;
+	if(blocks > block_max)
+		blocks = block_max;
+	if(blocks == 0)
+		blocks = 1;
+	if(depth < 1)
+		depth = 1;
+	if(depth > MAX_DEPTH)
+		depth = MAX_DEPTH;
+
+	if(count == 0){
+		end = get_capacity(fd);
+		if(end <= lba){
+			fprintf(stderr, "can not read the capacity, give the block count with -n\n");
+			return 1;
+		}
+	}else{
+		end = lba + count;
+	}
+	if(end > lba_max){
+		fprintf(stderr, "LBA larger than %llu not allowed\n", lba_max);
+		return 1;
+	}
+
+	for(i = 0 ; i < depth ; i++){
+		if(posix_memalign((void**) &reqs[i].buf, 4096, LBA_SIZE * blocks) != 0){
+			fprintf(stderr, "buffer allocation failed\n");
+			return 1;
+		}
+		reqs[i].busy = 0;
+		reqs[i].done = 0;
+	}
+
+	start = now_sec();
+	/* requests go out round robin over the slots, so slot order is lba order */
+	while(1){
+		while(inflight < depth && lba < end && !reqs[next_submit].busy && !reqs[next_submit].done){
+			unsigned int n = end - lba < blocks ? end - lba : blocks;
+			if(submit(fd, &reqs[next_submit], next_submit, lba, n) < 0)
+				return 1;
+			lba += n;
+			inflight++;
+			next_submit = (next_submit + 1) % depth;
+		}
+		if(inflight == 0)
+			break;
+
+		memset(&io_hdr, 0, sizeof(io_hdr));
+		io_hdr.interface_id = 'S';
+		io_hdr.pack_id = -1;		/* any completed request */
+		if(read(fd, &io_hdr, sizeof(io_hdr)) != sizeof(io_hdr)){
+			if(errno == EINTR)
+				continue;
+			perror("sg read");
+			return 1;
+		}
+		i = io_hdr.pack_id;
+		inflight--;
+		reqs[i].busy = 0;
+		if((io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK){
+			fprintf(stderr, "read failed at lba %llu, sense:", reqs[i].lba);
+			for(c = 0 ; c < 32 ; c++)
+				fprintf(stderr, " %02x", reqs[i].sense[c]);
+			fprintf(stderr, "\n");
+			return 1;
+		}
+		reqs[i].done = 1;
+
+		while(reqs[next_write].done){
+			if(write_all(out, reqs[next_write].buf, LBA_SIZE * reqs[next_write].blocks) < 0){
+				perror("output write");
+				return 1;
+			}
+			written += reqs[next_write].blocks;
+			reqs[next_write].done = 0;
+			next_write = (next_write + 1) % depth;
+		}
+	}
+	close(fd);
+	if(out != STDOUT_FILENO)
+		close(out);
+
+	fprintf(stderr, "%llu blocks, %.1f MB/s, %u blocks per request, depth %d\n", written,
+		written * LBA_SIZE / 1e6 / (now_sec() - start), blocks, depth);
+	return 0;
+}
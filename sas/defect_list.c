@@ -0,0 +1,458 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <scsi/sg.h> /* take care: fetches glibc's /usr/include/scsi/sg.h */
+
+#include "defect_list.h"
+
+/*
+ * READ DEFECT DATA(12) in DEFECT_CHUNK_LEN pieces.
+ * The ADDRESS DESCRIPTOR INDEX field moves the window through the list, so a
+ * P-list of any length goes through one small buffer. The descriptors are
+ * kept as sorted 64-bit keys and stored delta encoded, a few bytes per defect
+ * instead of 8, and two collections are compared key by key.
+ */
+
+static int get_desc_len(unsigned char format)
+{
+    switch(format & 0x07)
+    {
+        case DEFECT_FORMAT_SHORT_BLOCK:
+            return 4;
+        case DEFECT_FORMAT_LONG_BLOCK:
+        case DEFECT_FORMAT_BYTES_FROM_INDEX:
+        case DEFECT_FORMAT_PHYSICAL_SECTOR:
+            return 8;
+    }
+    return 0;
+}
+
+static unsigned long long get_key(unsigned char format, unsigned char *d)
+{
+    int i;
+    unsigned long long key = 0;
+
+    if((format & 0x07) == DEFECT_FORMAT_SHORT_BLOCK)
+    {
+        return ((unsigned int) d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+    }
+    /* long block is a plain lba, the others are cylinder(3) head(1) sector(4), both sort big endian */
+    for(i = 0 ; i < 8 ; i++)
+        key = (key << 8) | d[i];
+    return key;
+}
+
+static int cmp_key(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long*) a, y = *(const unsigned long long*) b;
+    return x < y ? -1 : x > y;
+}
+
+static int add_key(struct defect_list *list, unsigned long long key)
+{
+    unsigned long long *keys;
+
+    if(list->num == list->size)
+    {
+        if((keys = (unsigned long long*) realloc(list->keys, sizeof(*keys) * (list->size ? list->size * 2 : 1024))) == NULL)
+        {
+            return -1;
+        }
+        list->keys = keys;
+        list->size = list->size ? list->size * 2 : 1024;
+    }
+    list->keys[list->num++] = key;
+    return 0;
+}
+
+static int read_chunk(int sg_fd, unsigned char op, unsigned int index, unsigned char *buf, unsigned int len)
+{
+    unsigned char cmd[12];
+    unsigned char sense[32];
+    sg_io_hdr_t io_hdr;
+
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0] = 0xb7;
+    cmd[1] = op;                /* REQ_PLIST / REQ_GLIST and the descriptor format */
+    cmd[2] = index >> 24;
+    cmd[3] = index >> 16;
+    cmd[4] = index >> 8;
+    cmd[5] = index;
+    cmd[6] = len >> 24;
+    cmd[7] = len >> 16;
+    cmd[8] = len >> 8;
+    cmd[9] = len;
+
+    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = sizeof(cmd);
+    io_hdr.mx_sb_len = sizeof(sense);
+    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = len;
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = cmd;
+    io_hdr.sbp = sense;
+    io_hdr.timeout = 60000;
+    if(ioctl(sg_fd, SG_IO, &io_hdr) < 0)
+    {
+        perror("read defect data SG_IO ioctl error");
+        return -1;
+    }
+    if((io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+    {
+        return -2;
+    }
+    return len - io_hdr.resid;
+}
+
+static unsigned int get_list_len(unsigned char *buf)
+{
+    return ((unsigned int) buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+}
+
+/*
+ * The whole list in one command of len bytes, header included, for a device
+ * that ignores the descriptor index. Replaces what list holds.
+ * len is at most DEFECT_FULL_MAX_LEN.
+ */
+static int read_full(int sg_fd, unsigned char op, unsigned int len, struct defect_list *list)
+{
+    int ret;
+    unsigned int i, n, got, desc_len;
+    unsigned char *buf;
+
+    if((buf = (unsigned char*) malloc(len)) == NULL)
+    {
+        return -1;
+    }
+    if((ret = read_chunk(sg_fd, op, 0, buf, len)) < 0)
+    {
+        goto full_exit;
+    }
+    got = ret;
+    if(got < DEFECT_HEADER_LEN || (desc_len = get_desc_len(buf[1])) == 0)
+    {
+        ret = -1;
+        goto full_exit;
+    }
+    list->num = 0;
+    list->flags = buf[1];
+    list->generation = (buf[2] << 8) | buf[3];
+    n = get_list_len(buf);
+    n = n < got - DEFECT_HEADER_LEN ? n : got - DEFECT_HEADER_LEN;
+    for(i = 0, ret = 0 ; i < n / desc_len && ret == 0 ; i++)
+    {
+        ret = add_key(list, get_key(buf[1], buf + DEFECT_HEADER_LEN + i * desc_len));
+    }
+
+full_exit:
+    free(buf);
+    return ret;
+}
+
+/*
+ * Read the whole list selected by op into list, sorted.
+ * A device without descriptor index support answers every chunk from the
+ * start of the list: a later chunk that reports the full list length again,
+ * or starts with the head of the list, switches to one read of the full
+ * length the first chunk announced.
+ * @retval 0 Success.
+ * @retval -1 SG_IO or memory failure, unknown descriptor format.
+ * @retval -2 The device rejected the command.
+ * @retval DEFECT_TOO_LONG The device ignores the descriptor index and its list
+ * is longer than DEFECT_FULL_MAX_LEN.
+ */
+int defect_list_read(int sg_fd, unsigned char op, struct defect_list *list)
+{
+    int ret;
+    unsigned int i, desc_len = 0;
+    unsigned int index = 0;
+    unsigned int total = 0, n, len, got;
+    unsigned long long first = 0;
+    unsigned char *buf;
+
+    memset(list, 0, sizeof(*list));
+    if((buf = (unsigned char*) malloc(DEFECT_CHUNK_LEN)) == NULL)
+    {
+        return -1;
+    }
+    do
+    {
+        if((ret = read_chunk(sg_fd, op, index, buf, DEFECT_CHUNK_LEN)) < 0)
+        {
+            goto read_exit;
+        }
+        got = ret;
+        if(got < DEFECT_HEADER_LEN || (desc_len = get_desc_len(buf[1])) == 0)
+        {
+            ret = -1;
+            goto read_exit;
+        }
+        n = get_list_len(buf);
+        if(index == 0)
+        {
+            list->flags = buf[1];
+            list->generation = (buf[2] << 8) | buf[3];
+            total = n / desc_len;
+        }
+        /* the list length counts the descriptors from the index on */
+        else if(n / desc_len >= total ||
+                (got >= DEFECT_HEADER_LEN + desc_len && get_key(buf[1], buf + DEFECT_HEADER_LEN) == first))
+        {
+            /* the index was ignored, this is the head of the list again */
+            if(total > (DEFECT_FULL_MAX_LEN - DEFECT_HEADER_LEN) / desc_len)
+            {
+                ret = DEFECT_TOO_LONG;
+                goto read_exit;
+            }
+            len = DEFECT_HEADER_LEN + total * desc_len;
+            if((ret = read_full(sg_fd, op, len, list)) != 0)
+            {
+                goto read_exit;
+            }
+            break;
+        }
+        n = n < got - DEFECT_HEADER_LEN ? n : got - DEFECT_HEADER_LEN;
+        n /= desc_len;
+        for(i = 0 ; i < n && index < total ; i++, index++)
+        {
+            if(add_key(list, get_key(buf[1], buf + DEFECT_HEADER_LEN + i * desc_len)) != 0)
+            {
+                ret = -1;
+                goto read_exit;
+            }
+        }
+        if(list->num)
+            first = list->keys[0];
+    } while(n > 0 && index < total);
+
+    qsort(list->keys, list->num, sizeof(unsigned long long), cmp_key);
+    ret = 0;
+
+read_exit:
+    free(buf);
+    if(ret != 0)
+        defect_list_free(list);
+    return ret;
+}
+
+/*
+ * Header as the device returns it with DEFECT_ENCODED in byte 0 and the
+ * length of the encoded descriptors in bytes 4-7, then the gap to the
+ * previous key of every descriptor as a LEB128 varint.
+ * @return length of *bufP (malloc'ed), -1 on failure.
+ */
+int defect_list_encode(struct defect_list *list, unsigned char **bufP)
+{
+    unsigned int i;
+    int len = DEFECT_HEADER_LEN;
+    unsigned long long prev = 0, delta;
+    unsigned char *buf;
+
+    /* a varint never takes more than 10 bytes */
+    if((buf = (unsigned char*) malloc(DEFECT_HEADER_LEN + 10 * (size_t) list->num)) == NULL)
+    {
+        return -1;
+    }
+    for(i = 0 ; i < list->num ; i++)
+    {
+        delta = list->keys[i] - prev;
+        prev = list->keys[i];
+        while(delta >= 0x80)
+        {
+            buf[len++] = (delta & 0x7f) | 0x80;
+            delta >>= 7;
+        }
+        buf[len++] = delta;
+    }
+    buf[0] = DEFECT_ENCODED;
+    buf[1] = list->flags;
+    buf[2] = list->generation >> 8;
+    buf[3] = list->generation;
+    buf[4] = (len - DEFECT_HEADER_LEN) >> 24;
+    buf[5] = (len - DEFECT_HEADER_LEN) >> 16;
+    buf[6] = (len - DEFECT_HEADER_LEN) >> 8;
+    buf[7] = len - DEFECT_HEADER_LEN;
+    *bufP = buf;
+    return len;
+}
+
+int defect_list_decode(unsigned char *buf, int len, struct defect_list *list)
+{
+    int shift;
+    unsigned int end;
+    unsigned long long key = 0, delta;
+    unsigned char *p;
+
+    memset(list, 0, sizeof(*list));
+    if(len < DEFECT_HEADER_LEN || buf[0] != DEFECT_ENCODED)
+    {
+        return -1;
+    }
+    end = ((unsigned int) buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+    if(end > (unsigned int) len - DEFECT_HEADER_LEN)
+    {
+        return -1;
+    }
+    list->flags = buf[1];
+    list->generation = (buf[2] << 8) | buf[3];
+    for(p = buf + DEFECT_HEADER_LEN ; p < buf + DEFECT_HEADER_LEN + end ; )
+    {
+        delta = 0;
+        shift = 0;
+        do
+        {
+            delta |= (unsigned long long) (*p & 0x7f) << shift;
+            shift += 7;
+        } while((*p++ & 0x80) && p < buf + DEFECT_HEADER_LEN + end && shift < 64);
+        key += delta;
+        if(add_key(list, key) != 0)
+        {
+            defect_list_free(list);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Defects of new that old does not have, the newly grown ones when both are
+ * G-lists of the same disk.
+ * @return number of keys in *addedP (malloc'ed, NULL when 0), -1 on failure.
+ */
+int defect_list_diff(struct defect_list *old, struct defect_list *new, unsigned long long **addedP)
+{
+    int num = 0;
+    unsigned int i = 0, j = 0;
+    unsigned long long *added;
+
+    *addedP = NULL;
+    if(old->generation == new->generation && old->num == new->num && old->num && new->generation)
+    {
+        /* an unchanged generation code means an unchanged list */
+        return 0;
+    }
+    if(new->num == 0)
+    {
+        return 0;
+    }
+    if((added = (unsigned long long*) malloc(sizeof(unsigned long long) * new->num)) == NULL)
+    {
+        return -1;
+    }
+    while(j < new->num)
+    {
+        if(i < old->num && old->keys[i] < new->keys[j])
+            i++;
+        else if(i < old->num && old->keys[i] == new->keys[j])
+            i++, j++;
+        else
+            added[num++] = new->keys[j++];
+    }
+    if(num == 0)
+    {
+        free(added);
+        return 0;
+    }
+    *addedP = added;
+    return num;
+}
+
+void defect_list_free(struct defect_list *list)
+{
+    free(list->keys);
+    list->keys = NULL;
+    list->num = 0;
+    list->size = 0;
+}
+
+/*
+ * Package writer for templates 332 (G-list) and 333 (P-list): the list in
+ * its encoded form.
+ * @return bytes written to data_fd, -1 on failure.
+ */
+int send_read_defect_data_12(int sg_fd, unsigned char op, int data_fd)
+{
+    int len;
+    unsigned char *buf;
+    struct defect_list list;
+
+    if(defect_list_read(sg_fd, op, &list) != 0)
+    {
+        return -1;
+    }
+    len = defect_list_encode(&list, &buf);
+    defect_list_free(&list);
+    if(len < 0)
+    {
+        return -1;
+    }
+    if(write(data_fd, buf, len) != len)
+    {
+        len = -1;
+    }
+    free(buf);
+    return len;
+}
+
+#ifdef UNIT_TEST
+static int load_file(const char *path, struct defect_list *list)
+{
+    int fd, len;
+    static unsigned char buf[16 * 1024 * 1024];
+
+    if((fd = open(path, O_RDONLY)) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    len = read(fd, buf, sizeof(buf));
+    close(fd);
+    return defect_list_decode(buf, len, list);
+}
+
+int main(int argc, char *argv[])
+{
+    int i, num, fd, sg_fd, len;
+    unsigned long long *added;
+    struct defect_list old, new;
+
+    /* defect_list /dev/sg1 0c|14 out.bin: read the G-list or P-list into a package file */
+    if(argc == 4 && strcmp(argv[1], "-d"))
+    {
+        if((sg_fd = open(argv[1], O_RDONLY)) < 0 || (fd = open(argv[3], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        {
+            perror("open");
+            return 1;
+        }
+        len = send_read_defect_data_12(sg_fd, strtoul(argv[2], NULL, 16), fd);
+        printf("(op, len) = (%s, %d)\n", argv[2], len);
+        close(fd);
+        close(sg_fd);
+        return len < 0;
+    }
+    /* defect_list -d old.bin new.bin: grown defects between two packages */
+    if(argc == 4)
+    {
+        if(load_file(argv[2], &old) != 0 || load_file(argv[3], &new) != 0)
+        {
+            printf("not an encoded defect list\n");
+            return 1;
+        }
+        num = defect_list_diff(&old, &new, &added);
+        printf("(old, new, added) = (%u, %u, %d)\n", old.num, new.num, num);
+        for(i = 0 ; i < num ; i++)
+            printf("    0x%llx\n", added[i]);
+        free(added);
+        defect_list_free(&old);
+        defect_list_free(&new);
+        return 0;
+    }
+    printf("usage: %s /dev/sg<> 0c|14 out.bin | -d old.bin new.bin\n", argv[0]);
+    return 1;
+}
+#endif
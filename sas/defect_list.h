@@ -0,0 +1,36 @@
+#ifndef _DEFECT_LIST_H
+#define _DEFECT_LIST_H
+
+#define DEFECT_CHUNK_LEN        65536       /* allocation length of one READ DEFECT DATA(12) */
+#define DEFECT_FULL_MAX_LEN     (16 * 1024 * 1024)  /* one read of the whole list, devices without descriptor index */
+#define DEFECT_TOO_LONG         -3
+#define DEFECT_HEADER_LEN       8
+#define DEFECT_ENCODED          0x80        /* byte 0 of a stored header: sorted, delta encoded descriptors */
+
+#define DEFECT_FORMAT_SHORT_BLOCK       0x00
+#define DEFECT_FORMAT_LONG_BLOCK        0x03
+#define DEFECT_FORMAT_BYTES_FROM_INDEX  0x04
+#define DEFECT_FORMAT_PHYSICAL_SECTOR   0x05
+
+/*
+ * Each descriptor becomes one 64-bit key that sorts like the address:
+ * the lba for the block formats, cylinder << 40 | head << 32 | sector (or
+ * bytes from index) for the others.
+ */
+struct defect_list {
+    unsigned char flags;                /*!< byte 1 of the reply: PLISTV, GLISTV, format */
+    unsigned short generation;          /*!< bumped by the device whenever the list changes */
+    unsigned int num;
+    unsigned int size;
+    unsigned long long *keys;
+};
+
+int defect_list_read(int sg_fd, unsigned char op, struct defect_list *list);
+int defect_list_encode(struct defect_list *list, unsigned char **bufP);
+int defect_list_decode(unsigned char *buf, int len, struct defect_list *list);
+int defect_list_diff(struct defect_list *old, struct defect_list *new, unsigned long long **addedP);
+void defect_list_free(struct defect_list *list);
+
+int send_read_defect_data_12(int sg_fd, unsigned char op, int data_fd);
+
+#endif
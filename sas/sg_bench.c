@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <scsi/sg.h>
+/* passthrough vs block I/O benchmark: SG_IO READ(16)/WRITE(16) against O_DIRECT pread/pwrite */
+/* compile: gcc sg_bench.c -o sg_bench -lpthread */
+/* execute: sudo ./sg_bench [-p seq|rand] [-q 1,4,16] [-b 4k,64k,1m] [-t sec] [-w start:blocks] [-m sg|direct|both] <dev> */
+/* no disk: modprobe scsi_debug dev_size_mb=1024 and use its /dev/sdX, or give a file (direct only) */
+
+#define LBA_SIZE        512             /* files, and devices that answer no READ CAPACITY(16) */
+#define MAX_POINTS      16
+#define MAX_DEPTH       256
+#define LAT_SUB         32              /* histogram buckets per power of two, about 3% resolution */
+#define LAT_MAX_SHIFT   32
+#define LAT_BUCKETS     ((LAT_MAX_SHIFT + 2) * LAT_SUB)
+#define DEFAULT_SECONDS 5
+
+enum { MODE_SG = 1, MODE_DIRECT = 2 };
+
+struct bench {
+    const char *path;
+    int mode;
+    int random;
+    int write;
+    unsigned long long first;           /* lba range the benchmark stays in */
+    unsigned long long blocks;
+    unsigned int lba_size;              /* logical block length, 4096 on 4Kn disks */
+    unsigned int bs;                    /* bytes per request */
+    int seconds;
+    unsigned long long seq_next;        /* shared sequential cursor */
+};
+
+struct worker {
+    struct bench *b;
+    pthread_t tid;
+    int fd;
+    unsigned int seed;
+    unsigned long long ios;
+    unsigned long long lat[LAT_BUCKETS];    /* log-linear histogram of microseconds, every request counted */
+    unsigned long long lat_max;
+    int error;
+};
+
+static long long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* values below 2 * LAT_SUB have a bucket each, above that LAT_SUB buckets per power of two */
+static unsigned int lat_bucket(unsigned long long us)
+{
+    unsigned int shift = 0;
+
+    while((us >> shift) >= 2 * LAT_SUB)
+        shift++;
+    if(shift > LAT_MAX_SHIFT)
+        return LAT_BUCKETS - 1;
+    return shift * LAT_SUB + (us >> shift);
+}
+
+/* smallest value of a bucket */
+static unsigned long long lat_value(unsigned int idx)
+{
+    unsigned int shift;
+
+    if(idx < 2 * LAT_SUB)
+        return idx;
+    shift = idx / LAT_SUB - 1;
+    return (unsigned long long) (idx - shift * LAT_SUB) << shift;
+}
+
+static unsigned long long next_lba(struct worker *w)
+{
+    struct bench *b = w->b;
+    unsigned long long span = b->blocks - b->bs / b->lba_size + 1;
+    unsigned long long off;
+
+    if(b->random)
+    {
+        off = ((unsigned long long) rand_r(&w->seed) << 31 | rand_r(&w->seed)) % span;
+        return b->first + off / (b->bs / b->lba_size) * (b->bs / b->lba_size);
+    }
+    off = __atomic_fetch_add(&b->seq_next, b->bs / b->lba_size, __ATOMIC_RELAXED) % span;
+    return b->first + off;
+}
+
+static int sg_rw(int fd, int write, unsigned long long lba, unsigned int lba_size, unsigned char *buf, unsigned int len)
+{
+    int i;
+    unsigned int blocks = len / lba_size;
+    unsigned char cmd[16];
+    unsigned char sense[32];
+    sg_io_hdr_t io_hdr;
+
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0] = write ? 0x8a : 0x88;       /* WRITE(16) : READ(16) */
+    for(i = 0 ; i < 8 ; i++)
+        cmd[2 + i] = lba >> (56 - 8 * i);
+    for(i = 0 ; i < 4 ; i++)
+        cmd[10 + i] = blocks >> (24 - 8 * i);
+
+    memset(&io_hdr, 0, sizeof(io_hdr));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = sizeof(cmd);
+    io_hdr.mx_sb_len = sizeof(sense);
+    io_hdr.dxfer_direction = write ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = len;
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = cmd;
+    io_hdr.sbp = sense;
+    io_hdr.timeout = 60000;
+    if(ioctl(fd, SG_IO, &io_hdr) < 0 || (io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void *bench_worker(void *arg)
+{
+    struct worker *w = (struct worker*) arg;
+    struct bench *b = w->b;
+    unsigned char *buf;
+    long long end = now_us() + b->seconds * 1000000LL;
+    long long start;
+    unsigned long long lba, us;
+    int ret;
+
+    if(posix_memalign((void**) &buf, 4096, b->bs) != 0)
+    {
+        w->error = ENOMEM;
+        return NULL;
+    }
+    memset(buf, 0x5a, b->bs);
+    while((start = now_us()) < end)
+    {
+        lba = next_lba(w);
+        if(b->mode == MODE_SG)
+            ret = sg_rw(w->fd, b->write, lba, b->lba_size, buf, b->bs);
+        else if(b->write)
+            ret = pwrite(w->fd, buf, b->bs, lba * b->lba_size) == b->bs ? 0 : -1;
+        else
+            ret = pread(w->fd, buf, b->bs, lba * b->lba_size) == b->bs ? 0 : -1;
+        if(ret < 0)
+        {
+            w->error = errno ? errno : EIO;
+            break;
+        }
+        us = now_us() - start;
+        w->lat[lat_bucket(us)]++;
+        if(us > w->lat_max)
+            w->lat_max = us;
+        w->ios++;
+    }
+    free(buf);
+    return NULL;
+}
+
+/* upper end of the bucket holding the pct percentile, never above the largest sample */
+static unsigned long long percentile(unsigned long long *lat, unsigned long long num, unsigned long long max, double pct)
+{
+    unsigned int i;
+    unsigned long long rank = num * pct / 100;
+    unsigned long long seen = 0;
+
+    if(num == 0)
+        return 0;
+    for(i = 0 ; i < LAT_BUCKETS - 1 ; i++)
+    {
+        seen += lat[i];
+        if(seen > rank)
+            break;
+    }
+    if(i == LAT_BUCKETS - 1 || lat_value(i + 1) - 1 > max)
+        return max;
+    return lat_value(i + 1) - 1;
+}
+
+/* one point of the sweep, queue depth is the number of threads with a request outstanding */
+static int run_point(struct bench *b, int depth)
+{
+    int i, k, fd;
+    int flags = b->write ? O_RDWR : O_RDONLY;
+    unsigned long long ios = 0;
+    unsigned long long num = 0, max = 0;
+    unsigned long long all[LAT_BUCKETS];
+    long long start;
+    double sec;
+    struct worker *ws = (struct worker*) calloc(depth, sizeof(struct worker));
+
+    if(ws == NULL)
+    {
+        fprintf(stderr, "%s: out of memory for %d workers\n", b->path, depth);
+        return -1;
+    }
+    if(b->mode == MODE_DIRECT)
+        flags |= O_DIRECT;
+    if((fd = open(b->path, flags)) < 0 && b->mode == MODE_DIRECT && errno == EINVAL)
+    {
+        /* tmpfs and a few others refuse O_DIRECT, still useful as a stand-in */
+        fprintf(stderr, "%s: no O_DIRECT, falling back to buffered I/O\n", b->path);
+        fd = open(b->path, flags & ~O_DIRECT);
+    }
+    if(fd < 0)
+    {
+        perror(b->path);
+        free(ws);
+        return -1;
+    }
+    b->seq_next = 0;
+    start = now_us();
+    for(i = 0 ; i < depth ; i++)
+    {
+        ws[i].b = b;
+        ws[i].fd = fd;
+        ws[i].seed = i * 7919 + 1;
+        if(pthread_create(&ws[i].tid, NULL, bench_worker, &ws[i]) != 0)
+        {
+            fprintf(stderr, "%s: can not start worker %d, running at depth %d\n", b->path, i, i);
+            depth = i;
+            break;
+        }
+    }
+    memset(all, 0, sizeof(all));
+    for(i = 0 ; i < depth ; i++)
+    {
+        pthread_join(ws[i].tid, NULL);
+        ios += ws[i].ios;
+        for(k = 0 ; k < LAT_BUCKETS ; k++)
+            all[k] += ws[i].lat[k];
+        if(ws[i].lat_max > max)
+            max = ws[i].lat_max;
+        if(ws[i].error)
+            fprintf(stderr, "%s: %s\n", b->path, strerror(ws[i].error));
+    }
+    sec = (now_us() - start) / 1e6;
+    close(fd);
+    num = ios;
+
+    printf("%-6s %-4s %-5s %8u %5d %10.1f %10.0f %8llu %8llu %8llu %8llu\n",
+           b->mode == MODE_SG ? "sg" : "direct", b->random ? "rand" : "seq", b->write ? "write" : "read",
+           b->bs, depth, ios * b->bs / 1e6 / sec, ios / sec,
+           percentile(all, num, max, 50), percentile(all, num, max, 99), percentile(all, num, max, 99.9), max);
+    free(ws);
+    return 0;
+}
+
+/* "4k,64k,1m" */
+static int parse_list(char *s, unsigned int *vals, int max)
+{
+    int n = 0;
+    char *tok, *end, *save;
+
+    for(tok = strtok_r(s, ",", &save) ; tok && n < max ; tok = strtok_r(NULL, ",", &save))
+    {
+        unsigned long v = strtoul(tok, &end, 0);
+        if(*end == 'k' || *end == 'K')
+            v <<= 10;
+        else if(*end == 'm' || *end == 'M')
+            v <<= 20;
+        vals[n++] = v;
+    }
+    return n;
+}
+
+/* READ CAPACITY(16), answered by /dev/sgN and SCSI /dev/sdX alike; blocks of *lba_size bytes, 0 when it fails */
+static unsigned long long read_capacity(int fd, unsigned int *lba_size)
+{
+    int i;
+    unsigned char cmd[16];
+    unsigned char buf[32];
+    unsigned char sense[32];
+    unsigned long long last = 0;
+    unsigned int len = 0;
+    sg_io_hdr_t io_hdr;
+
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0] = 0x9e;                      /* SERVICE ACTION IN(16) */
+    cmd[1] = 0x10;                      /* READ CAPACITY(16) */
+    cmd[13] = sizeof(buf);
+    memset(buf, 0, sizeof(buf));
+
+    memset(&io_hdr, 0, sizeof(io_hdr));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = sizeof(cmd);
+    io_hdr.mx_sb_len = sizeof(sense);
+    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = sizeof(buf);
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = cmd;
+    io_hdr.sbp = sense;
+    io_hdr.timeout = 60000;
+    if(ioctl(fd, SG_IO, &io_hdr) < 0 || (io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+    {
+        return 0;
+    }
+    for(i = 0 ; i < 8 ; i++)
+        last = last << 8 | buf[i];
+    for(i = 8 ; i < 12 ; i++)
+        len = len << 8 | buf[i];
+    if(len == 0)
+    {
+        return 0;
+    }
+    *lba_size = len;
+    return last + 1;
+}
+
+/* size in logical blocks, asked once at startup; *lba_size is the block length the LBAs count in */
+static unsigned long long get_blocks(const char *path, unsigned int *lba_size)
+{
+    int fd;
+    int ssz = 0;
+    unsigned long long blocks = 0;
+    unsigned long long bytes = 0;
+    struct stat st;
+
+    *lba_size = LBA_SIZE;
+    if((fd = open(path, O_RDONLY)) < 0)
+    {
+        return 0;
+    }
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        blocks = st.st_size / LBA_SIZE;
+    /* BLKGETSIZE64 is a block device ioctl, an sg node only answers SCSI commands */
+    else if((blocks = read_capacity(fd, lba_size)) == 0 && ioctl(fd, BLKGETSIZE64, &bytes) == 0)
+    {
+        if(ioctl(fd, BLKSSZGET, &ssz) == 0 && ssz > 0)
+            *lba_size = ssz;
+        blocks = bytes / *lba_size;
+    }
+    close(fd);
+    return blocks;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, j, m;
+    int modes = MODE_SG | MODE_DIRECT;
+    unsigned int depths[MAX_POINTS] = {1, 4, 16, 32};
+    unsigned int sizes[MAX_POINTS] = {4096, 65536, 1048576};
+    int depth_num = 4, size_num = 3;
+    unsigned long long scratch_first = 0, scratch_blocks = 0;
+    struct bench b;
+    struct stat st;
+
+    memset(&b, 0, sizeof(b));
+    b.seconds = DEFAULT_SECONDS;
+    while((c = getopt(argc, argv, "p:q:b:t:w:m:")) != -1)
+    {
+        switch(c)
+        {
+            case 'p':
+                b.random = !strcmp(optarg, "rand");
+                break;
+            case 'q':
+                depth_num = parse_list(optarg, depths, MAX_POINTS);
+                break;
+            case 'b':
+                size_num = parse_list(optarg, sizes, MAX_POINTS);
+                break;
+            case 't':
+                b.seconds = atoi(optarg);
+                break;
+            case 'w':
+                /* writes only ever touch this range, in logical blocks of the device */
+                if(sscanf(optarg, "%llu:%llu", &scratch_first, &scratch_blocks) != 2)
+                {
+                    fprintf(stderr, "-w start:blocks\n");
+                    return 1;
+                }
+                b.write = 1;
+                break;
+            case 'm':
+                modes = !strcmp(optarg, "sg") ? MODE_SG : !strcmp(optarg, "direct") ? MODE_DIRECT : MODE_SG | MODE_DIRECT;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-p seq|rand] [-q 1,4,16] [-b 4k,64k,1m] [-t sec] [-w start:blocks] [-m sg|direct|both] <dev>\n", argv[0]);
+                return 1;
+        }
+    }
+    if(optind >= argc)
+    {
+        fprintf(stderr, "please enter a device or file\n");
+        return 1;
+    }
+    b.path = argv[optind];
+    if(stat(b.path, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        modes &= ~MODE_SG;      /* a file stand-in has no SCSI layer */
+    }
+    b.first = 0;
+    b.blocks = get_blocks(b.path, &b.lba_size);
+    if(b.write)
+    {
+        if(scratch_first + scratch_blocks > b.blocks)
+        {
+            fprintf(stderr, "scratch range past the end (%llu blocks of %u bytes)\n", b.blocks, b.lba_size);
+            return 1;
+        }
+        b.first = scratch_first;
+        b.blocks = scratch_blocks;
+    }
+    if(b.blocks == 0)
+    {
+        fprintf(stderr, "%s: unknown size\n", b.path);
+        return 1;
+    }
+
+    printf("%-6s %-4s %-5s %8s %5s %10s %10s %8s %8s %8s %8s\n",
+           "mode", "pat", "op", "bs", "qd", "MB/s", "IOPS", "p50 us", "p99 us", "p999 us", "max us");
+    for(m = MODE_SG ; m <= MODE_DIRECT ; m <<= 1)
+    {
+        if(!(modes & m))
+            continue;
+        b.mode = m;
+        for(i = 0 ; i < size_num ; i++)
+        {
+            b.bs = sizes[i];
+            if(b.bs < b.lba_size || b.bs % b.lba_size || b.bs / b.lba_size > b.blocks)
+                continue;
+            for(j = 0 ; j < depth_num ; j++)
+            {
+                if(depths[j] < 1 || depths[j] > MAX_DEPTH)
+                    continue;
+                run_point(&b, depths[j]);
+            }
+        }
+    }
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include <scsi/sg.h> /* take care: fetches glibc's /usr/include/scsi/sg.h */
 
 #include "test_sas.h"
+#include "../sata/sat_layer.h"
 void test_vpd_page_b2(char *dev, char *cmd_str);
 
 unsigned short get_cmd_len(char *cmd_str)
@@ -59,27 +60,28 @@ void cmd_str_to_buf(char *cmd_str, unsigned char *cmd)
     }
 }
 
-int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, unsigned short buf_len, unsigned char *buf)
+int _send_scsi_command_sense(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                             unsigned char *sense, unsigned char sense_len)
 {
     int ret = 0;
     int sg_fd;
     sg_io_hdr_t io_hdr;
-    unsigned char sense_buffer[32];
 
     if ((sg_fd = open(dev, O_RDONLY)) < 0) {
         perror("error opening given file name");
         return -1;
     }
 
+    memset(sense, 0, sense_len);
     memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
     io_hdr.interface_id = 'S';
     io_hdr.cmd_len = cmd_len;
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.mx_sb_len = sense_len;
+    io_hdr.dxfer_direction = buf_len ? SG_DXFER_FROM_DEV : SG_DXFER_NONE;
     io_hdr.dxfer_len = buf_len;
     io_hdr.dxferp = buf;
     io_hdr.cmdp = cmd;
-    io_hdr.sbp = sense_buffer;
+    io_hdr.sbp = sense;
     io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
 
     if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
@@ -87,8 +89,26 @@ int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, uns
         ret = -1;
         goto send_exit;
     }
-    
+
+    /* -2: the sense data is in sense */
     if ((io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK) 
+    {
+        ret = -2;
+        goto send_exit;
+    }
+
+send_exit:
+    close(sg_fd);
+    return ret;
+}
+
+int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, unsigned short buf_len, unsigned char *buf)
+{
+    int ret = 0;
+    unsigned char sense_buffer[32];
+
+    ret = _send_scsi_command_sense(dev, cmd_len, cmd, buf_len, buf, sense_buffer, sizeof(sense_buffer));
+    if(ret == -2)
     {
         printf("SG info is not ok\n");
         int i;
@@ -98,13 +118,8 @@ int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, uns
         }
         printf("\n");
         ret = -1;
-        goto send_exit;
     }
-
-send_exit:
-    close(sg_fd);
     return ret;
-
 }
 
 void dump_buf(unsigned char *buf)
@@ -209,12 +224,36 @@ void test_vpd_page_b2(char *dev, char *cmd_str)
     printf("\n");
 }
 
-void test_ata_passthrough12(char *dev)
+/*
+ * READ LOG EXT of log 0x30 page 0, the cdb form (PT12 / PT16) comes from the sat layer.
+ */
+void test_ata_passthrough(char *dev)
 {
-    char *cmd = "a1,08,0e,00,01,30,00,00,00,2f,00,00";
-    //char *cmd = "a1,08,0e,00,01,00,00,00,00,ec,00,00";
-    struct scsi_12_01_b2 data;
-    send_scsi_command(dev, cmd, &data, parsebuf_a1h);
+    int ret;
+    int cmd_len;
+    unsigned char cmd[16];
+    unsigned char buf[512];
+    struct ata_tf tf;
+    SAT_TRANSPORT transport;
+
+    transport = sat_detect(dev);
+    memset(&tf, 0, sizeof(tf));
+    tf.command = 0x2f;
+    tf.count = 1;
+    tf.lba = 0x30;
+    tf.ext = 1;
+    //tf.command = 0xec; tf.ext = 0;
+    cmd_len = sat_build_cdb(transport, &tf, ATA_PROT_PIO_IN, cmd);
+    if(cmd_len < 0)
+    {
+        printf("no ATA pass-through on %s (transport %d)\n", dev, transport);
+        return;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    ret = _send_scsi_command(dev, cmd_len, cmd, sizeof(buf), buf);
+    printf("cmd_len : ret = (%d, %d)\n", cmd_len, ret);
+    parsebuf_a1h(buf, NULL);
 }
 
 int main(int argc, char * argv[])
@@ -224,7 +263,7 @@ int main(int argc, char * argv[])
     test_vpd_page_00(argv[1], argv[2]);
     //test_vpd_page_b2(argv[1], argv[2]);
     */
-    test_ata_passthrough12(argv[1]);
+    test_ata_passthrough(argv[1]);
     return 0;
 }
 #endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sg_command.h"
+#include "power_gate.h"
+#include "sat_layer.h"
+
+/*
+ * Power state gate of the SG send layer.
+ * A command that would spin up a disk in standby is answered with the data
+ * the disk returned for the same cdb while it was up (the last
+ * POWER_GATE_ANSWERS data-in commands are kept per disk), or held back with
+ * POWER_GATE_STANDBY when there is none, so health collection and polls
+ * never wake a sleeping disk. The state is probed with commands that do not wake the disk
+ * and cached for POWER_GATE_TTL_SEC, a probe that could not tell for
+ * POWER_GATE_UNKNOWN_TTL_SEC so a disk that does not answer it is not probed
+ * before every command. A caller that must reach the disk opts in
+ * with power_gate_allow_wake(1).
+ */
+
+static struct power_dev devs[POWER_GATE_MAX_DEV];
+static int dev_num = 0;
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int allow_wake = 0;
+
+static time_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/*
+ * Let the following commands of this thread wake a standby disk.
+ * @return previous setting, to be restored after the essential command.
+ */
+int power_gate_allow_wake(int allow)
+{
+    int old = allow_wake;
+    allow_wake = allow;
+    return old;
+}
+
+/* ATA command of an ATA PASS-THROUGH (12)/(16) cdb, -1 for other cdbs */
+static int ata_command(unsigned char *cmd)
+{
+    if(cmd[0] == 0xa1)
+        return cmd[9];
+    if(cmd[0] == 0x85)
+        return cmd[14];
+    return -1;
+}
+
+/* commands a disk in standby answers without spinning up */
+static int is_non_waking(unsigned char *cmd)
+{
+    switch(ata_command(cmd))
+    {
+        case 0xe5:          /* CHECK POWER MODE */
+        case 0xe0:          /* STANDBY IMMEDIATE */
+        case 0xe2:          /* STANDBY */
+        case 0xe6:          /* SLEEP */
+            return 1;
+        case -1:
+            break;
+        default:
+            return 0;
+    }
+    switch(cmd[0])
+    {
+        case 0x00:          /* TEST UNIT READY */
+        case 0x03:          /* REQUEST SENSE */
+        case 0x12:          /* INQUIRY */
+        case 0x1b:          /* START STOP UNIT, the caller asks for the change */
+        case 0xa0:          /* REPORT LUNS */
+            return 1;
+    }
+    return 0;
+}
+
+/* gate_lock held */
+static struct power_dev *get_dev(char *dev, int create)
+{
+    int i;
+    for(i = 0 ; i < dev_num ; i++)
+    {
+        if(!strcmp(devs[i].dev, dev))
+            return &devs[i];
+    }
+    if(!create || dev_num == POWER_GATE_MAX_DEV)
+    {
+        return NULL;
+    }
+    memset(&devs[dev_num], 0, sizeof(devs[dev_num]));
+    snprintf(devs[dev_num].dev, sizeof(devs[dev_num].dev), "%s", dev);
+    devs[dev_num].is_ata = -1;
+    return &devs[dev_num++];
+}
+
+/* gate_lock held */
+static struct power_answer *find_answer(struct power_dev *p, unsigned short cmd_len, unsigned char *cmd,
+                                        unsigned short buf_len)
+{
+    int i;
+
+    for(i = 0 ; i < POWER_GATE_ANSWERS ; i++)
+    {
+        struct power_answer *a = &p->answers[i];
+        if(a->cmd_len == cmd_len && a->buf_len == buf_len && !memcmp(a->cmd, cmd, cmd_len))
+            return a;
+    }
+    return NULL;
+}
+
+/* gate_lock held */
+static void keep_answer(struct power_dev *p, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len,
+                        unsigned char *buf)
+{
+    struct power_answer *a;
+
+    if((a = find_answer(p, cmd_len, cmd, buf_len)) == NULL)
+    {
+        a = &p->answers[p->next_answer];
+        p->next_answer = (p->next_answer + 1) % POWER_GATE_ANSWERS;
+        free(a->buf);
+        a->cmd_len = 0;
+        if((a->buf = (unsigned char*) malloc(buf_len)) == NULL)
+        {
+            return;
+        }
+        memcpy(a->cmd, cmd, cmd_len);
+        a->cmd_len = cmd_len;
+        a->buf_len = buf_len;
+    }
+    memcpy(a->buf, buf, buf_len);
+    a->stamp = now_sec();
+}
+
+/* gate_lock held */
+static void free_answers(struct power_dev *p)
+{
+    int i;
+
+    for(i = 0 ; i < POWER_GATE_ANSWERS ; i++)
+    {
+        free(p->answers[i].buf);
+        p->answers[i].buf = NULL;
+        p->answers[i].cmd_len = 0;
+    }
+}
+
+static void set_state(char *dev, POWER_STATE state)
+{
+    struct power_dev *p;
+
+    pthread_mutex_lock(&gate_lock);
+    if((p = get_dev(dev, 1)) != NULL)
+    {
+        p->state = state;
+        /* UNKNOWN here means the state was changed, probe on the next check */
+        p->stamp = state == POWER_STATE_UNKNOWN ? 0 : now_sec();
+    }
+    pthread_mutex_unlock(&gate_lock);
+}
+
+/*
+ * Read the power state from the disk without waking it.
+ * SATA: CHECK POWER MODE with ck_cond, the count register comes back in the
+ * ATA return of the sense data (descriptor or fixed format), 0x00 is standby.
+ * SAS: REQUEST SENSE, ASC 0x5e with a standby ASCQ.
+ */
+POWER_STATE power_gate_probe(char *dev)
+{
+    int is_ata, len, count;
+    unsigned char cmd[16];
+    unsigned char buf[96];
+    unsigned char sense[32];
+    struct ata_tf tf;
+    SAT_TRANSPORT transport;
+    POWER_STATE state = POWER_STATE_UNKNOWN;
+    struct power_dev *p;
+
+    pthread_mutex_lock(&gate_lock);
+    p = get_dev(dev, 1);
+    is_ata = p ? p->is_ata : -1;
+    pthread_mutex_unlock(&gate_lock);
+
+    /* the gate does not probe the SAT layer itself, the probe is sent through the gate */
+    transport = sat_cached(dev);
+    if(transport != SAT_UNKNOWN)
+    {
+        is_ata = transport != SAT_NONE;
+    }
+    else if(is_ata < 0)
+    {
+        /* no answer stays UNKNOWN, cached so the next commands do not ask again */
+        if(send_scsi_command_with_buf(dev, "12,00,00,00,60,00", buf, sizeof(buf)) == 0)
+        {
+            is_ata = !memcmp(buf + 8, "ATA     ", 8);
+        }
+    }
+
+    if(is_ata > 0)
+    {
+        memset(&tf, 0, sizeof(tf));
+        tf.command = 0xe5;
+        tf.ck_cond = 1;
+        len = sat_build_cdb(transport == SAT_PT16 ? SAT_PT16 : SAT_PT12, &tf, ATA_PROT_NON_DATA, cmd);
+        if(_send_scsi_command_sense(dev, len, cmd, 0, NULL, sense, sizeof(sense)) == -2 &&
+           (count = sat_ata_count(sense)) >= 0)
+        {
+            state = count == 0x00 ? POWER_STATE_STANDBY : POWER_STATE_ACTIVE;
+        }
+    }
+    else if(is_ata == 0)
+    {
+        cmd_str_to_buf("03,00,00,00,12,00", cmd);
+        if(_send_scsi_command_sense(dev, 6, cmd, 18, buf, sense, sizeof(sense)) == 0)
+        {
+            /* standby by timer/command, standby_y by timer/command, change to standby */
+            if(buf[12] == 0x5e && (buf[13] == 0x02 || buf[13] == 0x04 || buf[13] == 0x09 || buf[13] == 0x0a ||
+                                   buf[13] == 0x43))
+                state = POWER_STATE_STANDBY;
+            else
+                state = POWER_STATE_ACTIVE;
+        }
+    }
+
+    pthread_mutex_lock(&gate_lock);
+    if((p = get_dev(dev, 1)) != NULL)
+    {
+        p->is_ata = is_ata;
+        p->state = state;
+        p->stamp = now_sec();
+    }
+    pthread_mutex_unlock(&gate_lock);
+    return state;
+}
+
+/*
+ * cached state, probed again once it is older than POWER_GATE_TTL_SEC
+ * (POWER_GATE_UNKNOWN_TTL_SEC when the last probe could not tell)
+ */
+POWER_STATE power_gate_get_state(char *dev)
+{
+    POWER_STATE state = POWER_STATE_UNKNOWN;
+    struct power_dev *p;
+    int cached = 0;
+
+    pthread_mutex_lock(&gate_lock);
+    if((p = get_dev(dev, 0)) != NULL && p->stamp != 0 &&
+       now_sec() - p->stamp < (p->state == POWER_STATE_UNKNOWN ? POWER_GATE_UNKNOWN_TTL_SEC : POWER_GATE_TTL_SEC))
+    {
+        state = p->state;
+        cached = 1;
+    }
+    pthread_mutex_unlock(&gate_lock);
+    if(!cached)
+    {
+        state = power_gate_probe(dev);
+    }
+    return state;
+}
+
+/*
+ * Called before a cdb is sent.
+ * @retval 0 Send it.
+ * @retval POWER_GATE_ANSWERED The disk is in standby, buf holds what it returned for the same cdb while it was up.
+ * @retval POWER_GATE_STANDBY The disk is in standby and the command would wake it.
+ */
+int power_gate_check(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf)
+{
+    int ret = POWER_GATE_STANDBY;
+    struct power_dev *p;
+    struct power_answer *a;
+
+    if(allow_wake || is_non_waking(cmd))
+    {
+        return 0;
+    }
+    if(power_gate_get_state(dev) != POWER_STATE_STANDBY)
+    {
+        return 0;
+    }
+    if(buf_len == 0)
+    {
+        return ret;
+    }
+    pthread_mutex_lock(&gate_lock);
+    if((p = get_dev(dev, 0)) != NULL && (a = find_answer(p, cmd_len, cmd, buf_len)) != NULL)
+    {
+        memcpy(buf, a->buf, buf_len);
+        ret = POWER_GATE_ANSWERED;
+    }
+    pthread_mutex_unlock(&gate_lock);
+    return ret;
+}
+
+/*
+ * Called after a cdb completed, keeps the cached state in step with what the
+ * command did to the disk and keeps its data for when the disk sleeps.
+ */
+void power_gate_done(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                     int ret)
+{
+    int ata = ata_command(cmd);
+    struct power_dev *p;
+
+    if(ret != 0)
+    {
+        return;
+    }
+    if(buf_len > 0 && buf_len <= POWER_GATE_ANSWER_LEN && cmd_len <= sizeof(p->answers[0].cmd) && !is_non_waking(cmd))
+    {
+        pthread_mutex_lock(&gate_lock);
+        if((p = get_dev(dev, 1)) != NULL)
+            keep_answer(p, cmd_len, cmd, buf_len, buf);
+        pthread_mutex_unlock(&gate_lock);
+    }
+    if(ata == 0xe0 || ata == 0xe2 || ata == 0xe6)
+        set_state(dev, POWER_STATE_STANDBY);
+    else if(cmd[0] == 0x1b)
+        set_state(dev, POWER_STATE_UNKNOWN);
+    else if(!is_non_waking(cmd))
+        set_state(dev, POWER_STATE_ACTIVE);
+}
+
+/* the device node went away or now names another disk, NULL forgets every device */
+void power_gate_forget(char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&gate_lock);
+    for(i = 0 ; i < dev_num ; i++)
+    {
+        if(dev == NULL)
+        {
+            free_answers(&devs[i]);
+        }
+        else if(!strcmp(devs[i].dev, dev))
+        {
+            free_answers(&devs[i]);
+            devs[i] = devs[--dev_num];
+            break;
+        }
+    }
+    if(dev == NULL)
+    {
+        dev_num = 0;
+    }
+    pthread_mutex_unlock(&gate_lock);
+}
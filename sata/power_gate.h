@@ -0,0 +1,49 @@
+#ifndef _POWER_GATE_H
+#define _POWER_GATE_H
+
+#include <time.h>
+
+#define POWER_GATE_MAX_DEV      256
+#define POWER_GATE_TTL_SEC      10      /* power state is probed again after this */
+#define POWER_GATE_UNKNOWN_TTL_SEC  30  /* a probe that could not tell is not repeated before this */
+#define POWER_GATE_STANDBY      -3      /* send result of a command held back from a standby disk */
+#define POWER_GATE_ANSWERS      8       /* last data-in answers kept per disk for when it sleeps */
+#define POWER_GATE_ANSWER_LEN   4096    /* longer answers are not kept */
+#define POWER_GATE_ANSWERED     1       /* power_gate_check() filled buf from an earlier answer */
+
+typedef enum _POWER_STATE
+{
+    POWER_STATE_UNKNOWN = 0,
+    POWER_STATE_ACTIVE,                 /*!< active or idle, commands do not spin it up */
+    POWER_STATE_STANDBY,
+} POWER_STATE;
+
+/*
+ * A data-in command the disk completed while it was up, with its data.
+ */
+struct power_answer {
+    unsigned char cmd[16];
+    unsigned short cmd_len;             /*!< 0 for a free entry */
+    unsigned short buf_len;
+    unsigned char *buf;
+    time_t stamp;
+};
+
+struct power_dev {
+    char dev[64];
+    int is_ata;                         /*!< SATA behind the SAT layer, probed with CHECK POWER MODE */
+    POWER_STATE state;
+    time_t stamp;                       /*!< of the last probe or state change, 0 to probe on the next check */
+    struct power_answer answers[POWER_GATE_ANSWERS];
+    int next_answer;                    /*!< entry replaced when all are taken */
+};
+
+int power_gate_allow_wake(int allow);
+int power_gate_check(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf);
+void power_gate_done(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                     int ret);
+POWER_STATE power_gate_get_state(char *dev);
+POWER_STATE power_gate_probe(char *dev);
+void power_gate_forget(char *dev);
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "qos_budget.h"
+
+/*
+ * Passthrough budget per disk.
+ * Every SG command spends one command token and its transfer length in byte
+ * tokens. Tokens refill at the full rate while the disk is idle, at
+ * QOS_LOAD_SHARE percent while the block layer shows foreground I/O, and not
+ * at all once the disk is saturated. A command that finds no token waits,
+ * and after QOS_MAX_WAIT_MS it is deferred so collection gives way to the
+ * application instead of queueing behind it.
+ */
+
+static struct qos_disk disks[QOS_MAX_DISK];
+static int disk_num = 0;
+static int cmd_rate = QOS_CMD_RATE;
+static int byte_rate = QOS_BYTE_RATE;
+static pthread_mutex_t qos_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread int bypass_budget = 0;
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void qos_budget_set_rate(int cmds, int bytes)
+{
+    pthread_mutex_lock(&qos_lock);
+    cmd_rate = cmds;
+    byte_rate = bytes;
+    pthread_mutex_unlock(&qos_lock);
+}
+
+/*
+ * Commands of this thread skip the budget (a user request, error recovery).
+ * @return previous setting.
+ */
+int qos_budget_bypass(int bypass)
+{
+    int old = bypass_budget;
+    bypass_budget = bypass;
+    return old;
+}
+
+/* /dev/sgN -> the block device of the same scsi device, /dev/sdX -> sdX */
+static void get_block_name(const char *dev, char *blk, int len)
+{
+    char path[128];
+    const char *name = strrchr(dev, '/') ? strrchr(dev, '/') + 1 : dev;
+    struct dirent *de;
+    DIR *dr;
+
+    blk[0] = '\0';
+    if(strncmp(name, "sg", 2))
+    {
+        snprintf(blk, len, "%s", name);
+        return;
+    }
+    snprintf(path, sizeof(path), "/sys/class/scsi_generic/%s/device/block", name);
+    if((dr = opendir(path)) == NULL)
+    {
+        return;
+    }
+    while((de = readdir(dr)) != NULL)
+    {
+        if(de->d_name[0] != '.')
+        {
+            snprintf(blk, len, "%s", de->d_name);
+            break;
+        }
+    }
+    closedir(dr);
+}
+
+/* qos_lock held */
+static struct qos_disk *get_disk(const char *dev)
+{
+    int i;
+    struct qos_disk *d;
+
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+            return &disks[i];
+    }
+    if(disk_num == QOS_MAX_DISK)
+    {
+        return NULL;
+    }
+    d = &disks[disk_num++];
+    memset(d, 0, sizeof(*d));
+    snprintf(d->dev, sizeof(d->dev), "%s", dev);
+    get_block_name(dev, d->blk, sizeof(d->blk));
+    d->cmd_tokens = cmd_rate;
+    d->byte_tokens = byte_rate;
+    d->refill_ms = now_ms();
+    return d;
+}
+
+/*
+ * Foreground load from the block layer: in-flight requests and the busy
+ * share of io_ticks since the last sample. Passthrough requests are not
+ * accounted there, so our own commands do not count as load.
+ * qos_lock held.
+ */
+static void update_load(struct qos_disk *d, long long now)
+{
+    char path[96];
+    unsigned long v[11];
+    unsigned long reads, writes;
+    FILE *fp;
+
+    if(d->blk[0] == '\0' || now - d->stat_ms < QOS_STAT_INTERVAL_MS)
+    {
+        return;
+    }
+    snprintf(path, sizeof(path), "/sys/block/%s/stat", d->blk);
+    if((fp = fopen(path, "r")) != NULL)
+    {
+        if(fscanf(fp, "%lu %lu %lu %lu %lu %lu %lu %lu %lu %lu", &v[1], &v[2], &v[3], &v[4], &v[5],
+                  &v[6], &v[7], &v[8], &v[9], &v[10]) == 10)
+        {
+            if(d->stat_ms)
+            {
+                d->busy_pct = (v[10] - d->io_ticks) * 100 / (now - d->stat_ms);
+                if(d->busy_pct > 100)
+                    d->busy_pct = 100;
+            }
+            d->io_ticks = v[10];
+            d->inflight = v[9];
+        }
+        fclose(fp);
+    }
+    snprintf(path, sizeof(path), "/sys/block/%s/inflight", d->blk);
+    if((fp = fopen(path, "r")) != NULL)
+    {
+        if(fscanf(fp, "%lu %lu", &reads, &writes) == 2)
+            d->inflight = reads + writes;
+        fclose(fp);
+    }
+    d->stat_ms = now;
+}
+
+/* qos_lock held */
+static void refill(struct qos_disk *d, long long now)
+{
+    int share = 100;
+    double sec = (now - d->refill_ms) / 1000.0;
+
+    if(d->busy_pct >= QOS_SATURATED_PCT)
+        share = 0;
+    else if(d->busy_pct >= QOS_BUSY_PCT || d->inflight > 0)
+        share = QOS_LOAD_SHARE;
+
+    d->cmd_tokens += sec * cmd_rate * share / 100;
+    d->byte_tokens += sec * byte_rate * share / 100;
+    if(d->cmd_tokens > cmd_rate)
+        d->cmd_tokens = cmd_rate;
+    if(d->byte_tokens > byte_rate)
+        d->byte_tokens = byte_rate;
+    d->refill_ms = now;
+}
+
+/*
+ * Spend budget for one command of bytes to dev, waiting for it if needed.
+ * A transfer larger than the byte rate goes once the bucket is full and
+ * leaves it in debt.
+ * @retval 0 Send it.
+ * @retval QOS_BUDGET_DEFERRED The disk stayed busy for QOS_MAX_WAIT_MS.
+ */
+int qos_budget_acquire(char *dev, unsigned int bytes)
+{
+    long long now = now_ms();
+    long long deadline = now + QOS_MAX_WAIT_MS;
+    struct qos_disk *d;
+
+    if(bypass_budget)
+    {
+        return 0;
+    }
+    while(1)
+    {
+        pthread_mutex_lock(&qos_lock);
+        if((d = get_disk(dev)) == NULL)
+        {
+            pthread_mutex_unlock(&qos_lock);
+            return 0;
+        }
+        update_load(d, now);
+        refill(d, now);
+        if(d->cmd_tokens >= 1 && (d->byte_tokens >= bytes || d->byte_tokens >= byte_rate))
+        {
+            d->cmd_tokens -= 1;
+            d->byte_tokens -= bytes;
+            pthread_mutex_unlock(&qos_lock);
+            return 0;
+        }
+        if(now >= deadline)
+        {
+            d->deferred++;
+            pthread_mutex_unlock(&qos_lock);
+            return QOS_BUDGET_DEFERRED;
+        }
+        pthread_mutex_unlock(&qos_lock);
+        usleep(20000);
+        now = now_ms();
+    }
+}
+
+int qos_budget_get(char *dev, struct qos_disk *disk)
+{
+    int i;
+    int ret = -1;
+
+    pthread_mutex_lock(&qos_lock);
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+        {
+            *disk = disks[i];
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&qos_lock);
+    return ret;
+}
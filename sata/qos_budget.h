@@ -0,0 +1,32 @@
+#ifndef _QOS_BUDGET_H
+#define _QOS_BUDGET_H
+
+#define QOS_MAX_DISK            256
+#define QOS_CMD_RATE            20                  /* passthrough commands per second per idle disk */
+#define QOS_BYTE_RATE           (4 * 1024 * 1024)   /* passthrough bytes per second per idle disk */
+#define QOS_LOAD_SHARE          10                  /* percent of the rates left under foreground load */
+#define QOS_BUSY_PCT            10                  /* io_ticks share that counts as foreground load */
+#define QOS_SATURATED_PCT       60                  /* no passthrough at all above this */
+#define QOS_STAT_INTERVAL_MS    100                 /* /sys/block/<disk>/stat sampling */
+#define QOS_MAX_WAIT_MS         2000                /* then the command is deferred */
+#define QOS_BUDGET_DEFERRED     -4                  /* send result of a command held back by the budget */
+
+struct qos_disk {
+    char dev[64];                       /*!< "/dev/sg1" */
+    char blk[32];                       /*!< "sdb", empty when there is no block device */
+    double cmd_tokens;
+    double byte_tokens;
+    long long refill_ms;
+    long long stat_ms;
+    unsigned long io_ticks;             /*!< field 10 of /sys/block/<blk>/stat */
+    int busy_pct;
+    int inflight;
+    unsigned long deferred;
+};
+
+void qos_budget_set_rate(int cmd_rate, int byte_rate);
+int qos_budget_bypass(int bypass);
+int qos_budget_acquire(char *dev, unsigned int bytes);
+int qos_budget_get(char *dev, struct qos_disk *disk);
+
+#endif
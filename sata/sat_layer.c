@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "sg_command.h"
+#include "sat_layer.h"
+
+/*
+ * SAT layer of a device, found once and cached.
+ * The ATA Information VPD page (0x89) tells that a SAT layer is there, a
+ * CHECK POWER MODE with ck_cond in each cdb form tells which of ATA
+ * PASS-THROUGH (16) and (12) it takes; CHECK POWER MODE goes through the
+ * power gate and does not spin up a disk in standby. USB bridges known to
+ * have no SAT translation are not probed at all, as their answer is a
+ * timeout. Later ATA commands are built for the cached transport with
+ * sat_ata_command() and a device without SAT fails at once.
+ */
+
+static const struct sat_quirk quirks[] = {
+    {0x04b4, 0x6830, SAT_QUIRK_NO_SAT, "Cypress CY7C68300"},
+    {0x067b, 0x2507, SAT_QUIRK_NO_SAT, "Prolific PL2507"},
+    {0x04fc, 0x0c15, SAT_QUIRK_NO_SAT, "Sunplus SPIF215"},
+    {0x04fc, 0x0c25, SAT_QUIRK_NO_SAT, "Sunplus SPIF225"},
+    {0x152d, 0x2338, SAT_QUIRK_NO_SAT, "JMicron JM20337/8"},
+    {0x152d, 0x2339, SAT_QUIRK_NO_SAT, "JMicron JM20339"},
+    {0, 0, 0, NULL},
+};
+
+static char sys_path_sg[PATH_MAX] = SYS_PATH_SG;
+static struct sat_dev sat_devs[SAT_MAX_DEV];
+static int sat_dev_num = 0;
+static pthread_mutex_t sat_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * For tests against a fake tree of scsi_generic links.
+ */
+void sat_set_root(const char *path)
+{
+    snprintf(sys_path_sg, sizeof(sys_path_sg), "%s", path);
+}
+
+/* sat_lock held */
+static struct sat_dev *find_dev(char *dev)
+{
+    int i;
+
+    for(i = 0 ; i < sat_dev_num ; i++)
+    {
+        if(!strcmp(sat_devs[i].dev, dev))
+            return &sat_devs[i];
+    }
+    return NULL;
+}
+
+static int read_hex(const char *dir, const char *name, unsigned short *valP)
+{
+    FILE *fp;
+    char path[PATH_MAX + 16];
+    unsigned int val;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if((fp = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+    if(fscanf(fp, "%x", &val) != 1)
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    *valP = val;
+    return 0;
+}
+
+/* idVendor and idProduct of the USB device above the scsi device of dev */
+static int get_usb_id(char *dev, unsigned short *vidP, unsigned short *pidP)
+{
+    char *name, *p;
+    char link[PATH_MAX + 64];
+    char path[PATH_MAX];
+
+    name = strrchr(dev, '/') ? strrchr(dev, '/') + 1 : dev;
+    snprintf(link, sizeof(link), "%s/%s/device", sys_path_sg, name);
+    if(realpath(link, path) == NULL)
+    {
+        return -1;
+    }
+    while((p = strrchr(path, '/')) != NULL && p != path)
+    {
+        *p = '\0';
+        if(read_hex(path, "idVendor", vidP) == 0 && read_hex(path, "idProduct", pidP) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+/* ATA status return descriptor, or fixed sense with ATA PASS-THROUGH INFORMATION AVAILABLE */
+static int has_ata_return(unsigned char *sense)
+{
+    if((sense[0] & 0x7f) == 0x72 || (sense[0] & 0x7f) == 0x73)
+    {
+        return sense[8] == 0x09 || (sense[2] == 0x00 && sense[3] == 0x1d);
+    }
+    if((sense[0] & 0x7f) == 0x70 || (sense[0] & 0x7f) == 0x71)
+    {
+        return sense[12] == 0x00 && sense[13] == 0x1d;
+    }
+    return 0;
+}
+
+/*
+ * Count register (7:0) of the ATA return in sense, the status return
+ * descriptor or the fixed format information field.
+ * @return the count, -1 when sense carries no ATA return.
+ */
+int sat_ata_count(unsigned char *sense)
+{
+    if(!has_ata_return(sense))
+    {
+        return -1;
+    }
+    if((sense[0] & 0x7f) == 0x72 || (sense[0] & 0x7f) == 0x73)
+    {
+        return sense[8] == 0x09 ? sense[8 + 5] : -1;
+    }
+    return sense[6];
+}
+
+/*
+ * CHECK POWER MODE with ck_cond in the cdb form of transport.
+ * @return 1 when the registers come back, 0 when not, the send error when it was held back.
+ */
+static int probe(char *dev, SAT_TRANSPORT transport)
+{
+    int ret, len;
+    unsigned char cdb[16];
+    unsigned char sense[32];
+    struct ata_tf tf;
+
+    memset(&tf, 0, sizeof(tf));
+    tf.command = 0xe5;
+    tf.ck_cond = 1;
+    len = sat_build_cdb(transport, &tf, ATA_PROT_NON_DATA, cdb);
+    ret = _send_scsi_command_sense(dev, len, cdb, 0, NULL, sense, sizeof(sense));
+    if(ret == -2)
+    {
+        return has_ata_return(sense);
+    }
+    /* a bridge that swallows the cdb reports success without the registers, SG_IO fails on a timeout */
+    return ret == 0 || ret == -1 ? 0 : ret;
+}
+
+/*
+ * Find the transport of dev.
+ * @return 0 with sd filled, the send error when a command could not be sent, nothing is cached then.
+ */
+static int detect(char *dev, struct sat_dev *sd)
+{
+    int i, ret, is_ata;
+    unsigned char cdb[6];
+    unsigned char buf[SAT_VPD_ATA_INFO_LEN];
+    unsigned char sense[32];
+
+    memset(sd, 0, sizeof(*sd));
+    snprintf(sd->dev, sizeof(sd->dev), "%s", dev);
+    if(get_usb_id(dev, &sd->vid, &sd->pid) == 0)
+    {
+        sd->usb = 1;
+        for(i = 0 ; quirks[i].name != NULL ; i++)
+        {
+            if(quirks[i].vid == sd->vid && quirks[i].pid == sd->pid)
+                sd->quirks = quirks[i].flags;
+        }
+    }
+    if(sd->quirks & SAT_QUIRK_NO_SAT)
+    {
+        sd->transport = SAT_NONE;
+        return 0;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    cmd_str_to_buf("12,00,00,00,60,00", cdb);
+    if((ret = _send_scsi_command_sense(dev, sizeof(cdb), cdb, 96, buf, sense, sizeof(sense))) != 0)
+    {
+        return ret;
+    }
+    is_ata = !memcmp(buf + 8, "ATA     ", 8);
+    /* most SCSI disks and bridges without SAT answer ILLEGAL REQUEST here */
+    memset(buf, 0, sizeof(buf));
+    cmd_str_to_buf("12,01,89,02,3c,00", cdb);
+    if(_send_scsi_command_sense(dev, sizeof(cdb), cdb, sizeof(buf), buf, sense, sizeof(sense)) == 0 && buf[1] == 0x89)
+    {
+        memcpy(sd->sat_vendor, buf + 8, 8);
+        for(i = 7 ; i >= 0 && sd->sat_vendor[i] == ' ' ; i--)
+            sd->sat_vendor[i] = '\0';
+    }
+    if(sd->sat_vendor[0] == '\0' && !is_ata && !sd->usb)
+    {
+        /* a SCSI disk, not worth a probe */
+        sd->transport = SAT_NONE;
+        return 0;
+    }
+    if(!strcmp(sd->sat_vendor, "linux"))
+    {
+        /* libata translates both forms */
+        sd->transport = SAT_PT16;
+        return 0;
+    }
+
+    if(!(sd->quirks & SAT_QUIRK_NO_PT16))
+    {
+        if((ret = probe(dev, SAT_PT16)) < 0)
+            return ret;
+        if(ret == 1)
+        {
+            sd->transport = SAT_PT16;
+            return 0;
+        }
+    }
+    if(!(sd->quirks & SAT_QUIRK_NO_PT12))
+    {
+        if((ret = probe(dev, SAT_PT12)) < 0)
+            return ret;
+        if(ret == 1)
+        {
+            sd->transport = SAT_PT12;
+            return 0;
+        }
+    }
+    sd->transport = SAT_NONE;
+    return 0;
+}
+
+static int detect_cached(char *dev, SAT_TRANSPORT *tP)
+{
+    int ret;
+    struct sat_dev sd, *p;
+
+    pthread_mutex_lock(&sat_lock);
+    if((p = find_dev(dev)) != NULL)
+    {
+        *tP = p->transport;
+        pthread_mutex_unlock(&sat_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&sat_lock);
+
+    if((ret = detect(dev, &sd)) != 0)
+    {
+        return ret;
+    }
+    pthread_mutex_lock(&sat_lock);
+    if((p = find_dev(dev)) == NULL && sat_dev_num < SAT_MAX_DEV)
+        p = &sat_devs[sat_dev_num++];
+    if(p != NULL)
+        *p = sd;
+    pthread_mutex_unlock(&sat_lock);
+    *tP = sd.transport;
+    return 0;
+}
+
+/*
+ * Transport of dev, probed on the first call.
+ * @return SAT_UNKNOWN when the probe could not be sent, try again later.
+ */
+SAT_TRANSPORT sat_detect(char *dev)
+{
+    SAT_TRANSPORT transport;
+
+    if(detect_cached(dev, &transport) != 0)
+    {
+        return SAT_UNKNOWN;
+    }
+    return transport;
+}
+
+/* transport of dev without sending anything, SAT_UNKNOWN when not probed yet */
+SAT_TRANSPORT sat_cached(char *dev)
+{
+    SAT_TRANSPORT transport = SAT_UNKNOWN;
+    struct sat_dev *p;
+
+    pthread_mutex_lock(&sat_lock);
+    if((p = find_dev(dev)) != NULL)
+        transport = p->transport;
+    pthread_mutex_unlock(&sat_lock);
+    return transport;
+}
+
+int sat_get_dev(char *dev, struct sat_dev *sd)
+{
+    struct sat_dev *p;
+
+    pthread_mutex_lock(&sat_lock);
+    if((p = find_dev(dev)) == NULL)
+    {
+        pthread_mutex_unlock(&sat_lock);
+        return -1;
+    }
+    *sd = *p;
+    pthread_mutex_unlock(&sat_lock);
+    return 0;
+}
+
+/*
+ * cdb of tf for transport, data-in protocols transfer count 512 byte blocks.
+ * @return cdb length, -1 when tf does not fit the (12) form or there is no SAT.
+ */
+int sat_build_cdb(SAT_TRANSPORT transport, struct ata_tf *tf, ATA_PROTOCOL protocol, unsigned char *cdb)
+{
+    unsigned char flags;
+
+    flags = tf->ck_cond ? 0x20 : 0;
+    if(protocol != ATA_PROT_NON_DATA)
+        flags |= 0x0e;                  /* t_dir in, byt_blok, length in the sector count */
+    memset(cdb, 0, 16);
+    if(transport == SAT_PT16)
+    {
+        cdb[0] = 0x85;
+        cdb[1] = (protocol << 1) | (tf->ext ? 1 : 0);
+        cdb[2] = flags;
+        cdb[3] = tf->feature >> 8;
+        cdb[4] = tf->feature;
+        cdb[5] = tf->count >> 8;
+        cdb[6] = tf->count;
+        cdb[7] = tf->lba >> 24;
+        cdb[8] = tf->lba;
+        cdb[9] = tf->lba >> 32;
+        cdb[10] = tf->lba >> 8;
+        cdb[11] = tf->lba >> 40;
+        cdb[12] = tf->lba >> 16;
+        cdb[13] = tf->device;
+        cdb[14] = tf->command;
+        return 16;
+    }
+    if(transport == SAT_PT12)
+    {
+        /* 28 bit registers only, the high bytes of a 48 bit command must be 0 */
+        if(tf->feature > 0xff || tf->count > 0xff || tf->lba >= (tf->ext ? 1ULL << 24 : 1ULL << 28))
+        {
+            return -1;
+        }
+        cdb[0] = 0xa1;
+        cdb[1] = protocol << 1;
+        cdb[2] = flags;
+        cdb[3] = tf->feature;
+        cdb[4] = tf->count;
+        cdb[5] = tf->lba;
+        cdb[6] = tf->lba >> 8;
+        cdb[7] = tf->lba >> 16;
+        cdb[8] = tf->ext ? tf->device : tf->device | ((tf->lba >> 24) & 0x0f);
+        cdb[9] = tf->command;
+        return 12;
+    }
+    return -1;
+}
+
+/*
+ * One ATA command in the cdb form dev takes.
+ * @return as _send_scsi_command_sense(), -1 at once for a device without SAT.
+ */
+int sat_ata_command(char *dev, struct ata_tf *tf, ATA_PROTOCOL protocol, unsigned short buf_len, unsigned char *buf,
+                    unsigned char *sense, unsigned char sense_len)
+{
+    int ret, len;
+    unsigned char cdb[16];
+    SAT_TRANSPORT transport;
+
+    if((ret = detect_cached(dev, &transport)) != 0)
+    {
+        return ret;
+    }
+    if((len = sat_build_cdb(transport, tf, protocol, cdb)) < 0)
+    {
+        return -1;
+    }
+    return _send_scsi_command_sense(dev, len, cdb, buf_len, buf, sense, sense_len);
+}
+
+/* the device was replaced, probe it again on its next command, NULL forgets every device */
+void sat_forget(char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&sat_lock);
+    if(dev == NULL)
+        sat_dev_num = 0;
+    for(i = 0 ; i < sat_dev_num ; i++)
+    {
+        if(!strcmp(sat_devs[i].dev, dev))
+        {
+            sat_devs[i] = sat_devs[--sat_dev_num];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sat_lock);
+}
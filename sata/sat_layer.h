@@ -0,0 +1,68 @@
+#ifndef _SAT_LAYER_H
+#define _SAT_LAYER_H
+
+#define SAT_MAX_DEV             256
+#define SAT_VPD_ATA_INFO_LEN    572     /* VPD 0x89 */
+#define SYS_PATH_SG             "/sys/class/scsi_generic"
+
+typedef enum _SAT_TRANSPORT
+{
+    SAT_UNKNOWN = 0,                    /*!< not probed yet */
+    SAT_NONE,                           /*!< no SAT translation, ATA commands are not sent */
+    SAT_PT12,                           /*!< only ATA PASS-THROUGH(12) */
+    SAT_PT16,                           /*!< ATA PASS-THROUGH(16), 48 bit commands too */
+} SAT_TRANSPORT;
+
+typedef enum _ATA_PROTOCOL
+{
+    ATA_PROT_NON_DATA = 3,
+    ATA_PROT_PIO_IN = 4,
+    ATA_PROT_DMA = 6,
+} ATA_PROTOCOL;
+
+/* quirks of USB bridges, by idVendor:idProduct */
+#define SAT_QUIRK_NO_SAT        0x01    /* vendor specific pass-through only, SAT cdbs time out */
+#define SAT_QUIRK_NO_PT12       0x02    /* opcode a1 is taken as MMC BLANK */
+#define SAT_QUIRK_NO_PT16       0x04
+
+struct sat_quirk {
+    unsigned short vid;
+    unsigned short pid;
+    int flags;
+    const char *name;
+};
+
+/*
+ * ATA registers of one command, the cdb form is picked by the transport of the device.
+ */
+struct ata_tf {
+    unsigned short feature;
+    unsigned short count;
+    unsigned long long lba;
+    unsigned char device;
+    unsigned char command;
+    int ext;                            /*!< 48 bit command */
+    int ck_cond;                        /*!< return the registers in the sense data */
+};
+
+struct sat_dev {
+    char dev[64];
+    SAT_TRANSPORT transport;
+    int usb;
+    unsigned short vid;                 /*!< of the USB bridge */
+    unsigned short pid;
+    int quirks;
+    char sat_vendor[9];                 /*!< SAT vendor of VPD 0x89, "" without the page */
+};
+
+void sat_set_root(const char *sys_path_sg);
+SAT_TRANSPORT sat_detect(char *dev);
+SAT_TRANSPORT sat_cached(char *dev);
+int sat_get_dev(char *dev, struct sat_dev *sd);
+int sat_build_cdb(SAT_TRANSPORT transport, struct ata_tf *tf, ATA_PROTOCOL protocol, unsigned char *cdb);
+int sat_ata_command(char *dev, struct ata_tf *tf, ATA_PROTOCOL protocol, unsigned short buf_len, unsigned char *buf,
+                    unsigned char *sense, unsigned char sense_len);
+int sat_ata_count(unsigned char *sense);
+void sat_forget(char *dev);
+
+#endif
@@ -7,11 +7,28 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <scsi/sg.h> /* take care: fetches glibc's /usr/include/scsi/sg.h */
 
 #include "sg_command.h"
-
+#include "power_gate.h"
+#include "singleflight.h"
+#include "qos_budget.h"
+#include "sat_layer.h"
+
+static __thread unsigned int timeout_ms = SG_TIMEOUT_MS;
+
+/*
+ * SG_IO timeout of the following commands of this thread, 0 for SG_TIMEOUT_MS.
+ * @return previous setting, to be restored after the long commands.
+ */
+unsigned int sg_set_timeout(unsigned int ms)
+{
+    unsigned int old = timeout_ms;
+    timeout_ms = ms ? ms : SG_TIMEOUT_MS;
+    return old;
+}
 
 unsigned short get_cmd_len(char *cmd_str)
 {
@@ -50,28 +67,33 @@ void cmd_str_to_buf(char *cmd_str, unsigned char *cmd)
     }
 }
 
-int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, unsigned short buf_len, unsigned char *buf)
+static int sg_send(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                   unsigned char *sense, unsigned char sense_len)
 {
     int ret = 0;
     int sg_fd;
     sg_io_hdr_t io_hdr;
-    unsigned char sense_buffer[32];
 
+    if((ret = qos_budget_acquire(dev, buf_len)) != 0)
+    {
+        return ret;
+    }
     if ((sg_fd = open(dev, O_RDONLY)) < 0) {
         perror("error opening given file name");
         return -1;
     }
 
     memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
+    memset(sense, 0, sense_len);
     io_hdr.interface_id = 'S';
     io_hdr.cmd_len = cmd_len;
-    io_hdr.mx_sb_len = sizeof(sense_buffer);
-    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.mx_sb_len = sense_len;
+    io_hdr.dxfer_direction = buf_len ? SG_DXFER_FROM_DEV : SG_DXFER_NONE;
     io_hdr.dxfer_len = buf_len;
     io_hdr.dxferp = buf;
     io_hdr.cmdp = cmd;
-    io_hdr.sbp = sense_buffer;
-    io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
+    io_hdr.sbp = sense;
+    io_hdr.timeout = timeout_ms;
 
     if (ioctl(sg_fd, SG_IO, &io_hdr) < 0) {
         perror("sg_simple0: Inquiry SG_IO ioctl error");
@@ -82,19 +104,61 @@ int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, uns
     if ((io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK) 
     {
         ret = -2;
-        int j;
-        for(j = 0 ; j < 32 ; j++)
-        {
-            printf("%02x ", sense_buffer[j]);
-        }
-        printf("\n");
         goto send_exit;
     }
 
 send_exit:
     close(sg_fd);
+    power_gate_done(dev, cmd_len, cmd, buf_len, buf, ret);
     return ret;
+}
 
+/*
+ * SG_IO with the sense data returned to the caller, for commands whose answer
+ * comes back in the sense buffer (ATA PASS-THROUGH with ck_cond, REQUEST SENSE
+ * style probes). buf_len 0 sends a non-data command.
+ * @retval 0 Success.
+ * @retval -1 The device can not be opened or SG_IO failed.
+ * @retval -2 The command completed with a check condition, sense is filled.
+ * @retval POWER_GATE_STANDBY Not sent, it would spin up a disk in standby and
+ * there is no earlier answer to the same cdb (one is returned as success).
+ * @retval QOS_BUDGET_DEFERRED Not sent, the disk is busy with foreground I/O.
+ * The same idempotent read (INQUIRY, MODE SENSE, READ CAPACITY) already in
+ * flight to dev is not sent twice, the caller gets the result of the one in flight.
+ */
+int _send_scsi_command_sense(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                             unsigned char *sense, unsigned char sense_len)
+{
+    int ret;
+
+    if((ret = power_gate_check(dev, cmd_len, cmd, buf_len, buf)) == POWER_GATE_ANSWERED)
+    {
+        memset(sense, 0, sense_len);
+        return 0;
+    }
+    if(ret != 0)
+    {
+        return ret;
+    }
+    return singleflight_do(dev, cmd_len, cmd, buf_len, buf, sense, sense_len, sg_send);
+}
+
+int _send_scsi_command(char *dev, unsigned short cmd_len,unsigned char *cmd, unsigned short buf_len, unsigned char *buf)
+{
+    int ret;
+    int j;
+    unsigned char sense_buffer[32];
+
+    ret = _send_scsi_command_sense(dev, cmd_len, cmd, buf_len, buf, sense_buffer, sizeof(sense_buffer));
+    if(ret == -2)
+    {
+        for(j = 0 ; j < 32 ; j++)
+        {
+            printf("%02x ", sense_buffer[j]);
+        }
+        printf("\n");
+    }
+    return ret;
 }
 
 void dump_buf(unsigned char *buf)
@@ -232,13 +296,195 @@ int is_sas_support_trim_read_zero(char *dev)
     return 0;
 }
 
+/*
+ * READ LOG EXT (or READ LOG DMA EXT) of num pages from page, in the ATA
+ * PASS-THROUGH form of the SAT layer of dev; buf holds num * ATA_LOG_PAGE_SIZE
+ * bytes. A (12) only device reads pages below 256.
+ * @return as _send_scsi_command_sense().
+ */
+int ata_read_log_ext(char *dev, unsigned char log, unsigned short page, unsigned short num, unsigned char *buf, int dma)
+{
+    unsigned char sense[32];
+    struct ata_tf tf;
+
+    if(num == 0 || num > ATA_LOG_MAX_PAGES)
+    {
+        return -1;
+    }
+    memset(&tf, 0, sizeof(tf));
+    tf.count = num;
+    /* LBA 7:0 log address, 15:8 and 47:40 page */
+    tf.lba = log | ((unsigned long long) (page & 0xff) << 8) | ((unsigned long long) (page >> 8) << 40);
+    tf.command = dma ? 0x47 : 0x2f;
+    tf.ext = 1;
+    return sat_ata_command(dev, &tf, dma ? ATA_PROT_DMA : ATA_PROT_PIO_IN, num * ATA_LOG_PAGE_SIZE, buf,
+                           sense, sizeof(sense));
+}
+
+static struct ata_log_dir log_dirs[ATA_LOG_DIR_MAX];
+static int log_dir_victim = 0;
+static pthread_mutex_t log_dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* log_dir_lock held */
+static struct ata_log_dir *find_log_dir(char *dev)
+{
+    int i;
+
+    for(i = 0 ; i < ATA_LOG_DIR_MAX ; i++)
+    {
+        if(log_dirs[i].dev[0] != '\0' && strcmp(log_dirs[i].dev, dev) == 0)
+            return &log_dirs[i];
+    }
+    return NULL;
+}
+
+/*
+ * The log directory of dev, read on the first call. READ LOG DMA EXT is tried
+ * when READ LOG EXT ends in a check condition, both up to ATA_LOG_DIR_RETRY
+ * times. Only a directory that was read is kept, a unit attention or a reset
+ * does not leave the disk without logs until it is replaced.
+ * @return 0 with log_dir_lock held, the send error without it.
+ */
+static int lock_log_dir(char *dev, struct ata_log_dir **dirP)
+{
+    int i, ret = -2, dma = 0, tries;
+    unsigned char buf[ATA_LOG_PAGE_SIZE];
+    struct ata_log_dir *dir;
+
+    pthread_mutex_lock(&log_dir_lock);
+    if((*dirP = find_log_dir(dev)) != NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_unlock(&log_dir_lock);
+
+    for(tries = 0 ; tries < ATA_LOG_DIR_RETRY && ret == -2 ; tries++)
+    {
+        memset(buf, 0, sizeof(buf));
+        if((ret = ata_read_log_ext(dev, ATA_LOG_DIRECTORY, 0, 1, buf, 0)) == -2)
+        {
+            memset(buf, 0, sizeof(buf));
+            if((ret = ata_read_log_ext(dev, ATA_LOG_DIRECTORY, 0, 1, buf, 1)) == 0)
+                dma = 1;
+        }
+    }
+    if(ret != 0)
+    {
+        return ret;
+    }
+
+    pthread_mutex_lock(&log_dir_lock);
+    if((dir = find_log_dir(dev)) == NULL)
+    {
+        for(i = 0 ; i < ATA_LOG_DIR_MAX ; i++)
+        {
+            if(log_dirs[i].dev[0] == '\0')
+                break;
+        }
+        if(i == ATA_LOG_DIR_MAX)
+        {
+            i = log_dir_victim;
+            log_dir_victim = (log_dir_victim + 1) % ATA_LOG_DIR_MAX;
+        }
+        dir = &log_dirs[i];
+        snprintf(dir->dev, sizeof(dir->dev), "%s", dev);
+        dir->dma = dma;
+        /* word 0 is the version, word n the number of pages of log n */
+        dir->pages[0] = 1;
+        for(i = 1 ; i < ATA_LOG_NUM ; i++)
+            dir->pages[i] = buf[i * 2] | (buf[i * 2 + 1] << 8);
+    }
+    *dirP = dir;
+    return 0;
+}
+
+/*
+ * Pages of log on dev from the log directory.
+ * @return number of pages, 0 when the disk does not have the log, the send error when the directory can not be read.
+ */
+int ata_log_pages(char *dev, unsigned char log)
+{
+    int ret;
+    struct ata_log_dir *dir;
+
+    if((ret = lock_log_dir(dev, &dir)) != 0)
+    {
+        return ret;
+    }
+    ret = dir->pages[log];
+    pthread_mutex_unlock(&log_dir_lock);
+    return ret;
+}
+
+/*
+ * Pages page .. page + num - 1 of log, cut to the pages the disk has, with as
+ * few commands as ATA_LOG_MAX_PAGES allows.
+ * @return number of pages read, 0 when the disk does not have them, the send error on failure.
+ */
+int ata_read_log(char *dev, unsigned char log, unsigned short page, unsigned short num, unsigned char *buf)
+{
+    int ret, dma, total, done, n;
+    struct ata_log_dir *dir;
+
+    if((ret = lock_log_dir(dev, &dir)) != 0)
+    {
+        return ret;
+    }
+    total = dir->pages[log];
+    dma = dir->dma;
+    pthread_mutex_unlock(&log_dir_lock);
+
+    if(page >= total)
+    {
+        return 0;
+    }
+    if(num > total - page)
+        num = total - page;
+    for(done = 0 ; done < num ; done += n)
+    {
+        n = num - done > ATA_LOG_MAX_PAGES ? ATA_LOG_MAX_PAGES : num - done;
+        if((ret = ata_read_log_ext(dev, log, page + done, n, buf + done * ATA_LOG_PAGE_SIZE, dma)) != 0)
+        {
+            return ret;
+        }
+    }
+    return num;
+}
+
+/* the disk was replaced, NULL forgets every disk */
+void ata_log_dir_forget(char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&log_dir_lock);
+    for(i = 0 ; i < ATA_LOG_DIR_MAX ; i++)
+    {
+        if(log_dirs[i].dev[0] != '\0' && (dev == NULL || strcmp(log_dirs[i].dev, dev) == 0))
+            log_dirs[i].dev[0] = '\0';
+    }
+    pthread_mutex_unlock(&log_dir_lock);
+}
+
+/*
+ * Pages of the IDENTIFY DEVICE DATA log (0x30) from page, as many as fit in
+ * buf_len, read with one command.
+ * @return 0, ATA_LOG_BUF_SHORT when buf_len holds no page, -1 when the disk
+ *         does not have the page, the send error on failure.
+ */
 int get_identify_device_data(char* dev, char *page, unsigned char *buf, int buf_len)
 {
-    char *base = "a1,08,0e,00,01,30,%s,00,00,2f,00,00";
-    char cmd[64] = {0};
-    sprintf(cmd, base, page);
-    printf("%s\n",cmd);
-    return send_scsi_command_with_buf(dev, cmd, buf, buf_len);
+    int ret;
+
+    if(buf_len < ATA_LOG_PAGE_SIZE)
+    {
+        return ATA_LOG_BUF_SHORT;
+    }
+    ret = ata_read_log(dev, ATA_LOG_IDENTIFY_DATA, strtoul(page, NULL, 16), buf_len / ATA_LOG_PAGE_SIZE, buf);
+    if(ret == 0)
+    {
+        return -1;
+    }
+    return ret < 0 ? ret : 0;
 }
 
 #ifdef UNIT_TEST
@@ -267,6 +513,50 @@ void test_get_identify_device_data(char *dev)
     }
 }
 
+void test_sat_detect(char *dev)
+{
+    struct sat_dev sd;
+    char *names[] = {"unknown", "none", "pt12", "pt16"};
+
+    sat_detect(dev);
+    if(sat_get_dev(dev, &sd) != 0)
+    {
+        printf("sat: not probed\n");
+        return;
+    }
+    printf("(sat, usb, vid, pid, quirks, sat_vendor) = (%s, %d, %04x, %04x, %x, %s)\n", names[sd.transport], sd.usb,
+           sd.vid, sd.pid, sd.quirks, sd.sat_vendor);
+}
+
+/* the log directory, then every page of the device statistics and identify data logs in one command each */
+void test_ata_read_log(char *dev)
+{
+    int i, ret;
+    unsigned char buf[ATA_LOG_MAX_PAGES * ATA_LOG_PAGE_SIZE];
+    unsigned char logs[] = {ATA_LOG_DEV_STATISTICS, ATA_LOG_SATA_PHY_EVENT, ATA_LOG_IDENTIFY_DATA};
+
+    printf("logs:");
+    for(i = 1 ; i < ATA_LOG_NUM ; i++)
+    {
+        if((ret = ata_log_pages(dev, i)) < 0)
+        {
+            printf(" ret %d\n", ret);
+            return;
+        }
+        if(ret > 0)
+            printf(" %02x(%d)", i, ret);
+    }
+    printf("\n");
+    for(i = 0 ; i < (int) sizeof(logs) ; i++)
+    {
+        ret = ata_read_log(dev, logs[i], 0, ATA_LOG_MAX_PAGES, buf);
+        printf("(log, pages) = (%02x, %d)", logs[i], ret);
+        if(ret > 0)
+            printf(" page 0: %02x %02x %02x %02x", buf[0], buf[1], buf[2], buf[3]);
+        printf("\n");
+    }
+}
+
 void test_vpd_page_00(char *dev, char *cmd_str)
 {
     struct scsi_12_01_00 data;
@@ -320,6 +610,15 @@ int main(int argc, char * argv[])
     //test_vpd_page_00(argv[1], argv[2]);
     //test_vpd_page_b2(argv[1], argv[2]);
     //test_get_identify_device_data(argv[1]);
+    /* sg_command /dev/sg1 [-r fake scsi_generic dir] */
+    if(argc == 2 || (argc == 4 && !strcmp(argv[2], "-r")))
+    {
+        if(argc == 4)
+            sat_set_root(argv[3]);
+        test_sat_detect(argv[1]);
+        test_ata_read_log(argv[1]);
+        return 0;
+    }
     test_send_scsi_command(argv[1], argv[2]);
     return 0;
 }
@@ -1,3 +1,16 @@
+#ifndef _SG_COMMAND_H
+#define _SG_COMMAND_H
+
+#define SG_TIMEOUT_MS           20000   /* 20 seconds */
+
+unsigned int sg_set_timeout(unsigned int ms);
+unsigned short get_cmd_len(char *cmd_str);
+void cmd_str_to_buf(char *cmd_str, unsigned char *cmd);
+
+int _send_scsi_command_sense(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                             unsigned char *sense, unsigned char sense_len);
+int _send_scsi_command(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf);
+int send_scsi_command_with_buf(char *dev, char *cmd_str, unsigned char *buf, int buf_len);
 
 
 int is_sas_support_trim(char *ctrl_name);
@@ -5,6 +18,32 @@ int is_sas_support_trim_write(char *ctrl_name);
 int is_sas_support_trim_read_zero(char *ctrl_name);
 int get_identify_device_data(char* dev, char *page, unsigned char *buf, int buf_len);
 
+#define ATA_LOG_PAGE_SIZE       512
+#define ATA_LOG_NUM             256
+#define ATA_LOG_MAX_PAGES       127     /* pages of one command, buf_len of the send layer is 16 bits */
+#define ATA_LOG_DIR_MAX         64      /* disks with a cached log directory */
+#define ATA_LOG_DIR_RETRY       3       /* directory reads that end in a check condition */
+#define ATA_LOG_DIRECTORY       0x00
+#define ATA_LOG_DEV_STATISTICS  0x04
+#define ATA_LOG_SATA_PHY_EVENT  0x11
+#define ATA_LOG_IDENTIFY_DATA   0x30
+#define ATA_LOG_BUF_SHORT       -5      /* get_identify_device_data() buf_len below one page */
+
+/*
+ * General Purpose Log Directory of a disk, read once.
+ */
+struct ata_log_dir
+{
+    char dev[32];                       /* "" for a free slot */
+    int dma;                            /* READ LOG EXT was aborted, READ LOG DMA EXT works */
+    unsigned short pages[ATA_LOG_NUM];  /* pages of every log address, 0 when not supported */
+};
+
+int ata_read_log_ext(char *dev, unsigned char log, unsigned short page, unsigned short num, unsigned char *buf, int dma);
+int ata_log_pages(char *dev, unsigned char log);
+int ata_read_log(char *dev, unsigned char log, unsigned short page, unsigned short num, unsigned char *buf);
+void ata_log_dir_forget(char *dev);
+
 struct scsi_12_01_00
 {
     unsigned char page_code;
@@ -19,3 +58,5 @@ struct scsi_12_01_b2
     unsigned char lbpw;
     unsigned char lbpr;
 };
+
+#endif
@@ -0,0 +1,53 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../so/module/uevent.h"
+#include "sg_hotplug.h"
+#include "power_gate.h"
+#include "sg_command.h"
+#include "sat_layer.h"
+#include "singleflight.h"
+
+/*
+ * Per device caches of the SG send layer are keyed by the device node. Once
+ * the node goes away, or comes back naming another disk, they are dropped.
+ */
+
+/* drop what the send layer keeps for dev ("/dev/sg1"), NULL drops every device */
+void sg_device_forget(char *dev)
+{
+    power_gate_forget(dev);
+    ata_log_dir_forget(dev);
+    sat_forget(dev);
+    singleflight_forget(dev);
+}
+
+static void hotplug_handler(struct uevent *ev, void *arg)
+{
+    char dev[80];
+
+    (void) arg;
+    if(ev->action == UEVENT_RESYNC)
+    {
+        /* events were lost, any node may name another disk now */
+        sg_device_forget(NULL);
+        return;
+    }
+    if(ev->action != UEVENT_ADD && ev->action != UEVENT_REMOVE)
+    {
+        return;
+    }
+    if(ev->devname[0] == '\0' || snprintf(dev, sizeof(dev), "/dev/%s", ev->devname) >= (int) sizeof(dev))
+    {
+        return;
+    }
+    sg_device_forget(dev);
+}
+
+/*
+ * Follow scsi_generic add/remove events, uevent_start() delivers them.
+ */
+int sg_start_hotplug()
+{
+    return uevent_register_handler("scsi_generic", hotplug_handler, NULL);
+}
@@ -0,0 +1,7 @@
+#ifndef _SG_HOTPLUG_H
+#define _SG_HOTPLUG_H
+
+void sg_device_forget(char *dev);
+int sg_start_hotplug();
+
+#endif
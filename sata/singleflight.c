@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "singleflight.h"
+
+/*
+ * Coalescing of identical concurrent device queries.
+ * While a (device, cdb, length) request is in flight, the same request from
+ * another thread waits for it instead of sending its own command. With a TTL
+ * set, a finished result answers the same request until it expires.
+ * Only the data-in commands of is_idempotent() are coalesced, they read
+ * device state that does not change by asking. Vendor commands, LOG SENSE
+ * and ATA pass-through go to the device every time.
+ */
+
+static struct sf_flight flights[SF_MAX_FLIGHT];
+static pthread_mutex_t sf_lock = PTHREAD_MUTEX_INITIALIZER;
+static int ttl = 0;
+static unsigned long sent = 0;
+static unsigned long shared = 0;
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* 0 disables the result cache, in-flight requests are still shared */
+void singleflight_set_ttl(int ttl_ms)
+{
+    pthread_mutex_lock(&sf_lock);
+    ttl = ttl_ms;
+    pthread_mutex_unlock(&sf_lock);
+}
+
+void singleflight_get_stat(unsigned long *sentP, unsigned long *sharedP)
+{
+    pthread_mutex_lock(&sf_lock);
+    *sentP = sent;
+    *sharedP = shared;
+    pthread_mutex_unlock(&sf_lock);
+}
+
+/* INQUIRY, MODE SENSE, READ CAPACITY and REPORT LUNS */
+static int is_idempotent(unsigned short cmd_len, unsigned char *cmd)
+{
+    if(cmd_len == 0)
+    {
+        return 0;
+    }
+    switch(cmd[0])
+    {
+        case 0x12:                      /* INQUIRY */
+        case 0x1a:                      /* MODE SENSE(6) */
+        case 0x5a:                      /* MODE SENSE(10) */
+        case 0x25:                      /* READ CAPACITY(10) */
+        case 0xa0:                      /* REPORT LUNS */
+            return 1;
+        case 0x9e:                      /* SERVICE ACTION IN(16), READ CAPACITY(16) only */
+            return cmd_len >= 2 && (cmd[1] & 0x1f) == 0x10;
+    }
+    return 0;
+}
+
+/* sf_lock held */
+static int is_expired(struct sf_flight *f, long long now)
+{
+    return f->done && f->refs == 0 && now - f->stamp >= ttl;
+}
+
+/* sf_lock held */
+static void release(struct sf_flight *f)
+{
+    free(f->buf);
+    f->buf = NULL;
+    f->used = 0;
+}
+
+/* sf_lock held */
+static struct sf_flight *find_flight(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len)
+{
+    int i;
+    long long now = now_ms();
+
+    for(i = 0 ; i < SF_MAX_FLIGHT ; i++)
+    {
+        struct sf_flight *f = &flights[i];
+        if(!f->used)
+            continue;
+        if(is_expired(f, now))
+        {
+            release(f);
+            continue;
+        }
+        if(f->done && f->ret != 0)
+            continue;
+        if(f->cmd_len == cmd_len && f->buf_len == buf_len && !memcmp(f->cmd, cmd, cmd_len) && !strcmp(f->dev, dev))
+            return f;
+    }
+    return NULL;
+}
+
+/* sf_lock held */
+static struct sf_flight *new_flight(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len)
+{
+    int i;
+    struct sf_flight *f;
+
+    for(i = 0 ; i < SF_MAX_FLIGHT ; i++)
+    {
+        if(!flights[i].used)
+            break;
+    }
+    if(i == SF_MAX_FLIGHT)
+    {
+        return NULL;
+    }
+    f = &flights[i];
+    if((f->buf = (unsigned char*) malloc(buf_len)) == NULL)
+    {
+        return NULL;
+    }
+    f->used = 1;
+    snprintf(f->dev, sizeof(f->dev), "%s", dev);
+    memcpy(f->cmd, cmd, cmd_len);
+    f->cmd_len = cmd_len;
+    f->buf_len = buf_len;
+    f->refs = 1;
+    f->done = 0;
+    f->ret = -1;
+    f->stamp = 0;
+    pthread_cond_init(&f->cond, NULL);
+    return f;
+}
+
+static void copy_result(struct sf_flight *f, unsigned char *buf, unsigned char *sense, unsigned char sense_len)
+{
+    memcpy(buf, f->buf, f->buf_len);
+    memcpy(sense, f->sense, sense_len < SF_SENSE_LEN ? sense_len : SF_SENSE_LEN);
+}
+
+/*
+ * Send through send(), or share the result of an identical request.
+ * Commands that are not idempotent reads, cdbs over 16 bytes and a full
+ * flight table go straight to send().
+ */
+int singleflight_do(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                    unsigned char *sense, unsigned char sense_len, sf_send_func send)
+{
+    int ret;
+    struct sf_flight *f;
+
+    if(buf_len == 0 || cmd_len > sizeof(f->cmd) || !is_idempotent(cmd_len, cmd))
+    {
+        return send(dev, cmd_len, cmd, buf_len, buf, sense, sense_len);
+    }
+
+    pthread_mutex_lock(&sf_lock);
+    if((f = find_flight(dev, cmd_len, cmd, buf_len)) != NULL)
+    {
+        f->refs++;
+        shared++;
+        while(!f->done)
+        {
+            pthread_cond_wait(&f->cond, &sf_lock);
+        }
+        ret = f->ret;
+        copy_result(f, buf, sense, sense_len);
+        f->refs--;
+        if(f->refs == 0 && (ttl == 0 || ret != 0))
+        {
+            release(f);
+        }
+        pthread_mutex_unlock(&sf_lock);
+        return ret;
+    }
+    if((f = new_flight(dev, cmd_len, cmd, buf_len)) == NULL)
+    {
+        pthread_mutex_unlock(&sf_lock);
+        return send(dev, cmd_len, cmd, buf_len, buf, sense, sense_len);
+    }
+    sent++;
+    pthread_mutex_unlock(&sf_lock);
+
+    ret = send(dev, cmd_len, cmd, buf_len, f->buf, f->sense, SF_SENSE_LEN);
+
+    pthread_mutex_lock(&sf_lock);
+    f->ret = ret;
+    f->done = 1;
+    f->stamp = now_ms();
+    copy_result(f, buf, sense, sense_len);
+    pthread_cond_broadcast(&f->cond);
+    f->refs--;
+    /* failures are never cached, the next request tries the device again */
+    if(f->refs == 0 && (ttl == 0 || ret != 0))
+    {
+        release(f);
+    }
+    pthread_mutex_unlock(&sf_lock);
+    return ret;
+}
+
+/*
+ * The disk behind dev was replaced, its cached results are dropped and a
+ * request still in flight is not joined any more. NULL forgets every device.
+ */
+void singleflight_forget(char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&sf_lock);
+    for(i = 0 ; i < SF_MAX_FLIGHT ; i++)
+    {
+        struct sf_flight *f = &flights[i];
+        if(!f->used || (dev != NULL && strcmp(f->dev, dev)))
+            continue;
+        if(f->done && f->refs == 0)
+            release(f);
+        else
+            f->dev[0] = '\0';
+    }
+    pthread_mutex_unlock(&sf_lock);
+}
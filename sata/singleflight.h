@@ -0,0 +1,38 @@
+#ifndef _SINGLEFLIGHT_H
+#define _SINGLEFLIGHT_H
+
+#include <pthread.h>
+
+#define SF_MAX_FLIGHT       64
+#define SF_SENSE_LEN        32
+
+/*
+ * One (device, cdb, transfer length) request. Followers that ask the same
+ * while it is in flight wait for the leader and copy its result; with a TTL
+ * the finished result keeps answering until it expires.
+ */
+struct sf_flight {
+    int used;
+    char dev[64];
+    unsigned char cmd[16];
+    unsigned short cmd_len;
+    unsigned short buf_len;
+    int refs;                           /*!< leader and followers still copying */
+    int done;
+    int ret;
+    unsigned char *buf;
+    unsigned char sense[SF_SENSE_LEN];
+    long long stamp;                    /*!< ms, CLOCK_MONOTONIC, when done */
+    pthread_cond_t cond;
+};
+
+typedef int (*sf_send_func)(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len,
+                            unsigned char *buf, unsigned char *sense, unsigned char sense_len);
+
+void singleflight_set_ttl(int ttl_ms);
+int singleflight_do(char *dev, unsigned short cmd_len, unsigned char *cmd, unsigned short buf_len, unsigned char *buf,
+                    unsigned char *sense, unsigned char sense_len, sf_send_func send);
+void singleflight_get_stat(unsigned long *sentP, unsigned long *sharedP);
+void singleflight_forget(char *dev);
+
+#endif
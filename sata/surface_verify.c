@@ -0,0 +1,699 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sg_command.h"
+#include "power_gate.h"
+#include "qos_budget.h"
+#include "sat_layer.h"
+#include "surface_verify.h"
+
+/*
+ * Media scan over the SG layer.
+ * Each disk has SV_DEPTH workers verifying SV_CHUNK_BYTES chunks in lba
+ * order, every added disk runs at the same time. Commands go through the
+ * send layer, so the QoS budget slows the scan down under foreground I/O and
+ * the power gate pauses it while a disk sleeps. A chunk that fails is
+ * verified again in SV_SUB_BYTES steps and the steps that fail with a medium
+ * error are recorded. UNIT ATTENTION and NOT READY are retried, any other
+ * check condition ends the scan of that disk.
+ * The lba below which everything is verified is checkpointed every
+ * SV_CHECKPOINT_SEC under the WWN (or serial) of the disk, a restarted scan of
+ * the same disk resumes from there whatever sg node it got.
+ */
+
+#define SV_STOPPED      -10
+#define SV_MEDIUM       -11     /* unrecovered read error inside the range */
+#define SV_REFUSED      -12     /* ILLEGAL REQUEST */
+#define SV_BAD_FULL     -13     /* no room for another bad range */
+
+static struct sv_disk disks[SV_MAX_DISK];
+static int disk_num = 0;
+static char checkpoint_dir[128] = SV_CHECKPOINT_DIR;
+static int wake = 0;
+static volatile int running = 0;
+
+struct sv_worker {
+    struct sv_disk *d;
+    int slot;
+    pthread_t tid;
+};
+
+static time_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+void surface_verify_set_dir(const char *dir)
+{
+    snprintf(checkpoint_dir, sizeof(checkpoint_dir), "%s", dir);
+}
+
+/* 1 lets the scan spin up a disk in standby, by default it waits for it */
+void surface_verify_set_wake(int w)
+{
+    wake = w;
+}
+
+/* keyed by the disk, not by the sg node that changes with the boot order; the node only without an id */
+static void get_checkpoint_path(struct sv_disk *d, char *path, int len)
+{
+    const char *name = strrchr(d->dev, '/') ? strrchr(d->dev, '/') + 1 : d->dev;
+
+    if(d->wwn[0])
+        snprintf(path, len, "%s/wwn-%s.sv", checkpoint_dir, d->wwn);
+    else if(d->serial[0])
+        snprintf(path, len, "%s/serial-%s.sv", checkpoint_dir, d->serial);
+    else
+        snprintf(path, len, "%s/%s.sv", checkpoint_dir, name);
+}
+
+/* mkdir -p */
+static int make_dirs(const char *dir)
+{
+    char path[128];
+    char *p;
+
+    if(snprintf(path, sizeof(path), "%s", dir) >= (int) sizeof(path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    for(p = path + 1 ; *p ; p++)
+    {
+        if(*p != '/')
+            continue;
+        *p = '\0';
+        if(mkdir(path, 0755) != 0 && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+    if(mkdir(path, 0755) != 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+/* d->lock held or no worker running */
+static int add_bad(struct sv_disk *d, unsigned long long lba, unsigned int blocks)
+{
+    int i;
+    unsigned long long end = lba + blocks;
+
+    for(i = 0 ; i < d->bad_num ; i++)
+    {
+        if(lba <= d->bad[i].lba + d->bad[i].blocks && end >= d->bad[i].lba)
+        {
+            /* overlapping or adjacent, merge and let the next range join in too */
+            if(end < d->bad[i].lba + d->bad[i].blocks)
+                end = d->bad[i].lba + d->bad[i].blocks;
+            if(lba > d->bad[i].lba)
+                lba = d->bad[i].lba;
+            d->bad[i].lba = lba;
+            d->bad[i].blocks = end - lba;
+            while(i + 1 < d->bad_num && d->bad[i + 1].lba <= end)
+            {
+                if(d->bad[i + 1].lba + d->bad[i + 1].blocks > end)
+                    end = d->bad[i + 1].lba + d->bad[i + 1].blocks;
+                d->bad[i].blocks = end - lba;
+                memmove(&d->bad[i + 1], &d->bad[i + 2], sizeof(struct sv_range) * (d->bad_num - i - 2));
+                d->bad_num--;
+            }
+            return 0;
+        }
+        if(end < d->bad[i].lba)
+            break;
+    }
+    if(d->bad_num == SV_MAX_BAD)
+    {
+        return -1;
+    }
+    memmove(&d->bad[i + 1], &d->bad[i], sizeof(struct sv_range) * (d->bad_num - i));
+    d->bad[i].lba = lba;
+    d->bad[i].blocks = blocks;
+    d->bad_num++;
+    return 0;
+}
+
+/*
+ * <serial> <capacity> <block size> <done>
+ * bad <lba> <blocks>
+ * ...
+ * d->lock held
+ */
+static int save_checkpoint(struct sv_disk *d)
+{
+    int i, err;
+    char path[256];
+    char tmp[264];
+    FILE *fp;
+
+    get_checkpoint_path(d, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    d->saved = now_sec();
+    if((fp = fopen(tmp, "w")) == NULL)
+    {
+        goto fail;
+    }
+    fprintf(fp, "%s %llu %u %llu\n", d->serial[0] ? d->serial : "-", d->capacity, d->block_size, d->done);
+    for(i = 0 ; i < d->bad_num ; i++)
+    {
+        fprintf(fp, "bad %llu %u\n", d->bad[i].lba, d->bad[i].blocks);
+    }
+    /* the data is on the disk before the rename makes it the checkpoint */
+    if(fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) != 0)
+    {
+        err = errno;
+        fclose(fp);
+        unlink(tmp);
+        errno = err;
+        goto fail;
+    }
+    if(fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        err = errno;
+        unlink(tmp);
+        errno = err;
+        goto fail;
+    }
+    d->save_errno = 0;
+    return 0;
+
+fail:
+    if(d->save_errno == 0)
+        fprintf(stderr, "%s: can not write the checkpoint %s: %s\n", d->dev, path, strerror(errno));
+    d->save_errno = errno ? errno : EIO;
+    return -1;
+}
+
+static void load_checkpoint(struct sv_disk *d)
+{
+    char path[256];
+    char serial[64];
+    unsigned long long capacity, done, lba;
+    unsigned int block_size, blocks;
+    FILE *fp;
+
+    get_checkpoint_path(d, path, sizeof(path));
+    if((fp = fopen(path, "r")) == NULL)
+    {
+        return;
+    }
+    if(fscanf(fp, "%63s %llu %u %llu", serial, &capacity, &block_size, &done) == 4 &&
+       !strcmp(serial, d->serial[0] ? d->serial : "-") && capacity == d->capacity && block_size == d->block_size &&
+       done <= capacity)
+    {
+        d->done = done;
+        d->next = done;
+        while(fscanf(fp, " bad %llu %u", &lba, &blocks) == 2)
+        {
+            add_bad(d, lba, blocks);
+        }
+    }
+    fclose(fp);
+}
+
+/* READ CAPACITY(16), translated by the SAT layer for SATA disks too */
+static int read_capacity(struct sv_disk *d)
+{
+    int i;
+    unsigned char buf[32];
+
+    if(send_scsi_command_with_buf(d->dev, "9e,10,00,00,00,00,00,00,00,00,00,00,00,20,00,00", buf, sizeof(buf)) != 0)
+    {
+        return -1;
+    }
+    d->capacity = 0;
+    for(i = 0 ; i < 8 ; i++)
+        d->capacity = (d->capacity << 8) | buf[i];
+    d->capacity++;
+    d->block_size = (buf[8] << 24) | (buf[9] << 16) | (buf[10] << 8) | buf[11];
+    return d->block_size ? 0 : -1;
+}
+
+static void read_serial(struct sv_disk *d)
+{
+    int i, len;
+    unsigned char buf[68];
+
+    memset(buf, 0, sizeof(buf));
+    if(send_scsi_command_with_buf(d->dev, "12,01,80,00,44,00", buf, sizeof(buf)) != 0 || buf[1] != 0x80)
+    {
+        return;
+    }
+    len = buf[3] < (int) sizeof(buf) - 4 ? buf[3] : (int) sizeof(buf) - 4;
+    for(i = 0, len = len < (int) sizeof(d->serial) - 1 ? len : (int) sizeof(d->serial) - 1 ; i < len ; i++)
+    {
+        /* the serial is space padded, keep it one token for the checkpoint and its file name */
+        d->serial[i] = buf[4 + i] > ' ' && buf[4 + i] < 0x7f && buf[4 + i] != '/' ? buf[4 + i] : '_';
+    }
+    d->serial[len] = '\0';
+}
+
+/* VPD 0x83, the NAA designator of the logical unit as hex */
+static void read_wwn(struct sv_disk *d)
+{
+    int i, off, len, end;
+    unsigned char buf[252];
+
+    memset(buf, 0, sizeof(buf));
+    if(send_scsi_command_with_buf(d->dev, "12,01,83,00,fc,00", buf, sizeof(buf)) != 0 || buf[1] != 0x83)
+    {
+        return;
+    }
+    end = 4 + ((buf[2] << 8) | buf[3]);
+    if(end > (int) sizeof(buf))
+        end = sizeof(buf);
+    for(off = 4 ; off + 4 <= end ; off += 4 + buf[off + 3])
+    {
+        len = buf[off + 3];
+        /* binary code set, associated with the logical unit, NAA */
+        if((buf[off] & 0x0f) != 1 || (buf[off + 1] & 0x30) != 0 || (buf[off + 1] & 0x0f) != 3 ||
+           off + 4 + len > end || len * 2 + 3 > (int) sizeof(d->wwn))
+            continue;
+        d->wwn[0] = '0';
+        d->wwn[1] = 'x';
+        for(i = 0 ; i < len ; i++)
+            sprintf(d->wwn + 2 + i * 2, "%02x", buf[off + 4 + i]);
+        return;
+    }
+}
+
+static void get_sense(unsigned char *sense, unsigned char *key, unsigned char *asc, unsigned char *ascq)
+{
+    if((sense[0] & 0x7f) >= 0x72)
+    {
+        *key = sense[1] & 0x0f;
+        *asc = sense[2];
+        *ascq = sense[3];
+    }
+    else
+    {
+        *key = sense[2] & 0x0f;
+        *asc = sense[12];
+        *ascq = sense[13];
+    }
+}
+
+/*
+ * What a check condition of a verify means.
+ * @retval SV_MEDIUM MEDIUM ERROR, or the ATA registers say ERR with UNC.
+ * @retval 0 UNIT ATTENTION or NOT READY, send it again.
+ * @retval SV_REFUSED ILLEGAL REQUEST.
+ * @retval -2 Anything else.
+ */
+static int check_sense(unsigned char *sense)
+{
+    int i, len;
+    unsigned char key, asc, ascq;
+
+    get_sense(sense, &key, &asc, &ascq);
+    if(key == 0x03)
+    {
+        return SV_MEDIUM;
+    }
+    if((sense[0] & 0x7f) >= 0x72)
+    {
+        /* ATA status return descriptor: error at +3, status at +13 */
+        len = 8 + sense[7] < SV_SENSE_LEN ? 8 + sense[7] : SV_SENSE_LEN;
+        for(i = 8 ; i + 1 < len ; i += 2 + sense[i + 1])
+        {
+            if(sense[i] == 0x09 && i + 13 < len)
+            {
+                if((sense[i + 13] & 0x01) && (sense[i + 3] & 0x40))
+                    return SV_MEDIUM;
+                break;
+            }
+        }
+    }
+    if(key == 0x06 || key == 0x02)
+    {
+        return 0;
+    }
+    if(key == 0x05)
+    {
+        return SV_REFUSED;
+    }
+    return -2;
+}
+
+static int verify_range(struct sv_disk *d, unsigned long long lba, unsigned int blocks, unsigned char *sense)
+{
+    int i;
+    unsigned char cmd[16];
+    struct ata_tf tf;
+
+    if(d->is_ata)
+    {
+        /* READ VERIFY SECTORS EXT, non-data */
+        memset(&tf, 0, sizeof(tf));
+        tf.count = blocks == 65536 ? 0 : blocks;
+        tf.lba = lba;
+        tf.device = 0x40;
+        tf.command = 0x42;
+        tf.ext = 1;
+        return sat_ata_command(d->dev, &tf, ATA_PROT_NON_DATA, 0, NULL, sense, SV_SENSE_LEN);
+    }
+    /* VERIFY(16), BYTCHK 0: medium verification without data out */
+    memset(cmd, 0, sizeof(cmd));
+    cmd[0] = 0x8f;
+    for(i = 0 ; i < 8 ; i++)
+        cmd[2 + i] = lba >> (56 - 8 * i);
+    for(i = 0 ; i < 4 ; i++)
+        cmd[10 + i] = blocks >> (24 - 8 * i);
+    return _send_scsi_command_sense(d->dev, sizeof(cmd), cmd, 0, NULL, sense, SV_SENSE_LEN);
+}
+
+/*
+ * verify_range() until the budget and the power gate let it through, UNIT
+ * ATTENTION and NOT READY are sent again up to SV_SENSE_RETRY times.
+ * A check condition comes back as SV_MEDIUM, SV_REFUSED or -2, sense holds it.
+ */
+static int verify_retry(struct sv_disk *d, unsigned long long lba, unsigned int blocks, unsigned char *sense)
+{
+    int ret;
+    int tries = 0;
+
+    while(1)
+    {
+        memset(sense, 0, SV_SENSE_LEN);
+        ret = verify_range(d, lba, blocks, sense);
+        if(ret == -2 && (ret = check_sense(sense)) == 0)
+        {
+            if(++tries > SV_SENSE_RETRY)
+                return -2;
+        }
+        else if(ret == QOS_BUDGET_DEFERRED || ret == POWER_GATE_STANDBY)
+        {
+            pthread_mutex_lock(&d->lock);
+            d->deferred++;
+            pthread_mutex_unlock(&d->lock);
+        }
+        else
+        {
+            return ret;
+        }
+        if(!running)
+        {
+            return SV_STOPPED;
+        }
+        usleep(SV_RETRY_MS * 1000);
+    }
+}
+
+/* a chunk with a medium error: find the failing steps inside it */
+static int verify_failed_chunk(struct sv_disk *d, unsigned long long lba, unsigned int blocks, unsigned char *sense)
+{
+    int ret;
+    unsigned int step = SV_SUB_BYTES / d->block_size ? SV_SUB_BYTES / d->block_size : 1;
+    unsigned int n;
+    unsigned long long end = lba + blocks;
+
+    for( ; lba < end ; lba += n)
+    {
+        n = end - lba < step ? end - lba : step;
+        if((ret = verify_retry(d, lba, n, sense)) == SV_MEDIUM)
+        {
+            pthread_mutex_lock(&d->lock);
+            ret = add_bad(d, lba, n);
+            pthread_mutex_unlock(&d->lock);
+            if(ret != 0)
+            {
+                /* the range list is full, stop here rather than lose failures */
+                return SV_BAD_FULL;
+            }
+        }
+        else if(ret != 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/* d->lock held */
+static void update_done(struct sv_disk *d)
+{
+    int i;
+    unsigned long long done = d->next;
+
+    for(i = 0 ; i < SV_DEPTH ; i++)
+    {
+        if(d->inflight[i] < done)
+            done = d->inflight[i];
+    }
+    d->done = done;
+    if(d->done == d->capacity || now_sec() - d->saved >= SV_CHECKPOINT_SEC)
+    {
+        save_checkpoint(d);
+    }
+}
+
+static void *verify_worker(void *arg)
+{
+    int ret;
+    unsigned char sense[SV_SENSE_LEN];
+    struct sv_worker *w = (struct sv_worker*) arg;
+    struct sv_disk *d = w->d;
+    unsigned int chunk = SV_CHUNK_BYTES / d->block_size;
+    unsigned int blocks;
+    unsigned long long lba;
+
+    power_gate_allow_wake(wake);
+    if(d->is_ata && chunk > 65536)
+        chunk = 65536;
+    if(chunk == 0)
+        chunk = 1;
+    /* a chunk of a disk busy retrying weak sectors takes longer than the default timeout */
+    sg_set_timeout(SG_TIMEOUT_MS + (unsigned long long) chunk * d->block_size / (SV_MIN_RATE / 1000));
+    while(running)
+    {
+        pthread_mutex_lock(&d->lock);
+        if(d->error || d->next >= d->capacity)
+        {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        lba = d->next;
+        blocks = d->capacity - lba < chunk ? d->capacity - lba : chunk;
+        d->next += blocks;
+        d->inflight[w->slot] = lba;
+        pthread_mutex_unlock(&d->lock);
+
+        ret = verify_retry(d, lba, blocks, sense);
+        if(ret == SV_MEDIUM)
+        {
+            ret = verify_failed_chunk(d, lba, blocks, sense);
+        }
+        if(ret == SV_STOPPED)
+        {
+            /* inflight keeps done below this chunk, it is verified again on resume */
+            break;
+        }
+        pthread_mutex_lock(&d->lock);
+        if(ret != 0)
+        {
+            /* the first failing worker tells why, the others stop behind it */
+            if(!d->error)
+            {
+                d->error = ret == SV_REFUSED ? SV_ERR_REFUSED : ret == SV_BAD_FULL ? SV_ERR_BAD_FULL : SV_ERR_DEVICE;
+                if(ret == SV_REFUSED || ret == -2)
+                    get_sense(sense, &d->sense_key, &d->asc, &d->ascq);
+            }
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        d->inflight[w->slot] = ~0ULL;
+        update_done(d);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Add dev to the scan, resuming from its checkpoint when the serial and the
+ * capacity still match.
+ */
+int surface_verify_add(const char *dev)
+{
+    int i, old;
+    struct sv_disk *d;
+
+    if(disk_num == SV_MAX_DISK || running)
+    {
+        return -1;
+    }
+    d = &disks[disk_num];
+    memset(d, 0, sizeof(*d));
+    snprintf(d->dev, sizeof(d->dev), "%s", dev);
+    /* the same wake setting as the scan, a sleeping disk is not added without it */
+    old = power_gate_allow_wake(wake);
+    if(read_capacity(d) != 0)
+    {
+        power_gate_allow_wake(old);
+        return -1;
+    }
+    /* READ VERIFY SECTORS EXT needs the (16) form, a (12) only bridge gets VERIFY(16) */
+    d->is_ata = sat_detect(d->dev) == SAT_PT16;
+    read_serial(d);
+    read_wwn(d);
+    power_gate_allow_wake(old);
+    for(i = 0 ; i < SV_DEPTH ; i++)
+        d->inflight[i] = ~0ULL;
+    load_checkpoint(d);
+    d->finished = d->done == d->capacity;
+    pthread_mutex_init(&d->lock, NULL);
+    disk_num++;
+    return 0;
+}
+
+/*
+ * Scan every added disk, returns when all of them are verified, failed or
+ * surface_verify_stop() was called.
+ * @return number of disks with recorded bad ranges or an error.
+ */
+int surface_verify_run()
+{
+    int i, j;
+    int bad = 0;
+    static struct sv_worker workers[SV_MAX_DISK * SV_DEPTH];
+
+    if(make_dirs(checkpoint_dir) != 0)
+    {
+        fprintf(stderr, "%s: %s, checkpoints are not saved\n", checkpoint_dir, strerror(errno));
+    }
+    running = 1;
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        for(j = 0 ; j < SV_DEPTH ; j++)
+        {
+            struct sv_worker *w = &workers[i * SV_DEPTH + j];
+            w->d = &disks[i];
+            w->slot = j;
+            if(pthread_create(&w->tid, NULL, verify_worker, w) != 0)
+                w->d = NULL;
+        }
+    }
+    for(i = 0 ; i < disk_num * SV_DEPTH ; i++)
+    {
+        if(workers[i].d)
+            pthread_join(workers[i].tid, NULL);
+    }
+    running = 0;
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        pthread_mutex_lock(&disks[i].lock);
+        update_done(&disks[i]);
+        save_checkpoint(&disks[i]);
+        disks[i].finished = disks[i].done == disks[i].capacity;
+        if(disks[i].bad_num || disks[i].error)
+            bad++;
+        pthread_mutex_unlock(&disks[i].lock);
+    }
+    return bad;
+}
+
+/* workers finish their chunk and surface_verify_run() saves the checkpoints */
+void surface_verify_stop()
+{
+    running = 0;
+}
+
+const char *surface_verify_strerror(SV_ERROR error)
+{
+    switch(error)
+    {
+        case SV_ERR_NONE:
+            return "none";
+        case SV_ERR_DEVICE:
+            return "the device stopped answering";
+        case SV_ERR_REFUSED:
+            return "the device refuses the verify command (ILLEGAL REQUEST)";
+        case SV_ERR_BAD_FULL:
+            return "too many bad ranges, scan stopped";
+    }
+    return "unknown";
+}
+
+int surface_verify_get(const char *dev, struct sv_disk *disk)
+{
+    int i;
+
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+        {
+            pthread_mutex_lock(&disks[i].lock);
+            *disk = disks[i];
+            pthread_mutex_unlock(&disks[i].lock);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#ifdef UNIT_TEST
+#include <signal.h>
+#include "../so/module/uevent.h"
+#include "sg_hotplug.h"
+
+static void on_signal(int sig)
+{
+    (void) sig;
+    surface_verify_stop();
+}
+
+int main(int argc, char *argv[])
+{
+    int c, i, j;
+    struct sv_disk d;
+
+    /* surface_verify [-d checkpoint dir] [-w] /dev/sg1 /dev/sg2 ... */
+    while((c = getopt(argc, argv, "d:w")) != -1)
+    {
+        switch(c)
+        {
+            case 'd':
+                surface_verify_set_dir(optarg);
+                break;
+            case 'w':
+                surface_verify_set_wake(1);
+                break;
+            default:
+                return 1;
+        }
+    }
+    for(i = optind ; i < argc ; i++)
+    {
+        if(surface_verify_add(argv[i]) != 0)
+            printf("%s: can not read the capacity\n", argv[i]);
+    }
+    if(sg_start_hotplug() < 0 || uevent_start() < 0)
+        printf("device add/remove events are not followed\n");
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("disks with failures: %d\n", surface_verify_run());
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        surface_verify_get(disks[i].dev, &d);
+        printf("(dev, serial, wwn, ata, done, capacity, deferred, error) = (%s, %s, %s, %d, %llu, %llu, %lu, %d)\n",
+               d.dev, d.serial, d.wwn, d.is_ata, d.done, d.capacity, d.deferred, d.error);
+        if(d.error && d.sense_key)
+            printf("    %s, sense %02x/%02x/%02x\n", surface_verify_strerror(d.error), d.sense_key, d.asc, d.ascq);
+        else if(d.error)
+            printf("    %s\n", surface_verify_strerror(d.error));
+        if(d.save_errno)
+            printf("    checkpoint not saved: %s\n", strerror(d.save_errno));
+        for(j = 0 ; j < d.bad_num ; j++)
+            printf("    bad (lba, blocks) = (%llu, %u)\n", d.bad[j].lba, d.bad[j].blocks);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,63 @@
+#ifndef _SURFACE_VERIFY_H
+#define _SURFACE_VERIFY_H
+
+#include <time.h>
+#include <pthread.h>
+
+#define SV_MAX_DISK             64
+#define SV_DEPTH                4                   /* chunks in flight per disk */
+#define SV_CHUNK_BYTES          (32 * 1024 * 1024)  /* one VERIFY, capped at 65536 sectors for SATA */
+#define SV_SUB_BYTES            (1024 * 1024)       /* a failed chunk is verified again in these steps */
+#define SV_MIN_RATE             (1024 * 1024)       /* bytes/s a chunk is given on top of the default timeout */
+#define SV_MAX_BAD              256
+#define SV_CHECKPOINT_SEC       10
+#define SV_RETRY_MS             500                 /* wait after a deferred or standby-held command */
+#define SV_SENSE_RETRY          20                  /* UNIT ATTENTION / NOT READY retries of one command */
+#define SV_SENSE_LEN            32
+#define SV_CHECKPOINT_DIR       "/etc/surface_verify"
+
+typedef enum _SV_ERROR
+{
+    SV_ERR_NONE = 0,
+    SV_ERR_DEVICE,                      /*!< the device stopped answering */
+    SV_ERR_REFUSED,                     /*!< ILLEGAL REQUEST, the disk does not take the verify command */
+    SV_ERR_BAD_FULL,                    /*!< more than SV_MAX_BAD separate bad ranges, the rest is not scanned */
+} SV_ERROR;
+
+struct sv_range {
+    unsigned long long lba;
+    unsigned int blocks;
+};
+
+struct sv_disk {
+    char dev[64];                       /*!< "/dev/sg1" */
+    char serial[64];                    /*!< VPD 0x80, a checkpoint of another disk is not resumed */
+    char wwn[40];                       /*!< NAA designator of VPD 0x83, "" without one */
+    int is_ata;                         /*!< READ VERIFY SECTORS EXT instead of VERIFY(16) */
+    unsigned int block_size;
+    unsigned long long capacity;        /*!< blocks */
+    unsigned long long next;            /*!< first lba not handed to a worker yet */
+    unsigned long long done;            /*!< every lba below is verified, this is checkpointed */
+    unsigned long long inflight[SV_DEPTH];
+    struct sv_range bad[SV_MAX_BAD];    /*!< sorted, adjacent ranges merged */
+    int bad_num;
+    unsigned long deferred;             /*!< commands held back by the QoS budget or the power gate */
+    int finished;
+    SV_ERROR error;
+    unsigned char sense_key;            /*!< of the command that ended the scan with an error */
+    unsigned char asc;
+    unsigned char ascq;
+    int save_errno;                     /*!< the last checkpoint write failed, 0 once one succeeds */
+    time_t saved;
+    pthread_mutex_t lock;
+};
+
+void surface_verify_set_dir(const char *dir);
+void surface_verify_set_wake(int wake);
+int surface_verify_add(const char *dev);
+int surface_verify_run();
+void surface_verify_stop();
+int surface_verify_get(const char *dev, struct sv_disk *disk);
+const char *surface_verify_strerror(SV_ERROR error);
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/nvme_ioctl.h>
+
+#include "sg_command.h"
+#include "power_gate.h"
+#include "sat_layer.h"
+#include "temp_sampler.h"
+
+/*
+ * Disk temperature sampler.
+ * Every due disk of a round is read concurrently, the interval of a disk
+ * grows while its temperature is steady and drops back when it moves, and a
+ * disk in standby is answered with its last reading, or held back, by the
+ * power gate of the send layer.
+ * Consumers read the cached value with temp_sampler_get() instead of sending
+ * their own command, the HAL snapshot producer publishes it for the
+ * PD_Get_Temperature() callers (hal_snapshot_pd_get_temperature()).
+ */
+
+static struct temp_disk disks[TEMP_SAMPLER_MAX_DISK];
+static int disk_num = 0;
+static pthread_mutex_t disk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile int running = 0;
+static pthread_t sampler;
+
+static time_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/* SMART READ LOG, SCT status log 0xe0, current temperature at byte 200 */
+int temp_read_sata(char *dev, int *tempP)
+{
+    int ret;
+    unsigned char buf[512];
+    unsigned char sense[32];
+    struct ata_tf tf;
+
+    memset(&tf, 0, sizeof(tf));
+    tf.feature = 0xd5;
+    tf.count = 1;
+    tf.lba = 0xe0 | (0x4f << 8) | (0xc2 << 16);
+    tf.command = 0xb0;
+    if((ret = sat_ata_command(dev, &tf, ATA_PROT_PIO_IN, sizeof(buf), buf, sense, sizeof(sense))) != 0)
+    {
+        return ret;
+    }
+    if(buf[200] == 0x80)
+    {
+        return -1;
+    }
+    *tempP = (signed char) buf[200];
+    return 0;
+}
+
+/* LOG SENSE temperature page, parameter 0x0000 holds the current temperature */
+int temp_read_sas(char *dev, int *tempP)
+{
+    int ret;
+    unsigned char buf[64];
+
+    if((ret = send_scsi_command_with_buf(dev, "4d,00,4d,00,00,00,00,00,40,00", buf, sizeof(buf))) != 0)
+    {
+        return ret;
+    }
+    if((buf[0] & 0x3f) != 0x0d || buf[4] != 0 || buf[5] != 0 || buf[9] == 0xff)
+    {
+        return -1;
+    }
+    *tempP = buf[9];
+    return 0;
+}
+
+/* GET LOG PAGE 0x02, composite temperature in Kelvin at bytes 1-2 */
+int temp_read_nvme(char *dev, int *tempP)
+{
+    int fd, ret;
+    unsigned char buf[512];
+    struct nvme_admin_cmd cmd;
+
+    if((fd = open(dev, O_RDONLY)) < 0)
+    {
+        return -1;
+    }
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = 0x02;
+    cmd.nsid = 0xffffffff;
+    cmd.addr = (unsigned long) buf;
+    cmd.data_len = sizeof(buf);
+    cmd.cdw10 = ((sizeof(buf) / 4 - 1) << 16) | 0x02;
+    ret = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    close(fd);
+    if(ret != 0)
+    {
+        return -1;
+    }
+    *tempP = (buf[1] | (buf[2] << 8)) - 273;
+    return 0;
+}
+
+/*
+ * A disk behind a SAT layer is SATA, USB bridges included. INQUIRY vendor
+ * "ATA" when the SAT layer could not be probed yet.
+ */
+static TEMP_DISK_TYPE get_disk_type(const char *dev)
+{
+    unsigned char buf[96];
+    SAT_TRANSPORT transport;
+
+    if(strstr(dev, "nvme"))
+    {
+        return TEMP_DISK_NVME;
+    }
+    transport = sat_detect((char*) dev);
+    if(transport == SAT_PT12 || transport == SAT_PT16)
+    {
+        return TEMP_DISK_SATA;
+    }
+    if(transport == SAT_UNKNOWN && send_scsi_command_with_buf((char*) dev, "12,00,00,00,60,00", buf, sizeof(buf)) == 0 &&
+       !memcmp(buf + 8, "ATA     ", 8))
+    {
+        return TEMP_DISK_SATA;
+    }
+    return TEMP_DISK_SAS;
+}
+
+int temp_sampler_add(const char *dev)
+{
+    int i;
+    TEMP_DISK_TYPE type = get_disk_type(dev);
+
+    pthread_mutex_lock(&disk_lock);
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+            break;
+    }
+    if(i == disk_num)
+    {
+        if(disk_num == TEMP_SAMPLER_MAX_DISK)
+        {
+            pthread_mutex_unlock(&disk_lock);
+            return -1;
+        }
+        disk_num++;
+    }
+    memset(&disks[i], 0, sizeof(disks[i]));
+    snprintf(disks[i].dev, sizeof(disks[i].dev), "%s", dev);
+    disks[i].type = type;
+    disks[i].interval = TEMP_SAMPLE_MIN_SEC;
+    pthread_mutex_unlock(&disk_lock);
+    return 0;
+}
+
+/* dev is sampled from now on, a disk already sampled keeps its value and interval */
+int temp_sampler_watch(const char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&disk_lock);
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+        {
+            pthread_mutex_unlock(&disk_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&disk_lock);
+    return temp_sampler_add(dev);
+}
+
+int temp_sampler_remove(const char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&disk_lock);
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+        {
+            disks[i] = disks[--disk_num];
+            pthread_mutex_unlock(&disk_lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&disk_lock);
+    return -1;
+}
+
+struct sample_work {
+    struct temp_disk due[TEMP_SAMPLER_MAX_DISK];
+    int ret[TEMP_SAMPLER_MAX_DISK];
+    int num;
+    int next;
+};
+
+static void *sample_worker(void *arg)
+{
+    int i;
+    struct sample_work *work = (struct sample_work*) arg;
+
+    while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num)
+    {
+        struct temp_disk *d = &work->due[i];
+
+        if(d->type == TEMP_DISK_SATA)
+            work->ret[i] = temp_read_sata(d->dev, &d->temp);
+        else if(d->type == TEMP_DISK_SAS)
+            work->ret[i] = temp_read_sas(d->dev, &d->temp);
+        else
+            work->ret[i] = temp_read_nvme(d->dev, &d->temp);
+    }
+    return NULL;
+}
+
+/* disk_lock held */
+static void update_disk(struct temp_disk *d, int temp, int ret, time_t now)
+{
+    int delta;
+
+    d->standby = (ret == POWER_GATE_STANDBY);
+    if(ret == 0)
+    {
+        delta = d->valid ? abs(temp - d->temp) : TEMP_SAMPLE_STEP;
+        if(delta >= TEMP_SAMPLE_STEP)
+            d->interval = TEMP_SAMPLE_MIN_SEC;
+        else if(delta == 0 && d->interval * 2 <= TEMP_SAMPLE_MAX_SEC)
+            d->interval *= 2;
+        d->temp = temp;
+        d->valid = 1;
+        d->stamp = now;
+    }
+    d->next = now + d->interval;
+}
+
+/*
+ * Sample every disk whose interval has passed.
+ * @return number of disks sampled (standby and failed ones included).
+ */
+int temp_sampler_poll()
+{
+    int i, j;
+    int thread_num;
+    time_t now = now_sec();
+    pthread_t tids[TEMP_SAMPLER_THREADS];
+    static struct sample_work work;
+    static pthread_mutex_t poll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&poll_lock);
+    pthread_mutex_lock(&disk_lock);
+    work.num = 0;
+    work.next = 0;
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(disks[i].next <= now)
+            work.due[work.num++] = disks[i];
+    }
+    pthread_mutex_unlock(&disk_lock);
+
+    thread_num = work.num - 1 < TEMP_SAMPLER_THREADS ? work.num - 1 : TEMP_SAMPLER_THREADS;
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        if(pthread_create(&tids[i], NULL, sample_worker, &work) != 0)
+            break;
+    }
+    thread_num = i;
+    sample_worker(&work);
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    now = now_sec();
+    pthread_mutex_lock(&disk_lock);
+    for(i = 0 ; i < work.num ; i++)
+    {
+        for(j = 0 ; j < disk_num ; j++)
+        {
+            if(!strcmp(disks[j].dev, work.due[i].dev))
+            {
+                update_disk(&disks[j], work.due[i].temp, work.ret[i], now);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&disk_lock);
+    pthread_mutex_unlock(&poll_lock);
+    return work.num;
+}
+
+static void *sampler_loop(void *arg)
+{
+    while(running)
+    {
+        temp_sampler_poll();
+        sleep(1);
+    }
+    return NULL;
+}
+
+int temp_sampler_start()
+{
+    if(running)
+    {
+        return 0;
+    }
+    running = 1;
+    if(pthread_create(&sampler, NULL, sampler_loop, NULL) != 0)
+    {
+        running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void temp_sampler_stop()
+{
+    if(!running)
+    {
+        return;
+    }
+    running = 0;
+    pthread_join(sampler, NULL);
+}
+
+/*
+ * Cached temperature of dev.
+ * @param[out] ageP seconds since the value was read, it keeps growing while
+ *             the disk sleeps.
+ * @retval 0 Success.
+ * @retval -1 dev is not sampled or has no value yet.
+ */
+int temp_sampler_get(const char *dev, int *tempP, int *ageP)
+{
+    int i;
+    int ret = -1;
+
+    pthread_mutex_lock(&disk_lock);
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        if(!strcmp(disks[i].dev, dev))
+        {
+            if(disks[i].valid)
+            {
+                *tempP = disks[i].temp;
+                if(ageP)
+                    *ageP = now_sec() - disks[i].stamp;
+                ret = 0;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&disk_lock);
+    return ret;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i;
+    int temp, age;
+    static const char *type_names[] = {"sata", "sas", "nvme"};
+
+    /* temp_sampler /dev/sg1 /dev/sg2 /dev/nvme0 ... */
+    for(i = 1 ; i < argc ; i++)
+    {
+        temp_sampler_add(argv[i]);
+    }
+    printf("sampled: %d\n", temp_sampler_poll());
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        printf("(dev, type, standby, interval) = (%s, %s, %d, %d)\n", disks[i].dev, type_names[disks[i].type],
+               disks[i].standby, disks[i].interval);
+        if(temp_sampler_get(disks[i].dev, &temp, &age) == 0)
+            printf("(dev, temp, age) = (%s, %d, %d)\n", disks[i].dev, temp, age);
+    }
+    return 0;
+}
+#endif
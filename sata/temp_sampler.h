@@ -0,0 +1,42 @@
+#ifndef _TEMP_SAMPLER_H
+#define _TEMP_SAMPLER_H
+
+#include <time.h>
+
+#define TEMP_SAMPLER_MAX_DISK   128
+#define TEMP_SAMPLER_THREADS    16
+#define TEMP_SAMPLE_MIN_SEC     10      /* interval while the temperature moves */
+#define TEMP_SAMPLE_MAX_SEC     120     /* interval once it is steady */
+#define TEMP_SAMPLE_STEP        2       /* degrees that reset the interval to the minimum */
+
+typedef enum _TEMP_DISK_TYPE
+{
+    TEMP_DISK_SATA = 0,                 /*!< SCT status through ATA PASS-THROUGH */
+    TEMP_DISK_SAS,                      /*!< LOG SENSE temperature page 0x0d */
+    TEMP_DISK_NVME,                     /*!< SMART / health log page 0x02 */
+} TEMP_DISK_TYPE;
+
+struct temp_disk {
+    char dev[64];                       /*!< "/dev/sg1", "/dev/nvme0" */
+    TEMP_DISK_TYPE type;
+    int temp;                           /*!< Celsius */
+    int valid;
+    int standby;                        /*!< skipped at the last sample, temp is older */
+    int interval;
+    time_t stamp;                       /*!< CLOCK_MONOTONIC seconds of temp */
+    time_t next;
+};
+
+int temp_sampler_add(const char *dev);
+int temp_sampler_watch(const char *dev);
+int temp_sampler_remove(const char *dev);
+int temp_sampler_poll();
+int temp_sampler_start();
+void temp_sampler_stop();
+int temp_sampler_get(const char *dev, int *tempP, int *ageP);
+
+int temp_read_sata(char *dev, int *tempP);
+int temp_read_sas(char *dev, int *tempP);
+int temp_read_nvme(char *dev, int *tempP);
+
+#endif
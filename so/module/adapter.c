@@ -7,40 +7,114 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "hal.h"
 #include "adapter.h"
+#include "uevent.h"
+#include "ses_status.h"
 #include <fcntl.h>
 #define MODULE_PATH    "/root/module/"
 
 struct module_struct {
     char name[64];
     void *handle;
+    struct module_ops ops;
 };
 
-struct module_struct modules[1];
+struct module_struct modules[MAX_MODULE_NUM];
+int module_num = 0;
 
 int loaded = 0;
 
+/*
+ * Called from the constructors of the in-tree modules (STATIC_MODULES),
+ * before main() and before any directory scan.
+ */
+int adapter_register_module(struct module_ops *ops)
+{
+    if(module_num >= MAX_MODULE_NUM)
+    {
+        return -1;
+    }
+    snprintf(modules[module_num].name, sizeof(modules[module_num].name), "%s", ops->name);
+    modules[module_num].handle = NULL;
+    modules[module_num].ops = *ops;
+    module_num++;
+    return 0;
+}
+
+int is_module_registered(char *name)
+{
+    int i;
+    for(i = 0 ; i < module_num ; i++)
+    {
+        if(!strcmp(modules[i].name, name))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifndef NO_DYNAMIC_MODULES
+int load_module(char *path, char *name)
+{
+    void *handle;
+    struct module_ops ops = {0};
+
+    handle = dlopen(path, RTLD_LAZY);
+    if(handle == NULL)
+    {
+        adapter_debug_log(LOG_ERROR, "%s : (%s, %s)\n", __func__, path, dlerror());
+        return -1;
+    }
+    ops.name = name;
+    ops.find_module_by_enc_sysid = dlsym(handle, "find_module_by_enc_sysid");
+    ops.get_enc_info = dlsym(handle, "get_enc_info");
+    ops.write_enc_conf = dlsym(handle, "write_enc_conf");
+    ops.pd_scan = dlsym(handle, "pd_scan");
+    ops.se_attach_specific = dlsym(handle, "se_attach_specific");
+    ops.mod_get_enc_info_batch = dlsym(handle, "mod_get_enc_info_batch");
+    if(adapter_register_module(&ops) < 0)
+    {
+        dlclose(handle);
+        return -1;
+    }
+    modules[module_num - 1].handle = handle;
+    return 0;
+}
+#endif
+
 int load_modules()
 {
+    int ret = 0;
+
     if(loaded == 1)
     {
         return 0;;
     }
     loaded = 1;
 
-    int i = 0;
+#ifndef NO_DYNAMIC_MODULES
     struct dirent *de;
     DIR *dr = opendir(MODULE_PATH);
     if (dr == NULL)
     {
-        return -1;
+        ret = -1;
     }
     
-    while ((de = readdir(dr)) != NULL)
+    while (dr && (de = readdir(dr)) != NULL)
     {
         char buf[128] = {0};
+        char name[64] = {0};
+        char *ext;
         if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
         {
             continue;
@@ -50,15 +124,31 @@ int load_modules()
             continue;
         }
 
-        sprintf(buf, "%s/%s", MODULE_PATH, de->d_name);
-        if(buf)
+        /* in-tree modules linked in with STATIC_MODULES win over their .so */
+        snprintf(name, sizeof(name), "%s", de->d_name);
+        if((ext = strstr(name, ".so")) != NULL)
         {
-            sprintf(modules[i].name, "%s", de->d_name);
-            modules[i].handle = dlopen(buf, RTLD_LAZY);
-            i++;
+            *ext = 0;
         }
+        if(is_module_registered(name))
+        {
+            continue;
+        }
+
+        snprintf(buf, sizeof(buf), "%s/%s", MODULE_PATH, de->d_name);
+        load_module(buf, name);
+    }
+    if(dr)
+    {
+        closedir(dr);
     }
-    closedir(dr);
+#endif
+    /* modules answer from the topology the listener keeps current */
+    if(adapter_start_discovery() < 0)
+    {
+        adapter_debug_log(LOG_WARNING, "%s : uevent discovery not started, pd_scan is not cached\n", __func__);
+    }
+    return ret;
 }
 
 void get_time(char *time_str)
@@ -120,23 +210,332 @@ int adapter_debug_log(int flags, const char* format, ...)
 
 }
 
+/*
+ * Dispatch timing.
+ * Every thread counts into its own block, blocks of exited threads are
+ * reused by new threads so the memory stays bounded.
+ */
+struct thread_stat {
+    struct thread_stat *next;
+    int in_use;
+    struct adapter_entry_stat stat[MAX_MODULE_NUM + 1][ENTRY_NUM];
+};
+
+static struct thread_stat *thread_stats = NULL;
+static pthread_mutex_t stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t stat_key;
+static pthread_once_t stat_once = PTHREAD_ONCE_INIT;
+static __thread struct thread_stat *my_stat = NULL;
+static unsigned long long ns_mult = 1 << 16;       /* ns = ticks * ns_mult >> 16 */
+
+static const char *entry_names[ENTRY_NUM] = {
+    "find_module_by_enc_sysid",
+    "get_enc_info",
+    "write_enc_conf",
+    "pd_scan",
+    "se_attach_specific",
+    "get_enc_info_batch",
+};
+
+static int stat_ready = 0;
+static int cal_done = 0;
+static unsigned long long cal_t0, cal_c0;  /* coarse ns and TSC of the first calibration edge */
+static void stat_init();
+
+/*
+ * The first call calibrates (once per process, not at load time), so the
+ * first timed interval does not include the calibration.
+ */
+static inline unsigned long long stat_ticks()
+{
+    if(__builtin_expect(!__atomic_load_n(&stat_ready, __ATOMIC_ACQUIRE), 0))
+    {
+        pthread_once(&stat_once, stat_init);
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static void stat_release(void *arg)
+{
+    struct thread_stat *ts = (struct thread_stat*) arg;
+    __atomic_store_n(&ts->in_use, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Dumps the counters into STAT_DUMP_FILE. The adapter installs no signal
+ * handler itself, a process that wants the dump installs this one
+ * (e.g. for STAT_DUMP_SIGNAL).
+ */
+void adapter_stat_signal_handler(int sig)
+{
+    int fd = open(STAT_DUMP_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        return;
+    }
+    adapter_dump_stat(fd);
+    close(fd);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static unsigned long long stat_coarse_edge(unsigned long long *tsc)
+{
+    struct timespec t0, t;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &t0);
+    do
+    {
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &t);
+    } while(t.tv_sec == t0.tv_sec && t.tv_nsec == t0.tv_nsec);
+    *tsc = __rdtsc();
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+#endif
+
+static void stat_init()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned long long c1, t1;
+
+    /* first guess from one tick of the coarse clock, edge to edge */
+    cal_t0 = stat_coarse_edge(&cal_c0);
+    t1 = stat_coarse_edge(&c1);
+    if(c1 > cal_c0 && t1 > cal_t0)
+    {
+        ns_mult = ((t1 - cal_t0) << 16) / (c1 - cal_c0);
+    }
+#endif
+    pthread_key_create(&stat_key, stat_release);
+    __atomic_store_n(&stat_ready, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * A coarse tick jitters, the guess is refined against the first edge
+ * until the window is STAT_CAL_WINDOW_NS long.
+ */
+static void stat_calibrate()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec ts;
+    unsigned long long t, c;
+
+    if(__atomic_load_n(&cal_done, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    c = __rdtsc();
+    t = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    if(t - cal_t0 < STAT_CAL_WINDOW_NS / 64 || c <= cal_c0)
+    {
+        return;
+    }
+    __atomic_store_n(&ns_mult, ((t - cal_t0) << 16) / (c - cal_c0), __ATOMIC_RELAXED);
+    if(t - cal_t0 >= STAT_CAL_WINDOW_NS)
+    {
+        __atomic_store_n(&cal_done, 1, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+static struct thread_stat *stat_get()
+{
+    struct thread_stat *ts;
+
+    if(my_stat)
+    {
+        return my_stat;
+    }
+    pthread_once(&stat_once, stat_init);
+    pthread_mutex_lock(&stat_lock);
+    for(ts = thread_stats ; ts ; ts = ts->next)
+    {
+        if(!__atomic_load_n(&ts->in_use, __ATOMIC_ACQUIRE))
+            break;
+    }
+    if(ts == NULL && (ts = calloc(1, sizeof(struct thread_stat))) != NULL)
+    {
+        ts->next = thread_stats;
+        __atomic_store_n(&thread_stats, ts, __ATOMIC_RELEASE);
+    }
+    if(ts)
+    {
+        ts->in_use = 1;
+        pthread_setspecific(stat_key, ts);
+    }
+    pthread_mutex_unlock(&stat_lock);
+    my_stat = ts;
+    return ts;
+}
+
+static inline void stat_add(int module, int entry, unsigned long long start)
+{
+    unsigned long long ns;
+    int bucket;
+    struct thread_stat *ts;
+    struct adapter_entry_stat *st;
+
+    stat_calibrate();
+    ns = ((stat_ticks() - start) * __atomic_load_n(&ns_mult, __ATOMIC_RELAXED)) >> 16;
+    bucket = 63 - __builtin_clzll(ns | 1);
+    ts = stat_get();
+
+    if(ts == NULL || module < 0 || module > MAX_MODULE_NUM)
+    {
+        return;
+    }
+    if(bucket >= STAT_HIST_BUCKETS)
+    {
+        bucket = STAT_HIST_BUCKETS - 1;
+    }
+    st = &ts->stat[module][entry];
+    /* only this thread writes the block, readers may see a slightly old value */
+    __atomic_store_n(&st->count, st->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->total_ns, st->total_ns + ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->hist[bucket], st->hist[bucket] + 1, __ATOMIC_RELAXED);
+    if(ns > st->max_ns)
+    {
+        __atomic_store_n(&st->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * Sum the counters of all threads.
+ * @param module module index, or STAT_ADAPTER for the adapter call as a whole
+ *        (module probe + dispatch + logging).
+ * @param entry one of enum adapter_entry.
+ */
+int adapter_get_stat(int module, int entry, struct adapter_entry_stat *stat)
+{
+    int i;
+    struct thread_stat *ts;
+    struct adapter_entry_stat *st;
+
+    if(module < 0 || module > MAX_MODULE_NUM || entry < 0 || entry >= ENTRY_NUM)
+    {
+        return -1;
+    }
+    memset(stat, 0, sizeof(*stat));
+    for(ts = __atomic_load_n(&thread_stats, __ATOMIC_ACQUIRE) ; ts ; ts = ts->next)
+    {
+        st = &ts->stat[module][entry];
+        stat->count += __atomic_load_n(&st->count, __ATOMIC_RELAXED);
+        stat->total_ns += __atomic_load_n(&st->total_ns, __ATOMIC_RELAXED);
+        if(__atomic_load_n(&st->max_ns, __ATOMIC_RELAXED) > stat->max_ns)
+        {
+            stat->max_ns = st->max_ns;
+        }
+        for(i = 0 ; i < STAT_HIST_BUCKETS ; i++)
+        {
+            stat->hist[i] += __atomic_load_n(&st->hist[i], __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+/* async-signal-safe number/string output for the signal dump */
+static int stat_puts(char *buf, int off, int len, const char *str)
+{
+    while(*str && off < len - 1)
+    {
+        buf[off++] = *str++;
+    }
+    return off;
+}
+
+static int stat_putu(char *buf, int off, int len, unsigned long long v)
+{
+    char tmp[24];
+    int i = 0;
+
+    do
+    {
+        tmp[i++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    while(i > 0 && off < len - 1)
+    {
+        buf[off++] = tmp[--i];
+    }
+    return off;
+}
+
+/*
+ * Write one line per (module, entry) with calls:
+ * "<module> <entry> count=<n> avg_ns=<n> max_ns=<n> hist=<bucket>:<n>,..."
+ * Only uses async-signal-safe calls, it may run from adapter_stat_signal_handler().
+ */
+void adapter_dump_stat(int fd)
+{
+    int m, e, i, off;
+    char line[1024];
+    struct adapter_entry_stat st;
+
+    for(m = 0 ; m <= MAX_MODULE_NUM ; m++)
+    {
+        if(m != STAT_ADAPTER && m >= module_num)
+        {
+            continue;
+        }
+        for(e = 0 ; e < ENTRY_NUM ; e++)
+        {
+            if(adapter_get_stat(m, e, &st) < 0 || st.count == 0)
+            {
+                continue;
+            }
+            off = stat_puts(line, 0, sizeof(line), m == STAT_ADAPTER ? "adapter" : modules[m].name);
+            off = stat_puts(line, off, sizeof(line), " ");
+            off = stat_puts(line, off, sizeof(line), entry_names[e]);
+            off = stat_puts(line, off, sizeof(line), " count=");
+            off = stat_putu(line, off, sizeof(line), st.count);
+            off = stat_puts(line, off, sizeof(line), " avg_ns=");
+            off = stat_putu(line, off, sizeof(line), st.total_ns / st.count);
+            off = stat_puts(line, off, sizeof(line), " max_ns=");
+            off = stat_putu(line, off, sizeof(line), st.max_ns);
+            off = stat_puts(line, off, sizeof(line), " hist=");
+            for(i = 0 ; i < STAT_HIST_BUCKETS ; i++)
+            {
+                if(st.hist[i] == 0)
+                    continue;
+                off = stat_putu(line, off, sizeof(line), i);
+                off = stat_puts(line, off, sizeof(line), ":");
+                off = stat_putu(line, off, sizeof(line), st.hist[i]);
+                off = stat_puts(line, off, sizeof(line), ",");
+            }
+            line[off++] = '\n';
+            write(fd, line, off);
+        }
+    }
+}
+
 int find_module_by_enc_sysid(char *enc_sys_id)
 {
     int i;
     int ret = -1;
+    unsigned long long start;
 
     load_modules();
-    for(i = 0 ; i < 1 ; i++)
+    for(i = 0 ; i < module_num ; i++)
     {
-        int (*func)(char*);
-        func = dlsym(modules[i].handle, "find_module_by_enc_sysid");
-        ret = func(enc_sys_id);
+        if(modules[i].ops.find_module_by_enc_sysid == NULL)
+        {
+            continue;
+        }
+        start = stat_ticks();
+        ret = modules[i].ops.find_module_by_enc_sysid(enc_sys_id);
+        stat_add(i, ENTRY_FIND_MODULE, start);
         if(ret == 0)
         {
             return i;
         }
     }
-    return ret;
+    return -1;
 }
 
 int find_module_by_enc_id(int enc_id)
@@ -155,62 +554,313 @@ int find_module_by_enc_id(int enc_id)
 int get_enc_info(char *enc_sys_id, ENCLOSURE_INFO *enc_info)
 {
     int i;
-    int (*func)(char*, ENCLOSURE_INFO*);
+    int ret = -1;
+    unsigned long long start = stat_ticks();
+    unsigned long long call;
 
     i = find_module_by_enc_sysid(enc_sys_id);
-    if(i < 0)
+    if(i >= 0)
     {
-        return -1;
+        adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
+        if(modules[i].ops.get_enc_info)
+        {
+            call = stat_ticks();
+            ret = modules[i].ops.get_enc_info(enc_sys_id, enc_info);
+            stat_add(i, ENTRY_GET_ENC_INFO, call);
+        }
+    }
+    stat_add(STAT_ADAPTER, ENTRY_GET_ENC_INFO, start);
+    return ret;
+}
+
+
+struct enc_group {
+    int module;
+    int count;
+    char *enc_sys_ids[MAX_SE_NUM];
+    ENCLOSURE_INFO *enc_infos[MAX_SE_NUM];
+    int *rets[MAX_SE_NUM];
+    pthread_t tid;
+};
+
+void *get_enc_info_group(void *arg)
+{
+    int i;
+    int rets[MAX_SE_NUM];
+    struct enc_group *group = (struct enc_group*) arg;
+    struct module_ops *ops = &modules[group->module].ops;
+    unsigned long long start;
+
+    adapter_debug_log(LOG_ERROR, "%s : (%s, %d)\n", __func__, modules[group->module].name, group->count);
+    if(ops->mod_get_enc_info_batch)
+    {
+        start = stat_ticks();
+        ops->mod_get_enc_info_batch(group->enc_sys_ids, group->count, group->enc_infos, rets);
+        stat_add(group->module, ENTRY_GET_ENC_INFO_BATCH, start);
+        for(i = 0 ; i < group->count ; i++)
+        {
+            *group->rets[i] = rets[i];
+        }
+        return NULL;
+    }
+    for(i = 0 ; i < group->count ; i++)
+    {
+        *group->rets[i] = -1;
+        if(ops->get_enc_info)
+        {
+            start = stat_ticks();
+            *group->rets[i] = ops->get_enc_info(group->enc_sys_ids[i], group->enc_infos[i]);
+            stat_add(group->module, ENTRY_GET_ENC_INFO, start);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Fill enc_infos[] for a set of enclosures in one call.
+ * The enclosures are grouped per module, each module serves its whole group
+ * in one pass (mod_get_enc_info_batch, or get_enc_info in a loop when the module
+ * has no batch entry) and the groups run concurrently.
+ *
+ * @param enc_sys_ids enclosures to query, NULL for all enclosures of SE_Enumerate()
+ *        (their enc_sys_id is stored into enc_infos[i].enc_sys_id).
+ * @param count entry count of enc_sys_ids, enc_infos and rets.
+ * @param rets per enclosure return value of the module, -1 if no module serves it.
+ * @return number of enclosures queried, -1 on failure.
+ */
+int get_enc_info_batch(char *enc_sys_ids[], int count, ENCLOSURE_INFO enc_infos[], int rets[])
+{
+    int i, j;
+    int enc_num = count;
+    int group_num = 0;
+    int id_ary[MAX_SE_NUM];
+    char *ids[MAX_SE_NUM];
+    char id_buf[MAX_SE_NUM][MAX_SYS_ID_LEN];
+    struct enc_group groups[MAX_MODULE_NUM];
+    unsigned long long start = stat_ticks();
+
+    if(count > MAX_SE_NUM)
+    {
+        count = MAX_SE_NUM;
+        enc_num = count;
+    }
+    load_modules();
+
+    if(enc_sys_ids == NULL)
+    {
+        enc_num = SE_Enumerate(id_ary, count, NULL, NULL);
+        if(enc_num < 0)
+        {
+            stat_add(STAT_ADAPTER, ENTRY_GET_ENC_INFO_BATCH, start);
+            return -1;
+        }
+        if(enc_num > count)
+        {
+            enc_num = count;
+        }
+        for(i = 0 ; i < enc_num ; i++)
+        {
+            memset(&enc_infos[i], 0, sizeof(ENCLOSURE_INFO));
+            /* the module fills enc_infos[i], it must not overwrite the id it is reading */
+            id_buf[i][0] = '\0';
+            se_lookup_sys_id(id_ary[i], id_buf[i], sizeof(id_buf[i]));
+            snprintf(enc_infos[i].enc_sys_id, sizeof(enc_infos[i].enc_sys_id), "%s", id_buf[i]);
+            ids[i] = id_buf[i];
+        }
+    }
+    else
+    {
+        for(i = 0 ; i < enc_num ; i++)
+        {
+            ids[i] = enc_sys_ids[i];
+        }
+    }
+
+    for(i = 0 ; i < enc_num ; i++)
+    {
+        int m = find_module_by_enc_sysid(ids[i]);
+
+        rets[i] = -1;
+        if(m < 0)
+        {
+            continue;
+        }
+        for(j = 0 ; j < group_num ; j++)
+        {
+            if(groups[j].module == m)
+                break;
+        }
+        if(j == group_num)
+        {
+            groups[j].module = m;
+            groups[j].count = 0;
+            group_num++;
+        }
+        groups[j].enc_sys_ids[groups[j].count] = ids[i];
+        groups[j].enc_infos[groups[j].count] = &enc_infos[i];
+        groups[j].rets[groups[j].count] = &rets[i];
+        groups[j].count++;
     }
-    adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
-    func = dlsym(modules[i].handle, "get_enc_info");
-    return func(enc_sys_id, enc_info); 
+
+    /* the last group runs on the calling thread */
+    for(j = 0 ; j < group_num - 1 ; j++)
+    {
+        if(pthread_create(&groups[j].tid, NULL, get_enc_info_group, &groups[j]) != 0)
+        {
+            get_enc_info_group(&groups[j]);
+            groups[j].tid = 0;
+        }
+    }
+    if(group_num > 0)
+    {
+        get_enc_info_group(&groups[group_num - 1]);
+    }
+    for(j = 0 ; j < group_num - 1 ; j++)
+    {
+        if(groups[j].tid)
+        {
+            pthread_join(groups[j].tid, NULL);
+        }
+    }
+    stat_add(STAT_ADAPTER, ENTRY_GET_ENC_INFO_BATCH, start);
+    return enc_num;
 }
 
 
 int write_enc_conf(int enc_id, ENCLOSURE_INFO *enc_info)
 {
     int i;
-    int (*func)(int, ENCLOSURE_INFO*);
+    int ret = -1;
+    unsigned long long start = stat_ticks();
+    unsigned long long call;
 
     i = find_module_by_enc_sysid(enc_info->enc_sys_id);
-    if(i < 0)
+    if(i >= 0)
+    {
+        adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
+        if(modules[i].ops.write_enc_conf)
+        {
+            call = stat_ticks();
+            ret = modules[i].ops.write_enc_conf(enc_id, enc_info);
+            stat_add(i, ENTRY_WRITE_ENC_CONF, call);
+        }
+    }
+    stat_add(STAT_ADAPTER, ENTRY_WRITE_ENC_CONF, start);
+    return ret;
+}
+
+/*
+ * With uevent discovery running, an enclosure whose last scan is newer than
+ * the last device event is not rescanned.
+ */
+struct scan_cache {
+    int enc_id;
+    int ret;
+    unsigned long generation;
+};
+
+static int discovery = 0;
+static struct scan_cache scan_caches[MAX_SE_NUM];
+static int scan_cache_num = 0;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int adapter_start_discovery()
+{
+    if(discovery)
+    {
+        return 0;
+    }
+    ses_status_start_hotplug();
+    if(uevent_start() < 0)
     {
         return -1;
     }
-    adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
-    func = dlsym(modules[i].handle, "write_enc_conf");
-    return func(enc_id, enc_info); 
+    discovery = 1;
+    return 0;
+}
+
+static struct scan_cache *get_scan_cache(int enc_id)
+{
+    int i;
+    for(i = 0 ; i < scan_cache_num ; i++)
+    {
+        if(scan_caches[i].enc_id == enc_id)
+            return &scan_caches[i];
+    }
+    if(scan_cache_num == MAX_SE_NUM)
+    {
+        return NULL;
+    }
+    scan_caches[scan_cache_num].enc_id = enc_id;
+    scan_caches[scan_cache_num].generation = (unsigned long) -1;
+    return &scan_caches[scan_cache_num++];
 }
 
 int pd_scan(int enc_id)
 {
     int i;
-    int (*func)(int);
+    int ret = -1;
+    unsigned long long start = stat_ticks();
+    unsigned long long call;
+    unsigned long generation = uevent_get_generation();
+    struct scan_cache *cache = NULL;
+
+    if(discovery)
+    {
+        pthread_mutex_lock(&scan_lock);
+        cache = get_scan_cache(enc_id);
+        if(cache && cache->generation == generation)
+        {
+            ret = cache->ret;
+            pthread_mutex_unlock(&scan_lock);
+            stat_add(STAT_ADAPTER, ENTRY_PD_SCAN, start);
+            return ret;
+        }
+        pthread_mutex_unlock(&scan_lock);
+    }
 
     i = find_module_by_enc_id(enc_id);
-    if(i < 0)
+    if(i >= 0)
     {
-        return -1;
+        adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
+        if(modules[i].ops.pd_scan)
+        {
+            call = stat_ticks();
+            ret = modules[i].ops.pd_scan(enc_id);
+            stat_add(i, ENTRY_PD_SCAN, call);
+        }
     }
-    adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
-    func = dlsym(modules[i].handle, "pd_scan");
-    return func(enc_id); 
+    if(cache)
+    {
+        pthread_mutex_lock(&scan_lock);
+        cache->ret = ret;
+        cache->generation = generation;
+        pthread_mutex_unlock(&scan_lock);
+    }
+    stat_add(STAT_ADAPTER, ENTRY_PD_SCAN, start);
+    return ret;
 }
 
 int se_attach_specific(char *enc_sys_id, int enc_id)
 {
     int i;
-    int (*func)(char*, int);
+    int ret = -1;
+    unsigned long long start = stat_ticks();
+    unsigned long long call;
 
     i = find_module_by_enc_sysid(enc_sys_id);
-    if(i < 0)
+    if(i >= 0)
     {
-        return -1;
+        adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
+        if(modules[i].ops.se_attach_specific)
+        {
+            call = stat_ticks();
+            ret = modules[i].ops.se_attach_specific(enc_sys_id, enc_id);
+            stat_add(i, ENTRY_SE_ATTACH_SPECIFIC, call);
+        }
     }
-    adapter_debug_log(LOG_ERROR, "%s : (%s)\n", __func__, modules[i].name);
-    func = dlsym(modules[i].handle, "se_attach_specific");
-    return func(enc_sys_id, enc_id); 
+    stat_add(STAT_ADAPTER, ENTRY_SE_ATTACH_SPECIFIC, start);
+    return ret;
 }
 
 #ifdef UNIT_TEST
@@ -218,16 +868,33 @@ int se_attach_specific(char *enc_sys_id, int enc_id)
 int main(int argc, char *argv[])
 {
     int i;
+
+    signal(STAT_DUMP_SIGNAL, adapter_stat_signal_handler);
     load_modules();
 
-    for(i = 0 ; i < 1 ; i++)
+    if(argc > 2)
     {
-        void (*func)(char*);
-        printf("loaded module:%s\n", modules[i].name);       
-        func = dlsym(modules[i].handle, "find_module_by_enc_sysid");
-        func(argv[1]);
+        int rets[MAX_SE_NUM];
+        ENCLOSURE_INFO enc_infos[MAX_SE_NUM];
+
+        memset(enc_infos, 0, sizeof(enc_infos));
+        get_enc_info_batch(argv + 1, argc - 1, enc_infos, rets);
+        for(i = 0 ; i < argc - 1 ; i++)
+        {
+            printf("(enc_sys_id, ret) = (%s, %d)\n", argv[i + 1], rets[i]);
+        }
+        adapter_dump_stat(1);
+        return 0;
     }
 
+    for(i = 0 ; i < module_num ; i++)
+    {
+        printf("loaded module:%s (%s)\n", modules[i].name, modules[i].handle ? "dlopen" : "static");
+        if(modules[i].ops.find_module_by_enc_sysid)
+        {
+            modules[i].ops.find_module_by_enc_sysid(argv[1]);
+        }
+    }
 }
 
 #endif
@@ -3,3 +3,75 @@
 #define LOG_ERROR		0x0001
 #define LOG_WARNING	0x0002
 #define LOG_INFO		0x0004
+
+#define MAX_MODULE_NUM  16
+
+struct _ENCLOSURE_INFO;
+
+/*
+ * Entry points of a vendor module.
+ * In-tree modules fill it and register it with ADAPTER_MODULE(),
+ * out-of-tree modules get it filled by dlsym() when they are loaded.
+ */
+struct module_ops {
+    const char *name;
+    int (*find_module_by_enc_sysid)(char *enc_sys_id);
+    int (*get_enc_info)(char *enc_sys_id, struct _ENCLOSURE_INFO *enc_info);
+    int (*write_enc_conf)(int enc_id, struct _ENCLOSURE_INFO *enc_info);
+    int (*pd_scan)(int enc_id);
+    int (*se_attach_specific)(char *enc_sys_id, int enc_id);
+    /* optional, serves a group of enclosures in one pass */
+    int (*mod_get_enc_info_batch)(char *enc_sys_ids[], int count, struct _ENCLOSURE_INFO *enc_infos[], int rets[]);
+};
+
+/* adapter entry points timed per module, see adapter_get_stat() */
+enum adapter_entry {
+    ENTRY_FIND_MODULE = 0,
+    ENTRY_GET_ENC_INFO,
+    ENTRY_WRITE_ENC_CONF,
+    ENTRY_PD_SCAN,
+    ENTRY_SE_ATTACH_SPECIFIC,
+    ENTRY_GET_ENC_INFO_BATCH,
+    ENTRY_NUM,
+};
+
+#define STAT_ADAPTER        MAX_MODULE_NUM      /* module index of the whole adapter call */
+#define STAT_CAL_WINDOW_NS  1000000000ULL      /* TSC calibration window, x86 only */
+#define STAT_HIST_BUCKETS   40                  /* bucket k counts calls of [2^k, 2^(k+1)) ns */
+#define STAT_DUMP_SIGNAL    SIGUSR1             /* for callers that install adapter_stat_signal_handler() */
+#define STAT_DUMP_FILE      "/var/log/adapter_stat.log"
+
+struct adapter_entry_stat {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+    unsigned long long hist[STAT_HIST_BUCKETS];
+};
+
+int adapter_register_module(struct module_ops *ops);
+int adapter_get_stat(int module, int entry, struct adapter_entry_stat *stat);
+void adapter_dump_stat(int fd);
+void adapter_stat_signal_handler(int sig);
+int adapter_start_discovery();
+int adapter_debug_log(int flags, const char* format, ...);
+
+/* libuLinux_hal internal, enc_id -> enc_sys_id */
+int se_lookup_sys_id(int enc_id, char *enc_sys_id, int buf_len);
+
+/*
+ * STATIC_MODULES links the modules into the adapter, so their entry points
+ * must not be exported (they share names with the adapter's own).
+ * A module keeps its ops table and ADAPTER_MODULE() under #ifdef
+ * STATIC_MODULES, the dlopen build looks the entry points up by name.
+ */
+#ifdef STATIC_MODULES
+#define MODULE_API static
+#define ADAPTER_MODULE(ops) \
+    static void __attribute__((constructor)) register_##ops(void) \
+    { \
+        adapter_register_module(&ops); \
+    }
+#else
+#define MODULE_API
+#define ADAPTER_MODULE(ops)
+#endif
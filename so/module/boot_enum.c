@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/sysmacros.h>
+
+#include "hal.h"
+#include "sysfs_attr.h"
+#include "boot_enum.h"
+
+/*
+ * Boot time disk enumeration.
+ * Disks are read by BOOT_ENUM_THREADS workers in parallel, and the boot disk
+ * identity of the last boot is kept in BOOT_DISK_CACHE so the next boot
+ * confirms it with one lookup instead of a full scan.
+ */
+
+#define BOOT_DISK_CACHE_NUM 8
+
+struct boot_disk_cache {
+    int disk_id;
+    struct boot_disk disk;
+};
+
+static char sysfs_root[SYSFS_ATTR_PATH_LEN] = "";
+static char cache_file[SYSFS_ATTR_PATH_LEN] = BOOT_DISK_CACHE;
+
+/*
+ * For tests against a fake sysfs tree.
+ */
+void boot_enum_set_root(const char *root, const char *cache)
+{
+    snprintf(sysfs_root, sizeof(sysfs_root), "%s", root ? root : "");
+    snprintf(cache_file, sizeof(cache_file), "%s", cache ? cache : BOOT_DISK_CACHE);
+}
+
+static int is_disk_name(const char *name)
+{
+    return !strncmp(name, "sd", 2) || !strncmp(name, "nvme", 4) ||
+           !strncmp(name, "hd", 2) || !strncmp(name, "vd", 2);
+}
+
+/* SCSI unit serial number VPD page, the identity of disks without a wwid */
+static int read_vpd_pg80(const char *name, char *buf, int buf_len)
+{
+    int fd, ret, len;
+    unsigned char page[256];
+    char path[SYSFS_ATTR_PATH_LEN];
+
+    if(snprintf(path, sizeof(path), "%s/sys/block/%s/device/vpd_pg80", sysfs_root, name) >= (int) sizeof(path))
+    {
+        return -1;
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return -1;
+    }
+    ret = read(fd, page, sizeof(page));
+    close(fd);
+    if(ret < 4)
+    {
+        return -1;
+    }
+    len = (page[2] << 8) | page[3];
+    if(len > ret - 4)
+        len = ret - 4;
+    if(len > buf_len - 1)
+        len = buf_len - 1;
+    memcpy(buf, page + 4, len);
+    buf[len] = '\0';
+    sysfs_strip(buf);
+    return 0;
+}
+
+int boot_read_disk(const char *name, struct boot_disk *disk)
+{
+    unsigned int major, minor;
+    char buf[64];
+
+    memset(disk, 0, sizeof(*disk));
+    snprintf(disk->name, sizeof(disk->name), "%s", name);
+    if(sysfs_attr_readf(buf, sizeof(buf), "%s/sys/block/%s/dev", sysfs_root, name) < 0 ||
+       sscanf(buf, "%u:%u", &major, &minor) != 2)
+    {
+        return -1;
+    }
+    disk->dev_no = makedev(major, minor);
+    if(sysfs_attr_readf(disk->wwid, sizeof(disk->wwid), "%s/sys/block/%s/device/wwid", sysfs_root, name) < 0)
+    {
+        sysfs_attr_readf(disk->wwid, sizeof(disk->wwid), "%s/sys/block/%s/wwid", sysfs_root, name);
+    }
+    if(sysfs_attr_readf(disk->serial, sizeof(disk->serial), "%s/sys/block/%s/device/serial", sysfs_root, name) < 0)
+    {
+        read_vpd_pg80(name, disk->serial, sizeof(disk->serial));
+    }
+    return 0;
+}
+
+struct enum_work {
+    char (*names)[BOOT_DISK_NAME_LEN];
+    struct boot_disk *disks;
+    int *rets;
+    int num;
+    int next;
+};
+
+static void *enum_worker(void *arg)
+{
+    int i;
+    struct enum_work *work = (struct enum_work*) arg;
+
+    while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num)
+    {
+        work->rets[i] = boot_read_disk(work->names[i], &work->disks[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Read the identity of every disk in /sys/block concurrently.
+ * @return number of disks stored in disks[], -1 if /sys/block can not be read.
+ */
+int boot_enumerate_disks(struct boot_disk disks[], int max)
+{
+    int i, n = 0;
+    int thread_num;
+    char path[SYSFS_ATTR_PATH_LEN];
+    char (*names)[BOOT_DISK_NAME_LEN];
+    int *rets;
+    struct boot_disk *found;
+    pthread_t tids[BOOT_ENUM_THREADS];
+    struct enum_work work;
+    struct dirent *de;
+    DIR *dr;
+
+    if(snprintf(path, sizeof(path), "%s/sys/block", sysfs_root) >= (int) sizeof(path) ||
+       (dr = opendir(path)) == NULL)
+    {
+        return -1;
+    }
+    names = malloc(BOOT_ENUM_MAX_DISK * sizeof(*names));
+    rets = malloc(BOOT_ENUM_MAX_DISK * sizeof(*rets));
+    found = malloc(BOOT_ENUM_MAX_DISK * sizeof(*found));
+    if(names == NULL || rets == NULL || found == NULL)
+    {
+        closedir(dr);
+        free(names);
+        free(rets);
+        free(found);
+        return -1;
+    }
+    while((de = readdir(dr)) != NULL && n < BOOT_ENUM_MAX_DISK)
+    {
+        if(is_disk_name(de->d_name) &&
+           snprintf(names[n], BOOT_DISK_NAME_LEN, "%s", de->d_name) < BOOT_DISK_NAME_LEN)
+        {
+            n++;
+        }
+    }
+    closedir(dr);
+
+    work.names = names;
+    work.disks = found;
+    work.rets = rets;
+    work.num = n;
+    work.next = 0;
+    thread_num = n < BOOT_ENUM_THREADS ? n : BOOT_ENUM_THREADS;
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        if(pthread_create(&tids[i], NULL, enum_worker, &work) != 0)
+            break;
+    }
+    thread_num = i;
+    enum_worker(&work);
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    for(i = 0, n = work.num, work.num = 0 ; i < n ; i++)
+    {
+        if(rets[i] == 0 && work.num < max)
+        {
+            disks[work.num++] = found[i];
+        }
+    }
+    free(names);
+    free(rets);
+    free(found);
+    return work.num;
+}
+
+/*
+ * PD_Boot_Enumerate() counterpart without the callback.
+ */
+int boot_enumerate(dev_t dev_no_ary[], unsigned int dev_no_ary_count)
+{
+    int i, num;
+    struct boot_disk *disks = malloc(BOOT_ENUM_MAX_DISK * sizeof(struct boot_disk));
+
+    if(disks == NULL)
+    {
+        return -1;
+    }
+    num = boot_enumerate_disks(disks, BOOT_ENUM_MAX_DISK);
+    for(i = 0 ; i < num && (unsigned int) i < dev_no_ary_count ; i++)
+    {
+        dev_no_ary[i] = disks[i].dev_no;
+    }
+    free(disks);
+    return num;
+}
+
+/* "<disk_id>\t<major>:<minor>\t<name>\t<wwid>\t<serial>", "-" for an empty field */
+static int load_cache(struct boot_disk_cache caches[], int max)
+{
+    int n = 0;
+    unsigned int major, minor;
+    char line[512];
+    char *f[5], *save;
+    int i;
+    FILE *fp = fopen(cache_file, "r");
+
+    if(fp == NULL)
+    {
+        return 0;
+    }
+    while(n < max && fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\n")] = '\0';
+        for(i = 0 ; i < 5 ; i++)
+        {
+            f[i] = strtok_r(i == 0 ? line : NULL, "\t", &save);
+            if(f[i] == NULL)
+                break;
+        }
+        if(i < 5 || sscanf(f[1], "%u:%u", &major, &minor) != 2)
+            continue;
+        memset(&caches[n], 0, sizeof(caches[n]));
+        caches[n].disk_id = atoi(f[0]);
+        caches[n].disk.dev_no = makedev(major, minor);
+        snprintf(caches[n].disk.name, BOOT_DISK_NAME_LEN, "%s", f[2]);
+        snprintf(caches[n].disk.wwid, BOOT_DISK_ID_LEN, "%s", strcmp(f[3], "-") ? f[3] : "");
+        snprintf(caches[n].disk.serial, BOOT_DISK_ID_LEN, "%s", strcmp(f[4], "-") ? f[4] : "");
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+/* fsync the directory holding path, so a rename into it survives a power loss */
+static int sync_dir(const char *path)
+{
+    int fd, ret;
+    char dir[SYSFS_ATTR_PATH_LEN];
+    char *slash;
+
+    snprintf(dir, sizeof(dir), "%s", path);
+    if((slash = strrchr(dir, '/')) == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else if(slash == dir)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+    if((fd = open(dir, O_RDONLY | O_DIRECTORY)) < 0)
+    {
+        return -1;
+    }
+    ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+static int save_cache(int disk_id, struct boot_disk *disk)
+{
+    int i, n;
+    char tmp[SYSFS_ATTR_PATH_LEN + 8];
+    struct boot_disk_cache caches[BOOT_DISK_CACHE_NUM];
+    FILE *fp;
+
+    n = load_cache(caches, BOOT_DISK_CACHE_NUM);
+    for(i = 0 ; i < n ; i++)
+    {
+        if(caches[i].disk_id == disk_id)
+            break;
+    }
+    if(i == BOOT_DISK_CACHE_NUM)
+    {
+        return -1;
+    }
+    caches[i].disk_id = disk_id;
+    caches[i].disk = *disk;
+    if(i == n)
+        n++;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cache_file);
+    if((fp = fopen(tmp, "w")) == NULL)
+    {
+        return -1;
+    }
+    for(i = 0 ; i < n ; i++)
+    {
+        fprintf(fp, "%d\t%u:%u\t%s\t%s\t%s\n", caches[i].disk_id,
+                major(caches[i].disk.dev_no), minor(caches[i].disk.dev_no), caches[i].disk.name,
+                caches[i].disk.wwid[0] ? caches[i].disk.wwid : "-",
+                caches[i].disk.serial[0] ? caches[i].disk.serial : "-");
+    }
+    /* the data is on disk before the rename, the rename before the next boot reads it */
+    if(fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    if(fclose(fp) != 0 || rename(tmp, cache_file) != 0)
+    {
+        unlink(tmp);
+        return -1;
+    }
+    return sync_dir(cache_file);
+}
+
+static int same_disk(struct boot_disk *a, struct boot_disk *b)
+{
+    if(a->wwid[0] && b->wwid[0])
+        return !strcmp(a->wwid, b->wwid);
+    if(a->serial[0] && b->serial[0])
+        return !strcmp(a->serial, b->serial);
+    return 0;
+}
+
+/* dev_t -> disk name through /sys/dev/block/<major>:<minor> */
+static int name_by_dev_no(dev_t dev_no, char *name, int len)
+{
+    int ret;
+    char path[SYSFS_ATTR_PATH_LEN];
+    char link[SYSFS_ATTR_PATH_LEN];
+    char *s;
+
+    if(snprintf(path, sizeof(path), "%s/sys/dev/block/%u:%u", sysfs_root, major(dev_no), minor(dev_no)) >= (int) sizeof(path))
+    {
+        return -1;
+    }
+    ret = readlink(path, link, sizeof(link) - 1);
+    if(ret < 0)
+    {
+        return -1;
+    }
+    link[ret] = '\0';
+    s = strrchr(link, '/');
+    snprintf(name, len, "%s", s ? s + 1 : link);
+    return 0;
+}
+
+/*
+ * PD_Get_Boot_Disk_At_Startup() with the boot disk identity of the last boot.
+ * The cached dev_t is confirmed with one lookup; on a mismatch the disks are
+ * scanned in parallel for the cached wwid/serial, and only a disk never seen
+ * before goes through the HAL. The name is returned as the HAL does ("/dev/sda").
+ */
+int boot_get_disk_at_startup(int disk_id, char *disk_name, unsigned int buf_len)
+{
+    int i, n;
+    char name[BOOT_DISK_NAME_LEN];
+    struct boot_disk_cache caches[BOOT_DISK_CACHE_NUM];
+    struct boot_disk *cached = NULL;
+    struct boot_disk disk;
+    struct boot_disk *disks;
+
+    n = load_cache(caches, BOOT_DISK_CACHE_NUM);
+    for(i = 0 ; i < n ; i++)
+    {
+        if(caches[i].disk_id == disk_id)
+        {
+            cached = &caches[i].disk;
+            break;
+        }
+    }
+
+    if(cached)
+    {
+        if(name_by_dev_no(cached->dev_no, name, sizeof(name)) == 0 &&
+           boot_read_disk(name, &disk) == 0 && same_disk(cached, &disk))
+        {
+            if(strcmp(name, cached->name))
+            {
+                save_cache(disk_id, &disk);
+            }
+            snprintf(disk_name, buf_len, "/dev/%s", name);
+            return 0;
+        }
+        if((disks = malloc(BOOT_ENUM_MAX_DISK * sizeof(struct boot_disk))) != NULL)
+        {
+            n = boot_enumerate_disks(disks, BOOT_ENUM_MAX_DISK);
+            for(i = 0 ; i < n ; i++)
+            {
+                if(same_disk(cached, &disks[i]))
+                {
+                    save_cache(disk_id, &disks[i]);
+                    snprintf(disk_name, buf_len, "/dev/%s", disks[i].name);
+                    free(disks);
+                    return 0;
+                }
+            }
+            free(disks);
+        }
+    }
+
+    if(PD_Get_Boot_Disk_At_Startup(disk_id, name, sizeof(name)) < 0)
+    {
+        return -1;
+    }
+    if(boot_read_disk(strncmp(name, "/dev/", 5) ? name : name + 5, &disk) == 0)
+    {
+        save_cache(disk_id, &disk);
+    }
+    snprintf(disk_name, buf_len, "%s%s", strncmp(name, "/dev/", 5) ? "/dev/" : "", name);
+    return 0;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i, num;
+    char name[BOOT_DISK_NAME_LEN + 5];
+    struct boot_disk *disks = malloc(BOOT_ENUM_MAX_DISK * sizeof(struct boot_disk));
+
+    /* boot_enum [sysfs root] [cache file] */
+    if(disks == NULL)
+    {
+        return 1;
+    }
+    if(argc > 1)
+    {
+        boot_enum_set_root(argv[1], argc > 2 ? argv[2] : NULL);
+    }
+    num = boot_enumerate_disks(disks, BOOT_ENUM_MAX_DISK);
+    for(i = 0 ; i < num ; i++)
+    {
+        printf("(name, dev, wwid, serial) = (%s, %u:%u, %s, %s)\n", disks[i].name,
+               major(disks[i].dev_no), minor(disks[i].dev_no), disks[i].wwid, disks[i].serial);
+    }
+    if(boot_get_disk_at_startup(0, name, sizeof(name)) == 0)
+    {
+        printf("boot disk 0: %s\n", name);
+    }
+    free(disks);
+    return 0;
+}
+#endif
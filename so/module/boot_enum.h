@@ -0,0 +1,29 @@
+#ifndef _BOOT_ENUM_H
+#define _BOOT_ENUM_H
+
+#include <sys/types.h>
+
+#define BOOT_ENUM_THREADS       8
+#define BOOT_ENUM_MAX_DISK      256
+#define BOOT_DISK_CACHE         "/etc/boot_disk.cache"
+#define BOOT_DISK_NAME_LEN      32
+#define BOOT_DISK_ID_LEN        128
+
+/*
+ * Identity of a block disk, the boot disk is remembered by wwid/serial and
+ * confirmed at the next boot through its dev_t.
+ */
+struct boot_disk {
+    char name[BOOT_DISK_NAME_LEN];      /*!< "sda", "nvme0n1" */
+    dev_t dev_no;
+    char wwid[BOOT_DISK_ID_LEN];
+    char serial[BOOT_DISK_ID_LEN];
+};
+
+void boot_enum_set_root(const char *sysfs_root, const char *cache_file);
+int boot_read_disk(const char *name, struct boot_disk *disk);
+int boot_enumerate_disks(struct boot_disk disks[], int max);
+int boot_enumerate(dev_t dev_no_ary[], unsigned int dev_no_ary_count);
+int boot_get_disk_at_startup(int disk_id, char *disk_name, unsigned int buf_len);
+
+#endif
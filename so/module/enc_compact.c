@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hal.h"
+#include "enc_compact.h"
+
+/*
+ * Compact store of ENCLOSURE_INFO for polling loops over many enclosures.
+ * hots[] and colds[] are parallel and packed, a loop over the status of every
+ * enclosure reads hots[] only. Identity strings are interned once in a string
+ * pool, and the full legacy struct is only built by enc_compact_materialize().
+ */
+
+static struct enc_hot hots[MAX_SE_NUM];
+static struct enc_cold colds[MAX_SE_NUM];
+static int enc_num = 0;
+
+static char pool[ENC_STR_POOL_SIZE];       /* offset 0 is the empty string */
+static uint32_t pool_len = 1;
+static uint32_t pool_hash[ENC_STR_HASH_SIZE];
+static int pool_hash_num = 0;
+
+static pthread_rwlock_t enc_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while(*s)
+    {
+        h = (h ^ (unsigned char) *s++) * 16777619;
+    }
+    return h;
+}
+
+/*
+ * @return pool offset of s, -1 when the pool is full.
+ * enc_lock held for writing.
+ */
+static int str_intern(const char *s)
+{
+    int len;
+    uint32_t i = str_hash(s);
+
+    if(*s == '\0')
+    {
+        return 0;
+    }
+    for( ; ; i++)
+    {
+        uint32_t off = pool_hash[i & (ENC_STR_HASH_SIZE - 1)];
+        if(off == 0)
+            break;
+        if(!strcmp(pool + off, s))
+            return off;
+    }
+    len = strlen(s) + 1;
+    if(pool_len + len > ENC_STR_POOL_SIZE || pool_hash_num >= ENC_STR_HASH_SIZE * 3 / 4)
+    {
+        return -1;
+    }
+    memcpy(pool + pool_len, s, len);
+    pool_hash[i & (ENC_STR_HASH_SIZE - 1)] = pool_len;
+    pool_hash_num++;
+    pool_len += len;
+    return pool_len - len;
+}
+
+/*
+ * Strings of removed or changed enclosures stay in the pool until it fills
+ * up, then the pool is rebuilt from the strings still referenced.
+ * enc_lock held for writing.
+ */
+static void str_compact()
+{
+    int i, j;
+    static char old[ENC_STR_POOL_SIZE];
+
+    memcpy(old, pool, pool_len);
+    memset(pool_hash, 0, sizeof(pool_hash));
+    pool_hash_num = 0;
+    pool_len = 1;
+    for(i = 0 ; i < enc_num ; i++)
+    {
+        for(j = 0 ; j < ENC_STR_NUM ; j++)
+        {
+            colds[i].str[j] = str_intern(old + colds[i].str[j]);
+        }
+    }
+}
+
+static void get_strs(const ENCLOSURE_INFO *info, const char *strs[])
+{
+    strs[ENC_STR_PARENT_SYS_ID] = info->enc_parent_sys_id;
+    strs[ENC_STR_SYS_ID] = info->enc_sys_id;
+    strs[ENC_STR_REAL_SYS_ID] = info->real_sys_id;
+    strs[ENC_STR_BSG_NAME] = info->bsg_name;
+    strs[ENC_STR_WWN] = info->wwn;
+    strs[ENC_STR_VENDOR] = info->vendor;
+    strs[ENC_STR_MODEL] = info->model;
+    strs[ENC_STR_SERIAL_NO] = info->serial_no;
+    strs[ENC_STR_REVISION] = info->revision;
+}
+
+static int find_enc(int enc_id)
+{
+    int i;
+    for(i = 0 ; i < enc_num ; i++)
+    {
+        if(hots[i].enc_id == enc_id)
+            return i;
+    }
+    return -1;
+}
+
+static int is_zero_exp(const EXP_EXT_INFO *exp)
+{
+    static const EXP_EXT_INFO zero_exp;
+    return !memcmp(exp, &zero_exp, sizeof(zero_exp));
+}
+
+/*
+ * Store (or replace) one enclosure, typically right after SE_Get_Info().
+ * @retval 1 The hot fields or the identity strings changed, or the enclosure is new.
+ * @retval 0 Nothing a status poll looks at changed.
+ * @retval -1 No free slot, or the strings do not fit in the pool.
+ */
+int enc_compact_store(const ENCLOSURE_INFO *info)
+{
+    int i, j;
+    int changed = 0;
+    int added = 0;
+    int compacted = 0;
+    int off[ENC_STR_NUM];
+    const char *strs[ENC_STR_NUM];
+    struct enc_hot hot;
+    struct enc_cold *cold;
+
+    memset(&hot, 0, sizeof(hot));
+    hot.enc_id = info->enc_id;
+    hot.status = info->status;
+    hot.capabilities = info->capabilities;
+    hot.tr_bus_speed = info->tr_bus_speed;
+    hot.link_speed = info->link_speed;
+    hot.enc_type = info->enc_type;
+    hot.protocol = info->protocol;
+    hot.max_disk_num = info->max_disk_num;
+    get_strs(info, strs);
+
+    pthread_rwlock_wrlock(&enc_lock);
+    if((i = find_enc(info->enc_id)) < 0)
+    {
+        if(enc_num == MAX_SE_NUM)
+        {
+            pthread_rwlock_unlock(&enc_lock);
+            return -1;
+        }
+        i = enc_num++;
+        added = 1;
+        memset(&colds[i], 0, sizeof(colds[i]));
+        hots[i].enc_id = -1;
+    }
+    for(j = 0 ; j < ENC_STR_NUM ; j++)
+    {
+        if((off[j] = str_intern(strs[j])) < 0)
+        {
+            if(compacted)
+            {
+                if(added)
+                    enc_num--;
+                pthread_rwlock_unlock(&enc_lock);
+                return -1;
+            }
+            str_compact();
+            compacted = 1;
+            j = -1;
+        }
+    }
+
+    cold = &colds[i];
+    if(memcmp(&hots[i], &hot, sizeof(hot)))
+        changed = 1;
+    for(j = 0 ; j < ENC_STR_NUM ; j++)
+    {
+        if(cold->str[j] != (uint32_t) off[j])
+            changed = 1;
+        cold->str[j] = off[j];
+    }
+    hots[i] = hot;
+
+    cold->enc_stack_id = info->enc_stack_id;
+    cold->enc_parent_port_id = info->enc_parent_port_id;
+    memcpy(cold->conn_status, info->conn_status, sizeof(cold->conn_status));
+    cold->capabilities_ext = info->capabilities_ext;
+    cold->tr_capabilities = info->tr_capabilities;
+    cold->tr_supported_raid_mode = info->tr_supported_raid_mode;
+    cold->max_sys_fan_region = info->max_sys_fan_region;
+    cold->max_sys_temp_region = info->max_sys_temp_region;
+    cold->max_fan_num = info->max_fan_num;
+    cold->max_cpu_fan_num = info->max_cpu_fan_num;
+    cold->default_cpu_fan_count = info->default_cpu_fan_count;
+    cold->factory_cpu_fan_count = info->factory_cpu_fan_count;
+    cold->max_sys_extra_region_count = info->max_sys_extra_region_count;
+    memcpy(cold->max_sys_extra_region_fan_num, info->max_sys_extra_region_fan_num, sizeof(cold->max_sys_extra_region_fan_num));
+    cold->max_temp_num = info->max_temp_num;
+    cold->max_pcie_slot = info->max_pcie_slot;
+    cold->max_mb_nic_count = info->max_mb_nic_count;
+    cold->max_conn_count = info->max_conn_count;
+    cold->max_ujbod_num = info->max_ujbod_num;
+    cold->max_cpu_num = info->max_cpu_num;
+    cold->cache_port_bitmap = info->cache_port_bitmap;
+    cold->ss_max_channels = info->ss_max_channels;
+    cold->ss_free_channels = info->ss_free_channels;
+
+    /* only expander enclosures fill exp_ext_info, it is most of the struct */
+    if(is_zero_exp(&info->exp_ext_info))
+    {
+        free(cold->exp_ext_info);
+        cold->exp_ext_info = NULL;
+    }
+    else
+    {
+        if(cold->exp_ext_info == NULL)
+            cold->exp_ext_info = (EXP_EXT_INFO*) malloc(sizeof(EXP_EXT_INFO));
+        if(cold->exp_ext_info)
+            memcpy(cold->exp_ext_info, &info->exp_ext_info, sizeof(EXP_EXT_INFO));
+    }
+    pthread_rwlock_unlock(&enc_lock);
+    return changed;
+}
+
+int enc_compact_remove(int enc_id)
+{
+    int i;
+
+    pthread_rwlock_wrlock(&enc_lock);
+    if((i = find_enc(enc_id)) < 0)
+    {
+        pthread_rwlock_unlock(&enc_lock);
+        return -1;
+    }
+    free(colds[i].exp_ext_info);
+    enc_num--;
+    hots[i] = hots[enc_num];
+    colds[i] = colds[enc_num];
+    pthread_rwlock_unlock(&enc_lock);
+    return 0;
+}
+
+/*
+ * Copy the hot fields of every stored enclosure.
+ * @return number of enclosures, may be larger than max.
+ */
+int enc_compact_get_hot(struct enc_hot hot[], int max)
+{
+    int num;
+
+    pthread_rwlock_rdlock(&enc_lock);
+    num = enc_num;
+    memcpy(hot, hots, sizeof(hot[0]) * (num < max ? num : max));
+    pthread_rwlock_unlock(&enc_lock);
+    return num;
+}
+
+int enc_compact_get_status(int enc_id, int *statusP)
+{
+    int i;
+
+    pthread_rwlock_rdlock(&enc_lock);
+    if((i = find_enc(enc_id)) >= 0)
+    {
+        *statusP = hots[i].status;
+    }
+    pthread_rwlock_unlock(&enc_lock);
+    return i < 0 ? -1 : 0;
+}
+
+int enc_compact_get_str(int enc_id, ENC_STR str, char *buf, unsigned int buf_len)
+{
+    int i;
+
+    if(str < 0 || str >= ENC_STR_NUM)
+    {
+        return -1;
+    }
+    pthread_rwlock_rdlock(&enc_lock);
+    if((i = find_enc(enc_id)) >= 0)
+    {
+        snprintf(buf, buf_len, "%s", pool + colds[i].str[str]);
+    }
+    pthread_rwlock_unlock(&enc_lock);
+    return i < 0 ? -1 : 0;
+}
+
+/*
+ * Build the legacy ENCLOSURE_INFO for callers that need all of it.
+ */
+int enc_compact_materialize(int enc_id, ENCLOSURE_INFO *info)
+{
+    int i;
+    struct enc_cold *cold;
+
+    pthread_rwlock_rdlock(&enc_lock);
+    if((i = find_enc(enc_id)) < 0)
+    {
+        pthread_rwlock_unlock(&enc_lock);
+        return -1;
+    }
+    cold = &colds[i];
+    memset(info, 0, sizeof(*info));
+    info->enc_id = hots[i].enc_id;
+    info->status = hots[i].status;
+    info->capabilities = hots[i].capabilities;
+    info->tr_bus_speed = hots[i].tr_bus_speed;
+    info->link_speed = hots[i].link_speed;
+    info->enc_type = hots[i].enc_type;
+    info->protocol = hots[i].protocol;
+    info->max_disk_num = hots[i].max_disk_num;
+
+    snprintf(info->enc_parent_sys_id, sizeof(info->enc_parent_sys_id), "%s", pool + cold->str[ENC_STR_PARENT_SYS_ID]);
+    snprintf(info->enc_sys_id, sizeof(info->enc_sys_id), "%s", pool + cold->str[ENC_STR_SYS_ID]);
+    snprintf(info->real_sys_id, sizeof(info->real_sys_id), "%s", pool + cold->str[ENC_STR_REAL_SYS_ID]);
+    snprintf(info->bsg_name, sizeof(info->bsg_name), "%s", pool + cold->str[ENC_STR_BSG_NAME]);
+    snprintf(info->wwn, sizeof(info->wwn), "%s", pool + cold->str[ENC_STR_WWN]);
+    snprintf(info->vendor, sizeof(info->vendor), "%s", pool + cold->str[ENC_STR_VENDOR]);
+    snprintf(info->model, sizeof(info->model), "%s", pool + cold->str[ENC_STR_MODEL]);
+    snprintf(info->serial_no, sizeof(info->serial_no), "%s", pool + cold->str[ENC_STR_SERIAL_NO]);
+    snprintf(info->revision, sizeof(info->revision), "%s", pool + cold->str[ENC_STR_REVISION]);
+
+    info->enc_stack_id = cold->enc_stack_id;
+    info->enc_parent_port_id = cold->enc_parent_port_id;
+    memcpy(info->conn_status, cold->conn_status, sizeof(info->conn_status));
+    info->capabilities_ext = cold->capabilities_ext;
+    info->tr_capabilities = cold->tr_capabilities;
+    info->tr_supported_raid_mode = cold->tr_supported_raid_mode;
+    info->max_sys_fan_region = cold->max_sys_fan_region;
+    info->max_sys_temp_region = cold->max_sys_temp_region;
+    info->max_fan_num = cold->max_fan_num;
+    info->max_cpu_fan_num = cold->max_cpu_fan_num;
+    info->default_cpu_fan_count = cold->default_cpu_fan_count;
+    info->factory_cpu_fan_count = cold->factory_cpu_fan_count;
+    info->max_sys_extra_region_count = cold->max_sys_extra_region_count;
+    memcpy(info->max_sys_extra_region_fan_num, cold->max_sys_extra_region_fan_num, sizeof(info->max_sys_extra_region_fan_num));
+    info->max_temp_num = cold->max_temp_num;
+    info->max_pcie_slot = cold->max_pcie_slot;
+    info->max_mb_nic_count = cold->max_mb_nic_count;
+    info->max_conn_count = cold->max_conn_count;
+    info->max_ujbod_num = cold->max_ujbod_num;
+    info->max_cpu_num = cold->max_cpu_num;
+    info->cache_port_bitmap = cold->cache_port_bitmap;
+    info->ss_max_channels = cold->ss_max_channels;
+    info->ss_free_channels = cold->ss_free_channels;
+    if(cold->exp_ext_info)
+    {
+        memcpy(&info->exp_ext_info, cold->exp_ext_info, sizeof(info->exp_ext_info));
+    }
+    pthread_rwlock_unlock(&enc_lock);
+    return 0;
+}
+
+/* bytes held by the store, to compare with enc_num * sizeof(ENCLOSURE_INFO) */
+unsigned int enc_compact_footprint()
+{
+    int i;
+    unsigned int size;
+
+    pthread_rwlock_rdlock(&enc_lock);
+    size = sizeof(hots[0]) * enc_num + sizeof(colds[0]) * enc_num + pool_len;
+    for(i = 0 ; i < enc_num ; i++)
+    {
+        if(colds[i].exp_ext_info)
+            size += sizeof(EXP_EXT_INFO);
+    }
+    pthread_rwlock_unlock(&enc_lock);
+    return size;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i, num;
+    int id_ary[MAX_SE_NUM];
+    struct enc_hot hot[MAX_SE_NUM];
+    static ENCLOSURE_INFO info, back;
+
+    num = SE_Enumerate(id_ary, MAX_SE_NUM, NULL, NULL);
+    for(i = 0 ; i < num && i < MAX_SE_NUM ; i++)
+    {
+        memset(&info, 0, sizeof(info));
+        if(SE_Get_Info(id_ary[i], &info) < 0)
+            continue;
+        printf("(enc_id, changed) = (%d, %d)\n", info.enc_id, enc_compact_store(&info));
+        enc_compact_materialize(info.enc_id, &back);
+        printf("(enc_id, round trip) = (%d, %s)\n", info.enc_id, memcmp(&info, &back, sizeof(info)) ? "differ" : "same");
+    }
+    num = enc_compact_get_hot(hot, MAX_SE_NUM);
+    for(i = 0 ; i < num ; i++)
+    {
+        printf("(enc_id, status, tr_bus_speed) = (%d, %d, %d)\n", hot[i].enc_id, hot[i].status, hot[i].tr_bus_speed);
+    }
+    printf("footprint: %u bytes, legacy: %zu bytes\n", enc_compact_footprint(), num * sizeof(ENCLOSURE_INFO));
+    return 0;
+}
+#endif
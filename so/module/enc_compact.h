@@ -0,0 +1,77 @@
+#ifndef _ENC_COMPACT_H
+#define _ENC_COMPACT_H
+
+#include <stdint.h>
+
+#define ENC_STR_POOL_SIZE       16384
+#define ENC_STR_HASH_SIZE       1024    /* power of 2 */
+
+typedef enum _ENC_STR
+{
+    ENC_STR_PARENT_SYS_ID = 0,
+    ENC_STR_SYS_ID,
+    ENC_STR_REAL_SYS_ID,
+    ENC_STR_BSG_NAME,
+    ENC_STR_WWN,
+    ENC_STR_VENDOR,
+    ENC_STR_MODEL,
+    ENC_STR_SERIAL_NO,
+    ENC_STR_REVISION,
+    ENC_STR_NUM,
+} ENC_STR;
+
+/*
+ * Fields read by polling loops, kept in one dense array.
+ */
+struct enc_hot {
+    int enc_id;                         /*!< -1 for a free slot */
+    int status;
+    int capabilities;
+    int tr_bus_speed;
+    SAS_LINK_SPEED link_speed;
+    ENC_TYPE enc_type;
+    ENCLOSURE_PROTOCOL protocol;
+    unsigned int max_disk_num;
+};
+
+/*
+ * Everything else of ENCLOSURE_INFO. Strings are offsets into the interned
+ * string pool, exp_ext_info is only allocated when it is not all zero.
+ */
+struct enc_cold {
+    uint32_t str[ENC_STR_NUM];
+    int enc_stack_id;
+    int enc_parent_port_id;
+    int conn_status[MAX_EXT_CONNECTOR_NUM];
+    int capabilities_ext;
+    int tr_capabilities;
+    int tr_supported_raid_mode;
+    unsigned int max_sys_fan_region;
+    unsigned int max_sys_temp_region;
+    unsigned int max_fan_num;
+    unsigned int max_cpu_fan_num;
+    unsigned int default_cpu_fan_count;
+    unsigned int factory_cpu_fan_count;
+    unsigned int max_sys_extra_region_count;
+    unsigned int max_sys_extra_region_fan_num[MAX_EXTRA_FAN_REGION_COUNT];
+    unsigned int max_temp_num;
+    unsigned int max_pcie_slot;
+    unsigned int max_mb_nic_count;
+    unsigned int max_conn_count;
+    unsigned int max_ujbod_num;
+    unsigned int max_cpu_num;
+    int cache_port_bitmap;
+    int ss_max_channels;
+    int ss_free_channels;
+    EXP_EXT_INFO *exp_ext_info;
+};
+
+int enc_compact_store(const ENCLOSURE_INFO *enc_infoP);
+int enc_compact_remove(int enc_id);
+int enc_compact_get_hot(struct enc_hot hot[], int max);
+int enc_compact_get_status(int enc_id, int *statusP);
+int enc_compact_get_str(int enc_id, ENC_STR str, char *buf, unsigned int buf_len);
+int enc_compact_materialize(int enc_id, ENCLOSURE_INFO *enc_infoP);
+unsigned int enc_compact_footprint();
+
+#endif
@@ -0,0 +1,483 @@
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "hal.h"
+#include "hal_snapshot.h"
+#include "ses_status.h"
+#include "../../sata/temp_sampler.h"
+
+/*
+ * One producer publishes ENCLOSURE_INFO / PD_INFO / temperatures into a
+ * shared memory segment, HAL clients read them from there instead of
+ * querying the hardware themselves. The temperatures of an SES enclosure
+ * come from one Enclosure Status page (ses_status.c), not one HAL call each,
+ * and the disk temperatures from the sampler (temp_sampler.c), which reads
+ * every disk on its own interval and leaves sleeping disks alone.
+ */
+
+static struct hal_snapshot *snap = NULL;
+static int snap_fd = -1;                /* producer side, holds the owner lock */
+
+static time_t snap_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void snap_write_begin(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void snap_write_end(uint32_t *seq)
+{
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t snap_read_begin(uint32_t *seq)
+{
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+static int snap_read_retry(uint32_t *seq, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return (start & 1) || __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static int snap_is_fresh(time_t stamp)
+{
+    return stamp != 0 && snap_now() - stamp <= HAL_SNAPSHOT_FRESH_SEC;
+}
+
+/*
+ * Readers map the segment read only, once per process.
+ */
+static struct hal_snapshot *snap_attach()
+{
+    int fd;
+    struct hal_snapshot *p;
+
+    if(snap)
+    {
+        return snap;
+    }
+    fd = shm_open(HAL_SNAPSHOT_SHM, O_RDONLY, 0);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    p = mmap(NULL, sizeof(struct hal_snapshot), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if(p->magic != HAL_SNAPSHOT_MAGIC || p->version != HAL_SNAPSHOT_VERSION ||
+       p->size != sizeof(struct hal_snapshot))
+    {
+        munmap(p, sizeof(struct hal_snapshot));
+        return NULL;
+    }
+    snap = p;
+    return snap;
+}
+
+static int snap_find_enc(struct hal_snapshot *p, int enc_id)
+{
+    int i;
+    for(i = 0 ; i < MAX_SE_NUM ; i++)
+    {
+        if(__atomic_load_n(&p->enc[i].enc_id, __ATOMIC_RELAXED) == enc_id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * A pd/temp record belongs to the enclosure record of its slot if it was
+ * written for the same enc_id, by the refresh that wrote the enclosure
+ * record or a later one still in progress.
+ */
+static int snap_rec_match(struct hal_snapshot *p, int slot, int enc_id, int rec_enc_id, uint32_t rec_gen)
+{
+    uint32_t gen = __atomic_load_n(&p->enc[slot].generation, __ATOMIC_ACQUIRE);
+    return rec_enc_id == enc_id && (int32_t) (rec_gen - gen) >= 0;
+}
+
+int hal_snapshot_se_get_info(int enc_id, ENCLOSURE_INFO *enc_infoP)
+{
+    int i, slot, ret;
+    uint32_t seq;
+    time_t stamp;
+    struct hal_snapshot *p = snap_attach();
+
+    if(p == NULL || (slot = snap_find_enc(p, enc_id)) < 0)
+    {
+        return SE_Get_Info(enc_id, enc_infoP);
+    }
+    for(i = 0 ; i < HAL_SNAPSHOT_READ_RETRY ; i++)
+    {
+        seq = snap_read_begin(&p->enc[slot].seq);
+        ret = p->enc[slot].ret;
+        stamp = p->enc[slot].stamp;
+        memcpy(enc_infoP, &p->enc[slot].info, sizeof(ENCLOSURE_INFO));
+        if(!snap_read_retry(&p->enc[slot].seq, seq))
+        {
+            if(p->enc[slot].enc_id == enc_id && snap_is_fresh(stamp))
+            {
+                return ret;
+            }
+            break;
+        }
+    }
+    return SE_Get_Info(enc_id, enc_infoP);
+}
+
+int hal_snapshot_pd_get_info(int enc_id, int port_id, PD_INFO *pd_infoP)
+{
+    int i, slot, ret, rec_enc_id, rec_port_id;
+    uint32_t seq, gen;
+    time_t stamp;
+    struct snap_pd_rec *rec;
+    struct hal_snapshot *p = snap_attach();
+
+    if(p == NULL || port_id < 1 || port_id > MAX_PD_NUM || (slot = snap_find_enc(p, enc_id)) < 0)
+    {
+        return PD_Get_Info(enc_id, port_id, pd_infoP);
+    }
+    rec = &p->pd[slot][port_id - 1];
+    for(i = 0 ; i < HAL_SNAPSHOT_READ_RETRY ; i++)
+    {
+        seq = snap_read_begin(&rec->seq);
+        rec_enc_id = rec->enc_id;
+        rec_port_id = rec->port_id;
+        gen = rec->generation;
+        ret = rec->ret;
+        stamp = rec->stamp;
+        memcpy(pd_infoP, &rec->info, sizeof(PD_INFO));
+        if(!snap_read_retry(&rec->seq, seq))
+        {
+            if(rec_port_id == port_id && snap_rec_match(p, slot, enc_id, rec_enc_id, gen) && snap_is_fresh(stamp))
+            {
+                return ret;
+            }
+            break;
+        }
+    }
+    return PD_Get_Info(enc_id, port_id, pd_infoP);
+}
+
+/* PD_Get_Temperature() answered from the sampled value of the snapshot */
+int hal_snapshot_pd_get_temperature(int enc_id, int port_id, int *tempP)
+{
+    int i, slot, temp, temp_ret, rec_enc_id, rec_port_id;
+    uint32_t seq, gen;
+    time_t stamp;
+    struct snap_pd_rec *rec;
+    struct hal_snapshot *p = snap_attach();
+
+    if(p == NULL || port_id < 1 || port_id > MAX_PD_NUM || (slot = snap_find_enc(p, enc_id)) < 0)
+    {
+        return PD_Get_Temperature(enc_id, port_id, 0, tempP);
+    }
+    rec = &p->pd[slot][port_id - 1];
+    for(i = 0 ; i < HAL_SNAPSHOT_READ_RETRY ; i++)
+    {
+        seq = snap_read_begin(&rec->seq);
+        rec_enc_id = rec->enc_id;
+        rec_port_id = rec->port_id;
+        gen = rec->generation;
+        temp_ret = rec->temp_ret;
+        temp = rec->temp;
+        stamp = rec->stamp;
+        if(!snap_read_retry(&rec->seq, seq))
+        {
+            if(temp_ret == 0 && rec_port_id == port_id && snap_rec_match(p, slot, enc_id, rec_enc_id, gen) &&
+               snap_is_fresh(stamp))
+            {
+                *tempP = temp;
+                return 0;
+            }
+            break;
+        }
+    }
+    return PD_Get_Temperature(enc_id, port_id, 0, tempP);
+}
+
+int hal_snapshot_hm_get_temperature(int enc_id, TEMP_INDEX temp_index, double *dValueP)
+{
+    int i, slot, ret, rec_enc_id;
+    uint32_t seq, gen;
+    time_t stamp;
+    double value;
+    struct snap_temp_rec *rec;
+    struct hal_snapshot *p = snap_attach();
+
+    if(p == NULL || temp_index < 0 || temp_index >= TEMP_LAST || (slot = snap_find_enc(p, enc_id)) < 0)
+    {
+        return ses_status_hm_get_temperature(enc_id, temp_index, dValueP);
+    }
+    rec = &p->temp[slot];
+    for(i = 0 ; i < HAL_SNAPSHOT_READ_RETRY ; i++)
+    {
+        seq = snap_read_begin(&rec->seq);
+        rec_enc_id = rec->enc_id;
+        gen = rec->generation;
+        ret = rec->ret[temp_index];
+        value = rec->value[temp_index];
+        stamp = rec->stamp;
+        if(!snap_read_retry(&rec->seq, seq))
+        {
+            if(snap_rec_match(p, slot, enc_id, rec_enc_id, gen) && snap_is_fresh(stamp))
+            {
+                *dValueP = value;
+                return ret;
+            }
+            break;
+        }
+    }
+    return ses_status_hm_get_temperature(enc_id, temp_index, dValueP);
+}
+
+/*
+ * One producer per segment: the owner holds an exclusive lock on the shm
+ * object for its lifetime, a second producer is refused instead of
+ * interleaving its records with the first one's.
+ */
+static struct hal_snapshot *snap_create()
+{
+    int fd;
+    pid_t owner;
+    struct hal_snapshot *p;
+
+    fd = shm_open(HAL_SNAPSHOT_SHM, O_CREAT | O_RDWR, 0644);
+    if(fd < 0)
+    {
+        perror("shm_open");
+        return NULL;
+    }
+    if(flock(fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        owner = 0;
+        if(pread(fd, &owner, sizeof(owner), offsetof(struct hal_snapshot, producer)) != sizeof(owner))
+        {
+            owner = 0;
+        }
+        fprintf(stderr, "%s is owned by producer pid %d\n", HAL_SNAPSHOT_SHM, (int) owner);
+        close(fd);
+        return NULL;
+    }
+    if(ftruncate(fd, sizeof(struct hal_snapshot)) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    p = mmap(NULL, sizeof(struct hal_snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fd);
+        return NULL;
+    }
+    snap_fd = fd;
+    /* readers reject the segment until the header is complete */
+    p->magic = 0;
+    p->version = HAL_SNAPSHOT_VERSION;
+    p->size = sizeof(struct hal_snapshot);
+    p->producer = getpid();
+    __atomic_store_n(&p->magic, HAL_SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+    return p;
+}
+
+/*
+ * The hardware I/O is done into these buffers, the records are only held
+ * odd for the copy.
+ */
+static ENCLOSURE_INFO enc_buf;
+static PD_INFO pd_buf;
+static struct snap_temp_rec temp_buf;
+
+/* the sampler's value of the disk, it starts sampling a disk seen for the first time */
+static int snap_pd_temp(PD_INFO *pd_info, int *tempP)
+{
+    char dev[MAX_SYS_ID_LEN + 8];
+
+    if(pd_info->pd_sys_id[0] == '\0')
+    {
+        return -1;
+    }
+    snprintf(dev, sizeof(dev), pd_info->pd_sys_id[0] == '/' ? "%s" : "/dev/%s", pd_info->pd_sys_id);
+    if(temp_sampler_watch(dev) != 0)
+    {
+        return -1;
+    }
+    return temp_sampler_get(dev, tempP, NULL);
+}
+
+static void snap_publish_enc(struct hal_snapshot *p, int slot, int enc_id, uint32_t gen)
+{
+    int ret;
+    int enc_ret;
+    int port_id;
+    int temp_index;
+    int temp, temp_ret;
+    int max_disk_num;
+    struct snap_pd_rec *rec;
+
+    memset(&enc_buf, 0, sizeof(enc_buf));
+    enc_ret = SE_Get_Info(enc_id, &enc_buf);
+
+    max_disk_num = (enc_ret == 0 && enc_buf.max_disk_num < MAX_PD_NUM) ? enc_buf.max_disk_num : MAX_PD_NUM;
+    for(port_id = 1 ; port_id <= max_disk_num ; port_id++)
+    {
+        memset(&pd_buf, 0, sizeof(pd_buf));
+        ret = PD_Get_Info(enc_id, port_id, &pd_buf);
+        temp = 0;
+        temp_ret = ret == 0 ? snap_pd_temp(&pd_buf, &temp) : -1;
+        rec = &p->pd[slot][port_id - 1];
+        snap_write_begin(&rec->seq);
+        rec->enc_id = enc_id;
+        rec->generation = gen;
+        rec->port_id = port_id;
+        rec->ret = ret;
+        rec->temp_ret = temp_ret;
+        rec->temp = temp;
+        rec->stamp = snap_now();
+        memcpy(&rec->info, &pd_buf, sizeof(pd_buf));
+        snap_write_end(&rec->seq);
+    }
+    /* slots above the new max_disk_num, left from a larger enclosure */
+    for(port_id = max_disk_num + 1 ; port_id <= p->enc[slot].pd_num ; port_id++)
+    {
+        rec = &p->pd[slot][port_id - 1];
+        snap_write_begin(&rec->seq);
+        rec->enc_id = -1;
+        rec->port_id = 0;
+        rec->stamp = 0;
+        snap_write_end(&rec->seq);
+    }
+
+    for(temp_index = 0 ; temp_index < TEMP_LAST ; temp_index++)
+    {
+        temp_buf.value[temp_index] = 0;
+        temp_buf.ret[temp_index] = ses_status_hm_get_temperature(enc_id, temp_index, &temp_buf.value[temp_index]);
+    }
+    snap_write_begin(&p->temp[slot].seq);
+    p->temp[slot].enc_id = enc_id;
+    p->temp[slot].generation = gen;
+    p->temp[slot].stamp = snap_now();
+    memcpy(p->temp[slot].ret, temp_buf.ret, sizeof(temp_buf.ret));
+    memcpy(p->temp[slot].value, temp_buf.value, sizeof(temp_buf.value));
+    snap_write_end(&p->temp[slot].seq);
+
+    /* last, so every record of this generation is in place before readers match it */
+    snap_write_begin(&p->enc[slot].seq);
+    p->enc[slot].enc_id = enc_id;
+    p->enc[slot].pd_num = max_disk_num;
+    p->enc[slot].ret = enc_ret;
+    p->enc[slot].stamp = snap_now();
+    memcpy(&p->enc[slot].info, &enc_buf, sizeof(enc_buf));
+    __atomic_store_n(&p->enc[slot].generation, gen, __ATOMIC_RELEASE);
+    snap_write_end(&p->enc[slot].seq);
+}
+
+/*
+ * Producer loop, the only writer of the segment.
+ * @param interval seconds between two refreshes.
+ * @param loops refresh count, 0 to run forever.
+ */
+int hal_snapshot_publish(int interval, int loops)
+{
+    int i, n;
+    int enc_num;
+    int id_ary[MAX_SE_NUM];
+    uint32_t gen;
+    struct hal_snapshot *p = snap_create();
+
+    if(p == NULL)
+    {
+        return -1;
+    }
+    if(temp_sampler_start() != 0)
+    {
+        fprintf(stderr, "temperature sampler not started, disk temperatures are read through the HAL\n");
+    }
+    for(n = 0 ; loops == 0 || n < loops ; n++)
+    {
+        gen = p->generation + 1;
+        enc_num = SE_Enumerate(id_ary, MAX_SE_NUM, NULL, NULL);
+        if(enc_num > MAX_SE_NUM)
+        {
+            enc_num = MAX_SE_NUM;
+        }
+        for(i = 0 ; i < enc_num ; i++)
+        {
+            snap_publish_enc(p, i, id_ary[i], gen);
+        }
+        /* enclosures gone since the last refresh */
+        for(i = (enc_num < 0 ? 0 : enc_num) ; i < p->enc_num ; i++)
+        {
+            snap_write_begin(&p->enc[i].seq);
+            p->enc[i].enc_id = -1;
+            p->enc[i].stamp = 0;
+            snap_write_end(&p->enc[i].seq);
+        }
+        p->enc_num = enc_num < 0 ? 0 : enc_num;
+        __atomic_store_n(&p->generation, gen, __ATOMIC_RELEASE);
+        __atomic_store_n(&p->stamp, snap_now(), __ATOMIC_RELEASE);
+        if(loops == 0 || n + 1 < loops)
+        {
+            sleep(interval);
+        }
+    }
+    return 0;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int ret;
+    int temp_pd = 0;
+    double temp;
+    ENCLOSURE_INFO enc_info;
+    PD_INFO pd_info;
+
+    if(argc > 1 && !strcmp(argv[1], "publish"))
+    {
+        return hal_snapshot_publish(argc > 2 ? atoi(argv[2]) : 1, argc > 3 ? atoi(argv[3]) : 0);
+    }
+    if(argc > 2 && !strcmp(argv[1], "enc"))
+    {
+        ret = hal_snapshot_se_get_info(atoi(argv[2]), &enc_info);
+        printf("(enc_id, ret, vendor, model, max_disk_num) = (%s, %d, %s, %s, %d)\n",
+               argv[2], ret, enc_info.vendor, enc_info.model, enc_info.max_disk_num);
+        ret = hal_snapshot_hm_get_temperature(atoi(argv[2]), TEMP_SYSTEM1, &temp);
+        printf("(temp, ret) = (%f, %d)\n", temp, ret);
+        return 0;
+    }
+    if(argc > 3 && !strcmp(argv[1], "pd"))
+    {
+        ret = hal_snapshot_pd_get_info(atoi(argv[2]), atoi(argv[3]), &pd_info);
+        printf("(enc_id, port_id, ret) = (%s, %s, %d)\n", argv[2], argv[3], ret);
+        ret = hal_snapshot_pd_get_temperature(atoi(argv[2]), atoi(argv[3]), &temp_pd);
+        printf("(enc_id, port_id, ret, temp) = (%s, %s, %d, %d)\n", argv[2], argv[3], ret, temp_pd);
+        return 0;
+    }
+    printf("usage: %s publish <interval> [loops] | enc <enc_id> | pd <enc_id> <port_id>\n", argv[0]);
+    return 1;
+}
+#endif
@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <sys/types.h>
+
+#define HAL_SNAPSHOT_SHM        "/hal_snapshot"
+#define HAL_SNAPSHOT_MAGIC      0x48534e50      /* "HSNP" */
+#define HAL_SNAPSHOT_VERSION    3
+#define HAL_SNAPSHOT_FRESH_SEC  5               /* older records are read from the hardware */
+#define HAL_SNAPSHOT_READ_RETRY 8               /* bounded seqlock retries, then fall back */
+
+/*
+ * Every record is guarded by its own sequence counter:
+ * odd while the producer rewrites it, even once it is consistent.
+ * pd and temperature records carry the enc_id and refresh generation they
+ * were written for, a record older than its enclosure record is stale.
+ */
+struct snap_enc_rec {
+    uint32_t seq;
+    int enc_id;
+    uint32_t generation;                            /*!< refresh that wrote it, after its pd/temp records */
+    int pd_num;                                     /*!< pd records written by that refresh */
+    int ret;
+    time_t stamp;
+    ENCLOSURE_INFO info;
+};
+
+struct snap_pd_rec {
+    uint32_t seq;
+    int enc_id;
+    uint32_t generation;
+    int port_id;
+    int ret;
+    int temp_ret;                                   /*!< 0 when temp holds a sampled value */
+    int temp;                                       /*!< Celsius, from temp_sampler */
+    time_t stamp;
+    PD_INFO info;
+};
+
+struct snap_temp_rec {
+    uint32_t seq;
+    int enc_id;
+    uint32_t generation;
+    time_t stamp;
+    int ret[TEMP_LAST];
+    double value[TEMP_LAST];
+};
+
+struct hal_snapshot {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    pid_t producer;
+    uint32_t generation;                            /*!< refresh count of the producer */
+    time_t stamp;                                   /*!< producer heartbeat, CLOCK_MONOTONIC seconds */
+    int enc_num;
+    struct snap_enc_rec enc[MAX_SE_NUM];
+    struct snap_pd_rec pd[MAX_SE_NUM][MAX_PD_NUM];  /*!< [enclosure slot][port_id - 1] */
+    struct snap_temp_rec temp[MAX_SE_NUM];
+};
+
+int hal_snapshot_publish(int interval, int loops);
+
+int hal_snapshot_se_get_info(int enc_id, ENCLOSURE_INFO *enc_infoP);
+int hal_snapshot_pd_get_info(int enc_id, int port_id, PD_INFO *pd_infoP);
+int hal_snapshot_pd_get_temperature(int enc_id, int port_id, int *tempP);
+int hal_snapshot_hm_get_temperature(int enc_id, TEMP_INDEX temp_index, double *dValueP);
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "nvme_admin.h"
+
+/*
+ * Admin command transport shared by nvme_collect and nvme_identify.
+ * A regular file in place of the device node is a mock controller, admin
+ * commands are served from its NVME_MOCK_* offsets.
+ */
+
+static int mock_admin(int fd, struct nvme_admin_cmd *cmd)
+{
+    off_t off;
+
+    if(cmd->opcode == NVME_ADMIN_IDENTIFY)
+    {
+        off = (cmd->cdw10 & 0xff) == NVME_ID_CNS_CTRL ? 0 : NVME_MOCK_NS_OFF;
+    }
+    else if(cmd->opcode == NVME_ADMIN_GET_LOG_PAGE)
+    {
+        off = NVME_MOCK_LOG_OFF(cmd->cdw10 & 0xff) + (((off_t) cmd->cdw13 << 32) | cmd->cdw12);
+    }
+    else
+    {
+        return 0x01;                    /* invalid command opcode */
+    }
+    memset((void*) (uintptr_t) cmd->addr, 0, cmd->data_len);
+    if(pread(fd, (void*) (uintptr_t) cmd->addr, cmd->data_len, off) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * One admin command.
+ * @return 0 on success, the NVMe status when the controller failed it, -1 when the ioctl failed.
+ */
+int nvme_admin(int fd, struct nvme_admin_cmd *cmd)
+{
+    struct stat st;
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        return mock_admin(fd, cmd);
+    }
+    if(cmd->timeout_ms == 0)
+        cmd->timeout_ms = NVME_ADMIN_TIMEOUT;
+    return ioctl(fd, NVME_IOCTL_ADMIN_CMD, cmd);
+}
+
+int nvme_identify(int fd, unsigned int cns, unsigned int nsid, unsigned char *buf)
+{
+    struct nvme_admin_cmd cmd;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.addr = (uintptr_t) buf;
+    cmd.data_len = NVME_ID_LEN;
+    cmd.cdw10 = cns;
+    return nvme_admin(fd, &cmd) == 0 ? 0 : -1;
+}
+
+/*
+ * GET LOG PAGE of len bytes, chunk bytes per command through the log page
+ * offset, or a single command when chunk is 0.
+ * @return commands sent, -1 on failure.
+ */
+int nvme_get_log(int fd, unsigned char lid, unsigned int nsid, unsigned char *buf, int len, int chunk)
+{
+    int off, n, cmds = 0;
+    unsigned int numd;
+    struct nvme_admin_cmd cmd;
+
+    if(chunk <= 0)
+        chunk = len;
+    for(off = 0 ; off < len ; off += n)
+    {
+        n = len - off < chunk ? len - off : chunk;
+        numd = n / 4 - 1;
+        memset(&cmd, 0, sizeof(cmd));
+        cmd.opcode = NVME_ADMIN_GET_LOG_PAGE;
+        cmd.nsid = nsid;
+        cmd.addr = (uintptr_t) (buf + off);
+        cmd.data_len = n;
+        cmd.cdw10 = ((numd & 0xffff) << 16) | lid;
+        cmd.cdw11 = numd >> 16;
+        cmd.cdw12 = off;
+        cmd.cdw13 = 0;
+        cmds++;
+        if(nvme_admin(fd, &cmd) != 0)
+        {
+            return -1;
+        }
+    }
+    return cmds;
+}
+
+/* "nvme0" is looked up in /dev, a path is used as is */
+int nvme_open(const char *dev)
+{
+    char path[96];
+
+    if(strchr(dev, '/'))
+        snprintf(path, sizeof(path), "%s", dev);
+    else
+        snprintf(path, sizeof(path), "/dev/%s", dev);
+    return open(path, O_RDONLY);
+}
@@ -0,0 +1,24 @@
+#ifndef _NVME_ADMIN_H
+#define _NVME_ADMIN_H
+
+#include <linux/nvme_ioctl.h>
+
+#define NVME_ID_LEN             4096
+#define NVME_ADMIN_TIMEOUT      20000   /* ms */
+
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_GET_LOG_PAGE 0x02
+#define NVME_ID_CNS_NS          0x00
+#define NVME_ID_CNS_CTRL        0x01
+
+/* file-backed mock controller: identify pages then one slot per log id */
+#define NVME_MOCK_NS_OFF        NVME_ID_LEN
+#define NVME_MOCK_LOG_SLOT      65536
+#define NVME_MOCK_LOG_OFF(lid)  (2 * NVME_ID_LEN + (off_t) (lid) * NVME_MOCK_LOG_SLOT)
+
+int nvme_admin(int fd, struct nvme_admin_cmd *cmd);
+int nvme_identify(int fd, unsigned int cns, unsigned int nsid, unsigned char *buf);
+int nvme_get_log(int fd, unsigned char lid, unsigned int nsid, unsigned char *buf, int len, int chunk);
+int nvme_open(const char *dev);
+
+#endif
@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "hal.h"
+#include "nvme_collect.h"
+#include "nvme_identify.h"
+
+/*
+ * NVMe counterpart of the SG collectors in sas/ and sata/.
+ * Every TEMPLATE_NVME_* of a controller is read with NVME_IOCTL_ADMIN_CMD,
+ * the controllers of one nvme_collect() run in their own threads. The error
+ * log can be hundreds of entries, it is read NVME_LOG_CHUNK at a time through
+ * the log page offset when the controller supports it (LPA bit 2).
+ * Admin commands go through nvme_admin.c, which also serves mock
+ * controllers from a regular file.
+ */
+
+#define NVME_LOG_ERROR          0x01
+#define NVME_LOG_SMART          0x02
+#define NVME_LOG_SELF_TEST      0x06
+#define NVME_LPA_EXT_DATA       0x04
+
+static int add_log(struct nvme_ctrl *ctrl, int fd, int temp, unsigned char lid, int len, int chunk)
+{
+    int cmds;
+
+    if((ctrl->data[temp] = malloc(len)) == NULL)
+    {
+        return -1;
+    }
+    if((cmds = nvme_get_log(fd, lid, 0xffffffff, ctrl->data[temp], len, chunk)) < 0)
+    {
+        free(ctrl->data[temp]);
+        ctrl->data[temp] = NULL;
+        return -1;
+    }
+    ctrl->cmds += cmds;
+    ctrl->len[temp] = len;
+    return 0;
+}
+
+/* every template of one controller, an optional log that fails is left out */
+static void *collect_ctrl(void *arg)
+{
+    int fd, chunk;
+    struct nvme_ctrl *ctrl = (struct nvme_ctrl*) arg;
+    PD_NVME_ID_CTRL *id;
+
+    ctrl->ret = -1;
+    if((fd = nvme_open(ctrl->dev)) < 0)
+    {
+        return NULL;
+    }
+    ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL] = malloc(NVME_ID_LEN);
+    ctrl->data[TEMPLATE_NVME_IDENTIFY_NAMESPACE] = malloc(NVME_ID_LEN);
+    if(ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL] == NULL || ctrl->data[TEMPLATE_NVME_IDENTIFY_NAMESPACE] == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    ctrl->cmds++;
+    if(nvme_identify(fd, NVME_ID_CNS_CTRL, 0, ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL]) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    ctrl->len[TEMPLATE_NVME_IDENTIFY_CTRL] = NVME_ID_LEN;
+    id = (PD_NVME_ID_CTRL*) ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL];
+
+    ctrl->cmds++;
+    if(nvme_identify(fd, NVME_ID_CNS_NS, ctrl->nsid ? ctrl->nsid : 1, ctrl->data[TEMPLATE_NVME_IDENTIFY_NAMESPACE]) == 0)
+        ctrl->len[TEMPLATE_NVME_IDENTIFY_NAMESPACE] = NVME_ID_LEN;
+    nvme_id_put(ctrl->dev, ctrl->nsid ? ctrl->nsid : 1, ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL],
+                ctrl->len[TEMPLATE_NVME_IDENTIFY_NAMESPACE] ? ctrl->data[TEMPLATE_NVME_IDENTIFY_NAMESPACE] : NULL);
+
+    add_log(ctrl, fd, TEMPLATE_NVME_SMART_LOG, NVME_LOG_SMART, NVME_SMART_LOG_LEN, 0);
+    /* elpe is 0 based, without the offset the whole log goes in one command */
+    chunk = (id->lpa & NVME_LPA_EXT_DATA) ? NVME_LOG_CHUNK : 0;
+    add_log(ctrl, fd, TEMPLATE_NVME_ERR_LOG, NVME_LOG_ERROR, (id->elpe + 1) * NVME_ERR_ENTRY_LEN, chunk);
+    /* device self-test is optional, oacs bit 4 */
+    if(id->oacs[0] & 0x10)
+        add_log(ctrl, fd, TEMPLATE_NVME_SELF_TEST, NVME_LOG_SELF_TEST, NVME_SELF_TEST_LOG_LEN, 0);
+    close(fd);
+    ctrl->ret = 0;
+    return NULL;
+}
+
+/*
+ * Read the templates of num controllers, one thread each.
+ * ctrls[].dev and nsid are the input, release the data with nvme_ctrl_free().
+ * @return number of controllers that answered identify.
+ */
+int nvme_collect(struct nvme_ctrl *ctrls, int num)
+{
+    int i, answered = 0;
+    pthread_t tids[NVME_MAX_CTRL];
+    int started[NVME_MAX_CTRL];
+
+    if(num > NVME_MAX_CTRL)
+        num = NVME_MAX_CTRL;
+    for(i = 0 ; i < num ; i++)
+    {
+        memset(ctrls[i].data, 0, sizeof(ctrls[i].data));
+        memset(ctrls[i].len, 0, sizeof(ctrls[i].len));
+        ctrls[i].cmds = 0;
+        ctrls[i].ret = -1;
+        started[i] = pthread_create(&tids[i], NULL, collect_ctrl, &ctrls[i]) == 0;
+        if(!started[i])
+            collect_ctrl(&ctrls[i]);
+    }
+    for(i = 0 ; i < num ; i++)
+    {
+        if(started[i])
+            pthread_join(tids[i], NULL);
+        if(ctrls[i].ret == 0)
+            answered++;
+    }
+    return answered;
+}
+
+/*
+ * Disk data package of one controller: the text header padded to
+ * DISK_DATA_PACKAGE_HEADER_SIZE, then the records in template order.
+ * The host identity lines are left empty, as Driver is in the SATA packages.
+ * A record's template is its NVME_DATA_TEMPLATE value (hal.h), as the SATA
+ * package numbers its records by DISK_DATA_TEMPLATE.
+ * @return 0 on success, -1 on failure.
+ */
+int nvme_write_pkg(struct nvme_ctrl *ctrl, const char *path)
+{
+    int fd, t, n = 0, num = 0, idx, ret = 0;
+    char hdr[DISK_DATA_PACKAGE_HEADER_SIZE];
+    time_t now;
+    struct tm tm;
+    struct utsname uts;
+    PD_NVME_ID_CTRL *id = (PD_NVME_ID_CTRL*) ctrl->data[TEMPLATE_NVME_IDENTIFY_CTRL];
+
+    if(ctrl->ret != 0 || id == NULL)
+    {
+        return -1;
+    }
+    for(t = 0 ; t < TEMPLATE_NVME_MAX_ITEMS ; t++)
+    {
+        if(ctrl->len[t] > 0)
+            num++;
+    }
+    now = time(NULL);
+    localtime_r(&now, &tm);
+    if(uname(&uts) != 0)
+        uts.release[0] = '\0';
+
+    memset(hdr, 0, sizeof(hdr));
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Header Size: %d\n", DISK_DATA_PACKAGE_HEADER_SIZE);
+    n += snprintf(hdr + n, sizeof(hdr) - n, QNAP_DRIVE_ANALYZER);
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Version: %s\n", QNAP_DRIVE_ANALYZER_VERSION);
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Copyright @QNAP Technology 2019\n");
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Signature: Drive Health Data\n");
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Date: %04d-%02d-%02d\n", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Time: %02d:%02d:%02d\n", tm.tm_hour, tm.tm_min, tm.tm_sec);
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Model Number: \nSerial Number: \nFirmware Version: \nHost ID: \n");
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Rack Number: \nSlot Number: \n");
+    n += snprintf(hdr + n, sizeof(hdr) - n, "System FW: %s\nOS: GNU/Linux\nDriver: nvme\nHost IP: \n", uts.release);
+    n += snprintf(hdr + n, sizeof(hdr) - n, "Interface: NVMe\nAttribute: Regular\n");
+    n += snprintf(hdr + n, sizeof(hdr) - n, "No. of Records: %d\n", num);
+    for(t = 0, num = 0, idx = DISK_DATA_PACKAGE_HEADER_SIZE ; t < TEMPLATE_NVME_MAX_ITEMS && n < (int) sizeof(hdr) ; t++)
+    {
+        if(ctrl->len[t] == 0)
+            continue;
+        num++;
+        n += snprintf(hdr + n, sizeof(hdr) - n, "Record %d byte index: %d\nRecord %d length: %d\nRecord %d template: %03d\n",
+                      num, idx, num, ctrl->len[t], num, t);
+        idx += ctrl->len[t];
+    }
+    n += snprintf(hdr + n, sizeof(hdr) - n, "END");
+    if(n >= (int) sizeof(hdr))
+    {
+        return -1;
+    }
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        return -1;
+    }
+    if(write(fd, hdr, sizeof(hdr)) != sizeof(hdr))
+        ret = -1;
+    for(t = 0 ; t < TEMPLATE_NVME_MAX_ITEMS && ret == 0 ; t++)
+    {
+        if(ctrl->len[t] > 0 && write(fd, ctrl->data[t], ctrl->len[t]) != ctrl->len[t])
+            ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+void nvme_ctrl_free(struct nvme_ctrl *ctrl)
+{
+    int t;
+
+    for(t = 0 ; t < TEMPLATE_NVME_MAX_ITEMS ; t++)
+    {
+        free(ctrl->data[t]);
+        ctrl->data[t] = NULL;
+        ctrl->len[t] = 0;
+    }
+}
+
+#ifdef UNIT_TEST
+/* a mock controller with err_num error log entries, every entry carries its index as error count */
+static int mock_create(const char *path, int err_num, int ext)
+{
+    int fd, i, ret = 0;
+    unsigned char buf[NVME_ID_LEN];
+    PD_NVME_ID_CTRL *id = (PD_NVME_ID_CTRL*) buf;
+    PD_NVME_ERROR_LOG_PAGE err;
+
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        return -1;
+    }
+    memset(buf, 0, sizeof(buf));
+    memcpy(id->sn, "MOCK0000000000000001", 20);
+    memcpy(id->mn, "Mock NVMe Controller                    ", 40);
+    memcpy(id->fr, "1.0     ", 8);
+    id->elpe = err_num - 1;
+    id->lpa = ext ? NVME_LPA_EXT_DATA : 0;
+    id->oacs[0] = 0x10;
+    id->wctemp[0] = 0x57;               /* 343 K */
+    id->wctemp[1] = 0x01;
+    id->cctemp[0] = 0x66;               /* 358 K */
+    id->cctemp[1] = 0x01;
+    id->nn[0] = 1;
+    id->psd[0].max_power[0] = 0x84;     /* 900 cW */
+    id->psd[0].max_power[1] = 0x03;
+    if(pwrite(fd, buf, sizeof(buf), 0) != sizeof(buf))
+        ret = -1;
+    memset(buf, 0, sizeof(buf));
+    buf[0] = 0x00;                      /* nsze 0x10000000 blocks */
+    buf[3] = 0x10;
+    ((NVME_ID_NS*) buf)->lbaf[0].ds = 12;
+    if(pwrite(fd, buf, sizeof(buf), NVME_MOCK_NS_OFF) != sizeof(buf))
+        ret = -1;
+    memset(buf, 0, sizeof(buf));
+    buf[1] = 0x3b;                      /* 315 K */
+    buf[2] = 0x01;
+    if(pwrite(fd, buf, NVME_SMART_LOG_LEN, NVME_MOCK_LOG_OFF(NVME_LOG_SMART)) != NVME_SMART_LOG_LEN)
+        ret = -1;
+    for(i = 0 ; i < err_num && ret == 0 ; i++)
+    {
+        memset(&err, 0, sizeof(err));
+        err.error_count = i + 1;
+        if(pwrite(fd, &err, sizeof(err), NVME_MOCK_LOG_OFF(NVME_LOG_ERROR) + i * sizeof(err)) != sizeof(err))
+            ret = -1;
+    }
+    memset(buf, 0, sizeof(buf));
+    if(pwrite(fd, buf, NVME_SELF_TEST_LOG_LEN, NVME_MOCK_LOG_OFF(NVME_LOG_SELF_TEST)) != NVME_SELF_TEST_LOG_LEN)
+        ret = -1;
+    close(fd);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, t, num, answered;
+    char path[128];
+    static struct nvme_ctrl ctrls[NVME_MAX_CTRL];
+
+    /* nvme_collect -m mock.img [error entries] [0|1 offset support] creates a mock controller */
+    if(argc >= 3 && strcmp(argv[1], "-m") == 0)
+    {
+        return mock_create(argv[2], argc > 3 ? atoi(argv[3]) : 256, argc > 4 ? atoi(argv[4]) : 1) != 0;
+    }
+    /* nvme_collect nvme0 [mock.img ...] writes a package of every controller */
+    for(num = 0 ; num < argc - 1 && num < NVME_MAX_CTRL ; num++)
+        snprintf(ctrls[num].dev, sizeof(ctrls[num].dev), "%s", argv[num + 1]);
+    answered = nvme_collect(ctrls, num);
+    printf("answered: %d\n", answered);
+    for(i = 0 ; i < num ; i++)
+    {
+        printf("(dev, ret, cmds) = (%s, %d, %d)\n", ctrls[i].dev, ctrls[i].ret, ctrls[i].cmds);
+        for(t = 0 ; t < TEMPLATE_NVME_MAX_ITEMS ; t++)
+        {
+            if(ctrls[i].len[t] > 0)
+                printf("    (template, len) = (%d, %d)\n", t, ctrls[i].len[t]);
+        }
+        if(ctrls[i].len[TEMPLATE_NVME_ERR_LOG] > 0)
+        {
+            PD_NVME_ERROR_LOG_PAGE *err = (PD_NVME_ERROR_LOG_PAGE*) ctrls[i].data[TEMPLATE_NVME_ERR_LOG];
+            int n = ctrls[i].len[TEMPLATE_NVME_ERR_LOG] / NVME_ERR_ENTRY_LEN;
+            printf("    error log: first %llu last %llu\n", err[0].error_count, err[n - 1].error_count);
+        }
+        snprintf(path, sizeof(path), "/tmp/nvme_pkg_%d.bin", i);
+        printf("    package %s: %d\n", path, nvme_write_pkg(&ctrls[i], path));
+        nvme_ctrl_free(&ctrls[i]);
+    }
+    return 0;
+}
+#endif
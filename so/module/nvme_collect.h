@@ -0,0 +1,25 @@
+#ifndef _NVME_COLLECT_H
+#define _NVME_COLLECT_H
+
+#include "nvme_admin.h"
+
+#define NVME_MAX_CTRL           32
+#define NVME_SMART_LOG_LEN      512
+#define NVME_SELF_TEST_LOG_LEN  564
+#define NVME_ERR_ENTRY_LEN      64
+#define NVME_LOG_CHUNK          4096    /* bytes per GET LOG PAGE when the controller takes an offset */
+
+struct nvme_ctrl {
+    char dev[64];                       /*!< "nvme0", "/dev/nvme0" or a mock image */
+    unsigned int nsid;                  /*!< namespace of TEMPLATE_NVME_IDENTIFY_NAMESPACE, 1 when 0 */
+    unsigned char *data[TEMPLATE_NVME_MAX_ITEMS];
+    int len[TEMPLATE_NVME_MAX_ITEMS];   /*!< 0 for a template that was not read */
+    int cmds;                           /*!< admin commands sent */
+    int ret;
+};
+
+int nvme_collect(struct nvme_ctrl *ctrls, int num);
+int nvme_write_pkg(struct nvme_ctrl *ctrl, const char *path);
+void nvme_ctrl_free(struct nvme_ctrl *ctrl);
+
+#endif
@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "hal.h"
+#include "nvme_admin.h"
+#include "nvme_identify.h"
+#include "uevent.h"
+
+/*
+ * Identify data of NVMe controllers, read once and kept as the raw 4 KB
+ * pages. A getter copies the bytes of its own field out of the page and
+ * decodes them, so asking for the model or the capacity does not move the
+ * power state descriptors and vendor specific areas around.
+ * The controller page is read on the first getter of a controller, the
+ * namespace page on the first namespace getter, nvme_collect() seeds both
+ * with what it has read anyway.
+ */
+
+static struct nvme_id_page pages[NVME_ID_MAX_CTRL];
+static int victim = 0;
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t hotplug_once = PTHREAD_ONCE_INIT;
+
+static void start_hotplug();
+
+/* pages are keyed by "nvme0", a lookup as "/dev/nvme0" finds the same page */
+static const char *dev_name(const char *dev)
+{
+    return strncmp(dev, "/dev/", 5) == 0 ? dev + 5 : dev;
+}
+
+/* page_lock held */
+static struct nvme_id_page *find_page(const char *dev)
+{
+    int i;
+
+    for(i = 0 ; i < NVME_ID_MAX_CTRL ; i++)
+    {
+        if(pages[i].dev[0] != '\0' && strcmp(pages[i].dev, dev_name(dev)) == 0)
+            return &pages[i];
+    }
+    return NULL;
+}
+
+/* page_lock held */
+static struct nvme_id_page *new_page(const char *dev)
+{
+    int i;
+    struct nvme_id_page *page;
+
+    for(i = 0 ; i < NVME_ID_MAX_CTRL ; i++)
+    {
+        if(pages[i].dev[0] == '\0')
+            break;
+    }
+    if(i == NVME_ID_MAX_CTRL)
+    {
+        i = victim;
+        victim = (victim + 1) % NVME_ID_MAX_CTRL;
+    }
+    page = &pages[i];
+    memset(page, 0, offsetof(struct nvme_id_page, ctrl));
+    snprintf(page->dev, sizeof(page->dev), "%s", dev_name(dev));
+    return page;
+}
+
+/*
+ * Make sure the page a getter needs is there, the identify command is sent
+ * without page_lock so a slow controller does not hold up the others.
+ * @return 0 with page_lock held, -1 without it.
+ */
+static int lock_page(const char *dev, int ns, struct nvme_id_page **pageP)
+{
+    int fd, ret;
+    unsigned int nsid;
+    struct nvme_id_page *page;
+    unsigned char *buf;
+
+    pthread_once(&hotplug_once, start_hotplug);
+    pthread_mutex_lock(&page_lock);
+    page = find_page(dev);
+    if(page != NULL && (!ns || page->ns_valid))
+    {
+        *pageP = page;
+        return 0;
+    }
+    nsid = page != NULL && page->nsid ? page->nsid : 1;
+    pthread_mutex_unlock(&page_lock);
+
+    if((buf = malloc(NVME_ID_LEN)) == NULL)
+    {
+        return -1;
+    }
+    if((fd = nvme_open(dev)) < 0)
+    {
+        free(buf);
+        return -1;
+    }
+    /* a namespace getter on a new controller reads the controller page first */
+    ret = 0;
+    if(page == NULL)
+    {
+        ret = nvme_identify(fd, NVME_ID_CNS_CTRL, 0, buf);
+        pthread_mutex_lock(&page_lock);
+        if(ret == 0 && (page = find_page(dev)) == NULL)
+        {
+            page = new_page(dev);
+            memcpy(page->ctrl, buf, NVME_ID_LEN);
+            page->loads++;
+        }
+        pthread_mutex_unlock(&page_lock);
+    }
+    if(ret == 0 && ns)
+    {
+        ret = nvme_identify(fd, NVME_ID_CNS_NS, nsid, buf);
+        pthread_mutex_lock(&page_lock);
+        if(ret == 0 && (page = find_page(dev)) != NULL && !page->ns_valid)
+        {
+            memcpy(page->ns, buf, NVME_ID_LEN);
+            page->ns_valid = 1;
+            page->loads++;
+        }
+        pthread_mutex_unlock(&page_lock);
+    }
+    close(fd);
+    free(buf);
+    if(ret != 0)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&page_lock);
+    page = find_page(dev);
+    if(page == NULL || (ns && !page->ns_valid))
+    {
+        /* pushed out by other controllers in the meantime */
+        pthread_mutex_unlock(&page_lock);
+        return -1;
+    }
+    *pageP = page;
+    return 0;
+}
+
+/*
+ * len bytes at off of the controller page, or of the namespace page when ns is set.
+ * @retval 0 Success.
+ * @retval -1 The identify command failed or off and len are outside of the page.
+ */
+int nvme_id_get_bytes(const char *dev, int ns, int off, void *buf, int len)
+{
+    struct nvme_id_page *page;
+
+    if(off < 0 || len < 0 || off + len > NVME_ID_LEN)
+    {
+        return -1;
+    }
+    if(lock_page(dev, ns, &page) != 0)
+    {
+        return -1;
+    }
+    memcpy(buf, (ns ? page->ns : page->ctrl) + off, len);
+    pthread_mutex_unlock(&page_lock);
+    return 0;
+}
+
+static uint64_t get_le(unsigned char *p, int len)
+{
+    uint64_t v = 0;
+
+    while(len-- > 0)
+        v = (v << 8) | p[len];
+    return v;
+}
+
+/* an ASCII field padded with spaces, as PD_Get_Model() returns it */
+static int get_string(const char *dev, int off, int len, char *str, unsigned int buf_len)
+{
+    char field[64];
+
+    if(buf_len == 0 || nvme_id_get_bytes(dev, 0, off, field, len) != 0)
+    {
+        return -1;
+    }
+    while(len > 0 && (field[len - 1] == ' ' || field[len - 1] == '\0'))
+        len--;
+    if(len > (int) buf_len - 1)
+        len = buf_len - 1;
+    memcpy(str, field, len);
+    str[len] = '\0';
+    return 0;
+}
+
+int nvme_id_get_model(const char *dev, char *model, unsigned int buf_len)
+{
+    return get_string(dev, offsetof(PD_NVME_ID_CTRL, mn), sizeof(((PD_NVME_ID_CTRL*) 0)->mn), model, buf_len);
+}
+
+int nvme_id_get_serial(const char *dev, char *serial_no, unsigned int buf_len)
+{
+    return get_string(dev, offsetof(PD_NVME_ID_CTRL, sn), sizeof(((PD_NVME_ID_CTRL*) 0)->sn), serial_no, buf_len);
+}
+
+int nvme_id_get_fw(const char *dev, char *fw, unsigned int buf_len)
+{
+    return get_string(dev, offsetof(PD_NVME_ID_CTRL, fr), sizeof(((PD_NVME_ID_CTRL*) 0)->fr), fw, buf_len);
+}
+
+/* namespace size in sectors of the formatted LBA size, as PD_Get_Capacity() */
+int nvme_id_get_capacity(const char *dev, unsigned long long *capacityP, unsigned int *sector_sizeP)
+{
+    unsigned char head[offsetof(NVME_ID_NS, lbaf) + sizeof(((NVME_ID_NS*) 0)->lbaf)];
+    NVME_ID_NS *id = (NVME_ID_NS*) head;
+    unsigned char ds;
+
+    if(nvme_id_get_bytes(dev, 1, 0, head, sizeof(head)) != 0)
+    {
+        return -1;
+    }
+    ds = id->lbaf[id->flbas & 0x0f].ds;
+    *capacityP = get_le(id->nsze, sizeof(id->nsze));
+    *sector_sizeP = ds >= 9 && ds < 32 ? 1U << ds : 512;
+    return 0;
+}
+
+/* total NVM capacity in bytes, 0 when the controller does not report it; the low 64 bits */
+int nvme_id_get_tnvmcap(const char *dev, unsigned long long *bytesP)
+{
+    unsigned char cap[8];
+
+    if(nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, tnvmcap), cap, sizeof(cap)) != 0)
+    {
+        return -1;
+    }
+    *bytesP = get_le(cap, sizeof(cap));
+    return 0;
+}
+
+int nvme_id_get_ns_num(const char *dev, unsigned int *numP)
+{
+    unsigned char nn[4];
+
+    if(nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, nn), nn, sizeof(nn)) != 0)
+    {
+        return -1;
+    }
+    *numP = get_le(nn, sizeof(nn));
+    return 0;
+}
+
+/* warning and critical composite temperature thresholds in Celsius, 0 when not reported */
+int nvme_id_get_temp_thr(const char *dev, int *warnP, int *critP)
+{
+    unsigned char thr[4];
+    int k;
+
+    /* wctemp and cctemp are next to each other */
+    if(nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, wctemp), thr, sizeof(thr)) != 0)
+    {
+        return -1;
+    }
+    k = get_le(thr, 2);
+    *warnP = k ? k - 273 : 0;
+    k = get_le(thr + 2, 2);
+    *critP = k ? k - 273 : 0;
+    return 0;
+}
+
+/* entries of the error log, elpe is 0 based */
+int nvme_id_get_err_entries(const char *dev, int *numP)
+{
+    unsigned char elpe;
+
+    if(nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, elpe), &elpe, 1) != 0)
+    {
+        return -1;
+    }
+    *numP = elpe + 1;
+    return 0;
+}
+
+/* one power state descriptor, index up to npss */
+int nvme_id_get_power_state(const char *dev, int index, PD_NVME_ID_POWER_STATE *psd)
+{
+    unsigned char npss;
+
+    if(index < 0 || index >= 32 || nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, npss), &npss, 1) != 0)
+    {
+        return -1;
+    }
+    if(index > npss)
+    {
+        return -1;
+    }
+    return nvme_id_get_bytes(dev, 0, offsetof(PD_NVME_ID_CTRL, psd) + index * sizeof(*psd), psd, sizeof(*psd));
+}
+
+/* pages the caller has read anyway, ns may be NULL */
+void nvme_id_put(const char *dev, unsigned int nsid, const unsigned char *ctrl, const unsigned char *ns)
+{
+    struct nvme_id_page *page;
+
+    pthread_once(&hotplug_once, start_hotplug);
+    pthread_mutex_lock(&page_lock);
+    if((page = find_page(dev)) == NULL)
+        page = new_page(dev);
+    memcpy(page->ctrl, ctrl, NVME_ID_LEN);
+    page->nsid = nsid;
+    page->ns_valid = 0;
+    if(ns != NULL)
+    {
+        memcpy(page->ns, ns, NVME_ID_LEN);
+        page->ns_valid = 1;
+    }
+    pthread_mutex_unlock(&page_lock);
+}
+
+/*
+ * The controller was removed or reformatted, "nvme0" also drops a page read
+ * as "/dev/nvme0". NULL forgets every controller.
+ */
+void nvme_id_forget(const char *dev)
+{
+    int i;
+
+    pthread_mutex_lock(&page_lock);
+    for(i = 0 ; i < NVME_ID_MAX_CTRL ; i++)
+    {
+        if(pages[i].dev[0] != '\0' && (dev == NULL || strcmp(pages[i].dev, dev_name(dev)) == 0))
+            pages[i].dev[0] = '\0';
+    }
+    pthread_mutex_unlock(&page_lock);
+}
+
+/* nvme controller add/remove events, uevent_start() (or adapter_start_discovery()) delivers them */
+static void hotplug_handler(struct uevent *ev, void *arg)
+{
+    (void) arg;
+    if(ev->action == UEVENT_RESYNC)
+        nvme_id_forget(NULL);
+    else if((ev->action == UEVENT_ADD || ev->action == UEVENT_REMOVE) && ev->devname[0])
+        nvme_id_forget(ev->devname);
+}
+
+/* the first cached page starts following hotplug */
+static void start_hotplug()
+{
+    uevent_register_handler("nvme", hotplug_handler, NULL);
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i, r, warn, crit, err_num;
+    char model[41], serial[21], fw[9];
+    unsigned int sector_size, nn;
+    unsigned long long capacity, tnvmcap;
+    PD_NVME_ID_POWER_STATE psd;
+    struct nvme_id_page *page;
+
+    /* nvme_identify nvme0 [./mock.img ...], every getter a few times */
+    for(i = 1 ; i < argc ; i++)
+    {
+        for(r = 0 ; r < 3 ; r++)
+        {
+            model[0] = serial[0] = fw[0] = '\0';
+            nvme_id_get_model(argv[i], model, sizeof(model));
+            nvme_id_get_serial(argv[i], serial, sizeof(serial));
+            nvme_id_get_fw(argv[i], fw, sizeof(fw));
+            capacity = sector_size = 0;
+            nvme_id_get_capacity(argv[i], &capacity, &sector_size);
+        }
+        tnvmcap = nn = warn = crit = err_num = 0;
+        nvme_id_get_tnvmcap(argv[i], &tnvmcap);
+        nvme_id_get_ns_num(argv[i], &nn);
+        nvme_id_get_temp_thr(argv[i], &warn, &crit);
+        nvme_id_get_err_entries(argv[i], &err_num);
+        printf("(dev, model, serial, fw) = (%s, %s, %s, %s)\n", argv[i], model, serial, fw);
+        printf("    (capacity, sector_size, tnvmcap, nn) = (%llu, %u, %llu, %u)\n", capacity, sector_size, tnvmcap, nn);
+        printf("    (warn, crit, err_entries) = (%d, %d, %d)\n", warn, crit, err_num);
+        if(nvme_id_get_power_state(argv[i], 0, &psd) == 0)
+            printf("    ps0 max power: %d cW\n", psd.max_power[0] | (psd.max_power[1] << 8));
+        pthread_mutex_lock(&page_lock);
+        if((page = find_page(argv[i])) != NULL)
+            printf("    identify commands: %lu\n", page->loads);
+        pthread_mutex_unlock(&page_lock);
+    }
+    printf("cache: %zu bytes for %d controllers\n", sizeof(pages), NVME_ID_MAX_CTRL);
+    return 0;
+}
+#endif
@@ -0,0 +1,35 @@
+#ifndef _NVME_IDENTIFY_H
+#define _NVME_IDENTIFY_H
+
+#include <stdint.h>
+
+#define NVME_ID_MAX_CTRL        32
+
+/*
+ * Raw identify pages of one controller, kept as read. Fields are decoded
+ * from the bytes by the getters, nothing is copied out as PD_NVME_ID_CTRL
+ * or NVME_ID_NS.
+ */
+struct nvme_id_page {
+    char dev[64];                       /*!< "" for a free slot */
+    unsigned int nsid;
+    int ns_valid;                       /*!< the namespace page is read on its first getter */
+    unsigned long loads;                /*!< identify commands sent for this controller */
+    unsigned char ctrl[NVME_ID_LEN];
+    unsigned char ns[NVME_ID_LEN];
+};
+
+int nvme_id_get_model(const char *dev, char *model, unsigned int buf_len);
+int nvme_id_get_serial(const char *dev, char *serial_no, unsigned int buf_len);
+int nvme_id_get_fw(const char *dev, char *fw, unsigned int buf_len);
+int nvme_id_get_capacity(const char *dev, unsigned long long *capacityP, unsigned int *sector_sizeP);
+int nvme_id_get_tnvmcap(const char *dev, unsigned long long *bytesP);
+int nvme_id_get_ns_num(const char *dev, unsigned int *numP);
+int nvme_id_get_temp_thr(const char *dev, int *warnP, int *critP);
+int nvme_id_get_err_entries(const char *dev, int *numP);
+int nvme_id_get_power_state(const char *dev, int index, PD_NVME_ID_POWER_STATE *psd);
+int nvme_id_get_bytes(const char *dev, int ns, int off, void *buf, int len);
+void nvme_id_put(const char *dev, unsigned int nsid, const unsigned char *ctrl, const unsigned char *ns);
+void nvme_id_forget(const char *dev);
+
+#endif
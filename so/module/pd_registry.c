@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "hal.h"
+#include "pd_registry.h"
+#include "uevent.h"
+
+/*
+ * In-process registry of physical disks for the PD_Get_Id_By_* family.
+ * Every key has its own hash index over one entry pool, so a lookup is a
+ * bucket walk instead of a configuration file scan. Updates are grouped in a
+ * transaction under the write lock and bump the generation once on commit.
+ */
+
+/* allocated on the first add and grown on demand, not held by every process that maps the library */
+static struct pd_reg_entry *entries = NULL;
+static int entry_used = 0;
+static int entry_cap = 0;
+static int (*heads)[PD_REG_HASH_SIZE] = NULL;
+static unsigned long generation = 0;
+static pthread_rwlock_t reg_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * Disks whose add event came before the HAL knew them, retried on later
+ * events and lookup misses.
+ */
+struct pending_disk {
+    char sys_name[MAX_PD_SYS_NAME];
+    time_t last_try;
+};
+
+static struct pending_disk pendings[PD_REG_PENDING_MAX];
+static int pending_num = 0;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_bytes(uint32_t h, const void *data, int len)
+{
+    int i;
+    const unsigned char *p = (const unsigned char*) data;
+
+    for(i = 0 ; i < len ; i++)
+    {
+        h = (h ^ p[i]) * 16777619;
+    }
+    return h;
+}
+
+#define HASH_INIT   2166136261u
+
+/*
+ * @retval 1 the key is hashed into *hash.
+ * @retval 0 the entry has no such key (empty string, unknown dev_t), it is not indexed.
+ */
+static int key_hash(const struct pd_reg_entry *e, int idx, uint32_t *hash)
+{
+    uint32_t h = HASH_INIT;
+
+    switch(idx)
+    {
+        case PD_REG_BY_DEV_ID:
+            h = hash_bytes(h, &e->dev_id, sizeof(e->dev_id));
+            break;
+        case PD_REG_BY_SYS_ID:
+            if(e->pd_sys_id[0] == '\0')
+                return 0;
+            h = hash_bytes(h, e->enc_sys_id, strlen(e->enc_sys_id) + 1);
+            h = hash_bytes(h, e->pd_sys_id, strlen(e->pd_sys_id));
+            break;
+        case PD_REG_BY_SYS_NAME:
+            if(e->sys_name[0] == '\0')
+                return 0;
+            h = hash_bytes(h, e->sys_name, strlen(e->sys_name));
+            break;
+        case PD_REG_BY_SG_NAME:
+            if(e->sg_name[0] == '\0')
+                return 0;
+            h = hash_bytes(h, e->sg_name, strlen(e->sg_name));
+            break;
+        case PD_REG_BY_DEV_NO:
+            if(e->dev_no == 0)
+                return 0;
+            h = hash_bytes(h, &e->dev_no, sizeof(e->dev_no));
+            break;
+        case PD_REG_BY_WWN:
+            if(e->wwn[0] == '\0')
+                return 0;
+            h = hash_bytes(h, e->wwn, strlen(e->wwn));
+            break;
+        case PD_REG_BY_SERIAL:
+            if(e->serial[0] == '\0')
+                return 0;
+            h = hash_bytes(h, e->serial, strlen(e->serial));
+            break;
+        default:
+            return 0;
+    }
+    *hash = h & (PD_REG_HASH_SIZE - 1);
+    return 1;
+}
+
+static int key_equal(const struct pd_reg_entry *a, const struct pd_reg_entry *b, int idx)
+{
+    switch(idx)
+    {
+        case PD_REG_BY_DEV_ID:
+            return a->dev_id == b->dev_id;
+        case PD_REG_BY_SYS_ID:
+            return !strcmp(a->enc_sys_id, b->enc_sys_id) && !strcmp(a->pd_sys_id, b->pd_sys_id);
+        case PD_REG_BY_SYS_NAME:
+            return !strcmp(a->sys_name, b->sys_name);
+        case PD_REG_BY_SG_NAME:
+            return !strcmp(a->sg_name, b->sg_name);
+        case PD_REG_BY_DEV_NO:
+            return a->dev_no == b->dev_no;
+        case PD_REG_BY_WWN:
+            return !strcmp(a->wwn, b->wwn);
+        case PD_REG_BY_SERIAL:
+            return !strcmp(a->serial, b->serial);
+    }
+    return 0;
+}
+
+static void link_entry(int slot)
+{
+    int idx;
+    uint32_t h;
+    struct pd_reg_entry *e = &entries[slot];
+
+    for(idx = 0 ; idx < PD_REG_INDEX_NUM ; idx++)
+    {
+        e->next[idx] = -1;
+        if(key_hash(e, idx, &h))
+        {
+            e->next[idx] = heads[idx][h];
+            heads[idx][h] = slot;
+        }
+    }
+}
+
+static void unlink_entry(int slot)
+{
+    int idx;
+    int *p;
+    uint32_t h;
+    struct pd_reg_entry *e = &entries[slot];
+
+    for(idx = 0 ; idx < PD_REG_INDEX_NUM ; idx++)
+    {
+        if(!key_hash(e, idx, &h))
+            continue;
+        for(p = &heads[idx][h] ; *p >= 0 ; p = &entries[*p].next[idx])
+        {
+            if(*p == slot)
+            {
+                *p = e->next[idx];
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Walk one index for the key of probe. A present disk wins; with history,
+ * the most recently removed disk is returned when none is present.
+ * reg_lock held.
+ */
+static struct pd_reg_entry *lookup(const struct pd_reg_entry *probe, int idx, int history)
+{
+    int slot;
+    uint32_t h;
+    struct pd_reg_entry *removed = NULL;
+
+    if(heads == NULL || !key_hash(probe, idx, &h))
+    {
+        return NULL;
+    }
+    for(slot = heads[idx][h] ; slot >= 0 ; slot = entries[slot].next[idx])
+    {
+        struct pd_reg_entry *e = &entries[slot];
+        if(!key_equal(e, probe, idx))
+            continue;
+        if(e->present)
+            return e;
+        if(history && (removed == NULL || e->removed_gen > removed->removed_gen))
+            removed = e;
+    }
+    return removed;
+}
+
+/* a never used slot (the pool grows up to PD_REG_MAX), else the oldest history entry */
+static int alloc_slot()
+{
+    int i;
+    int cap;
+    int oldest = -1;
+    struct pd_reg_entry *p;
+
+    if(heads == NULL)
+    {
+        if((heads = malloc(PD_REG_INDEX_NUM * sizeof(*heads))) == NULL)
+            return -1;
+        memset(heads, 0xff, PD_REG_INDEX_NUM * sizeof(*heads));
+    }
+    if(entry_used == entry_cap && entry_cap < PD_REG_MAX)
+    {
+        cap = entry_cap ? entry_cap * 2 : PD_REG_GROW;
+        if(cap > PD_REG_MAX)
+            cap = PD_REG_MAX;
+        /* entries are chained by index, moving the pool keeps the indexes valid */
+        if((p = realloc(entries, cap * sizeof(struct pd_reg_entry))) != NULL)
+        {
+            entries = p;
+            entry_cap = cap;
+        }
+    }
+    if(entry_used < entry_cap)
+    {
+        return entry_used++;
+    }
+    for(i = 0 ; i < entry_used ; i++)
+    {
+        if(!entries[i].present && (oldest < 0 || entries[i].removed_gen < entries[oldest].removed_gen))
+            oldest = i;
+    }
+    if(oldest >= 0)
+    {
+        unlink_entry(oldest);
+    }
+    return oldest;
+}
+
+void pd_registry_begin()
+{
+    pthread_rwlock_wrlock(&reg_lock);
+}
+
+unsigned long pd_registry_commit()
+{
+    unsigned long gen = __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&reg_lock);
+    return gen;
+}
+
+/*
+ * Bumped by every commit, a caller holding results of earlier lookups
+ * compares it to know they may be stale.
+ */
+unsigned long pd_registry_get_generation()
+{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+static void mark_removed(struct pd_reg_entry *e)
+{
+    e->present = 0;
+    e->removed_gen = generation + 1;
+}
+
+/*
+ * Add or refresh a present disk, inside a transaction. The same disk on the
+ * same PD_DEV_ID is updated in place, a different one moves the old disk to
+ * the history. Pointers into the pool are not valid across this call.
+ */
+int pd_registry_add(const struct pd_reg_entry *disk)
+{
+    int slot;
+    struct pd_reg_entry *old = lookup(disk, PD_REG_BY_DEV_ID, 0);
+
+    if(old && ((old->wwn[0] && !strcmp(old->wwn, disk->wwn)) ||
+               (old->serial[0] && !strcmp(old->serial, disk->serial))))
+    {
+        unsigned long added_gen = old->added_gen;
+
+        slot = old - entries;
+        unlink_entry(slot);
+        *old = *disk;
+        old->present = 1;
+        old->added_gen = added_gen;
+        old->removed_gen = 0;
+        link_entry(slot);
+        return 0;
+    }
+    if(old)
+    {
+        mark_removed(old);
+    }
+    if((slot = alloc_slot()) < 0)
+    {
+        return -1;
+    }
+    entries[slot] = *disk;
+    entries[slot].present = 1;
+    entries[slot].added_gen = generation + 1;
+    entries[slot].removed_gen = 0;
+    link_entry(slot);
+    return 0;
+}
+
+int pd_registry_remove(PD_DEV_ID dev_id)
+{
+    struct pd_reg_entry probe;
+    struct pd_reg_entry *e;
+
+    probe.dev_id = dev_id;
+    if((e = lookup(&probe, PD_REG_BY_DEV_ID, 0)) == NULL)
+    {
+        return -1;
+    }
+    mark_removed(e);
+    return 0;
+}
+
+int pd_registry_remove_by_sys_name(const char *sys_name)
+{
+    struct pd_reg_entry probe;
+    struct pd_reg_entry *e;
+
+    snprintf(probe.sys_name, sizeof(probe.sys_name), "%s", sys_name);
+    if((e = lookup(&probe, PD_REG_BY_SYS_NAME, 0)) == NULL)
+    {
+        return -1;
+    }
+    mark_removed(e);
+    return 0;
+}
+
+/* /sys/block/<sys_name>/device/scsi_generic/<sg name> */
+static void get_sg_name(const char *sys_name, char *sg_name, int len)
+{
+    char path[128];
+    struct dirent *de;
+    DIR *dr;
+
+    sg_name[0] = '\0';
+    snprintf(path, sizeof(path), "/sys/block/%s/device/scsi_generic", sys_name);
+    if((dr = opendir(path)) == NULL)
+    {
+        return;
+    }
+    while((de = readdir(dr)) != NULL)
+    {
+        if(de->d_name[0] != '.')
+        {
+            snprintf(sg_name, len, "%s", de->d_name);
+            break;
+        }
+    }
+    closedir(dr);
+}
+
+static int fill_entry(int enc_id, int port_id, struct pd_reg_entry *e)
+{
+    PD_INFO info;
+    char *name;
+
+    if(PD_Get_Info(enc_id, port_id, &info) < 0)
+    {
+        return -1;
+    }
+    memset(e, 0, sizeof(*e));
+    e->dev_id = PD_MAKE_DEV_ID(enc_id, port_id);
+    name = strncmp(info.pd_sys_name, "/dev/", 5) ? info.pd_sys_name : info.pd_sys_name + 5;
+    snprintf(e->enc_sys_id, sizeof(e->enc_sys_id), "%s", info.enc_sys_id);
+    snprintf(e->pd_sys_id, sizeof(e->pd_sys_id), "%s", info.pd_sys_id);
+    snprintf(e->sys_name, sizeof(e->sys_name), "%s", name);
+    snprintf(e->wwn, sizeof(e->wwn), "%s", info.wwn);
+    snprintf(e->serial, sizeof(e->serial), "%s", info.serial_no);
+    if(PD_Get_Dev_No_By_Id(enc_id, port_id, &e->dev_no) < 0)
+    {
+        e->dev_no = 0;
+    }
+    get_sg_name(e->sys_name, e->sg_name, sizeof(e->sg_name));
+    return 0;
+}
+
+/*
+ * Fill the registry from the HAL, disks no longer enumerated go to the history.
+ * The HAL is read before the write lock is taken.
+ * @return number of present disks, -1 on failure.
+ */
+int pd_registry_load()
+{
+    int i, j, num;
+    int id_num = MAX_PD_NUM;
+    PD_DEV_ID *ids = NULL;
+    PD_DEV_ID *p;
+    struct pd_reg_entry *disks;
+    static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+    int disk_num = 0;
+
+    pthread_mutex_lock(&load_lock);
+    /* the HAL returns the full count when the array is too small */
+    while(1)
+    {
+        if((p = realloc(ids, id_num * sizeof(PD_DEV_ID))) == NULL)
+        {
+            free(ids);
+            pthread_mutex_unlock(&load_lock);
+            return -1;
+        }
+        ids = p;
+        num = PD_Enumerate_All(ids, id_num, NULL, NULL);
+        if(num <= id_num || id_num >= MAX_SE_NUM * MAX_PD_NUM)
+            break;
+        id_num = num < MAX_SE_NUM * MAX_PD_NUM ? num : MAX_SE_NUM * MAX_PD_NUM;
+    }
+    if(num < 0 || (disks = malloc((num ? num : 1) * sizeof(struct pd_reg_entry))) == NULL)
+    {
+        free(ids);
+        pthread_mutex_unlock(&load_lock);
+        return -1;
+    }
+    if(num > id_num)
+        num = id_num;
+    for(i = 0 ; i < num ; i++)
+    {
+        if(fill_entry(ids[i] >> 16, ids[i] & 0xffff, &disks[disk_num]) == 0)
+            disk_num++;
+    }
+
+    pd_registry_begin();
+    for(i = 0 ; i < entry_used ; i++)
+    {
+        if(!entries[i].present)
+            continue;
+        for(j = 0 ; j < disk_num ; j++)
+        {
+            if(disks[j].dev_id == entries[i].dev_id)
+                break;
+        }
+        if(j == disk_num)
+            mark_removed(&entries[i]);
+    }
+    for(i = 0 ; i < disk_num ; i++)
+    {
+        pd_registry_add(&disks[i]);
+    }
+    pd_registry_commit();
+    pthread_mutex_unlock(&load_lock);
+    free(disks);
+    free(ids);
+    return disk_num;
+}
+
+static void pending_add(const char *sys_name)
+{
+    int i;
+
+    pthread_mutex_lock(&pending_lock);
+    for(i = 0 ; i < pending_num ; i++)
+    {
+        if(!strcmp(pendings[i].sys_name, sys_name))
+            break;
+    }
+    if(i == pending_num && pending_num < PD_REG_PENDING_MAX)
+    {
+        snprintf(pendings[i].sys_name, sizeof(pendings[i].sys_name), "%s", sys_name);
+        pending_num++;
+    }
+    if(i < pending_num)
+    {
+        pendings[i].last_try = time(NULL);
+    }
+    pthread_mutex_unlock(&pending_lock);
+}
+
+static void pending_del(const char *sys_name)
+{
+    int i;
+
+    pthread_mutex_lock(&pending_lock);
+    for(i = 0 ; i < pending_num ; i++)
+    {
+        if(!strcmp(pendings[i].sys_name, sys_name))
+        {
+            pendings[i] = pendings[--pending_num];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pending_lock);
+}
+
+/* HAL lookup of a hotplugged disk, a disk the HAL does not know yet is left pending */
+static int hotplug_add(const char *sys_name)
+{
+    int enc_id, port_id;
+    struct pd_reg_entry disk;
+
+    if(PD_Get_Id_By_Sys_Name((char*) sys_name, &enc_id, &port_id) < 0 ||
+       fill_entry(enc_id, port_id, &disk) < 0)
+    {
+        pending_add(sys_name);
+        return -1;
+    }
+    pending_del(sys_name);
+    pd_registry_begin();
+    pd_registry_add(&disk);
+    pd_registry_commit();
+    return 0;
+}
+
+/*
+ * Retry the pending disks, each at most once per PD_REG_PENDING_RETRY_SEC.
+ * @return number of disks added.
+ */
+static int retry_pending()
+{
+    int i, num = 0;
+    int try_num = 0;
+    time_t now = time(NULL);
+    char names[PD_REG_PENDING_MAX][MAX_PD_SYS_NAME];
+
+    pthread_mutex_lock(&pending_lock);
+    for(i = 0 ; i < pending_num ; i++)
+    {
+        if(now - pendings[i].last_try >= PD_REG_PENDING_RETRY_SEC)
+        {
+            pendings[i].last_try = now;
+            memcpy(names[try_num++], pendings[i].sys_name, MAX_PD_SYS_NAME);
+        }
+    }
+    pthread_mutex_unlock(&pending_lock);
+    for(i = 0 ; i < try_num ; i++)
+    {
+        if(hotplug_add(names[i]) == 0)
+            num++;
+    }
+    return num;
+}
+
+static void hotplug_handler(struct uevent *ev, void *arg)
+{
+    if(ev->action == UEVENT_RESYNC)
+    {
+        pd_registry_load();
+        retry_pending();
+        return;
+    }
+    if(strcmp(ev->devtype, "disk") || ev->devname[0] == '\0')
+    {
+        retry_pending();
+        return;
+    }
+    if(ev->action == UEVENT_REMOVE)
+    {
+        pending_del(ev->devname);
+        pd_registry_begin();
+        pd_registry_remove_by_sys_name(ev->devname);
+        pd_registry_commit();
+    }
+    else if(ev->action == UEVENT_ADD)
+    {
+        hotplug_add(ev->devname);
+    }
+    retry_pending();
+}
+
+/*
+ * Follow block disk add/remove events, uevent_start() (or
+ * adapter_start_discovery()) delivers them. Lost events reload the registry.
+ */
+int pd_registry_start_hotplug()
+{
+    return uevent_register_handler("block", hotplug_handler, NULL);
+}
+
+static int get_entry(struct pd_reg_entry *probe, int idx, int history, struct pd_reg_entry *disk, int *enc_idP, int *port_idP)
+{
+    int ret = -1;
+    int retried = 0;
+    struct pd_reg_entry *e;
+
+    while(1)
+    {
+        pthread_rwlock_rdlock(&reg_lock);
+        if((e = lookup(probe, idx, history)) != NULL)
+        {
+            if(disk)
+                *disk = *e;
+            if(enc_idP)
+                *enc_idP = e->dev_id >> 16;
+            if(port_idP)
+                *port_idP = e->dev_id & 0xffff;
+            ret = 0;
+        }
+        pthread_rwlock_unlock(&reg_lock);
+        /* the missing disk may be one still pending */
+        if(ret == 0 || retried || retry_pending() == 0)
+            break;
+        retried = 1;
+    }
+    return ret;
+}
+
+int pd_registry_get(PD_DEV_ID dev_id, struct pd_reg_entry *disk)
+{
+    struct pd_reg_entry probe;
+
+    probe.dev_id = dev_id;
+    return get_entry(&probe, PD_REG_BY_DEV_ID, 0, disk, NULL, NULL);
+}
+
+static int get_id_by_sys_id(char *enc_sys_id, char *pd_sys_id, int history, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    snprintf(probe.enc_sys_id, sizeof(probe.enc_sys_id), "%s", enc_sys_id);
+    snprintf(probe.pd_sys_id, sizeof(probe.pd_sys_id), "%s", pd_sys_id);
+    return get_entry(&probe, PD_REG_BY_SYS_ID, history, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_sys_id(char *enc_sys_id, char *pd_sys_id, int *enc_idP, int *port_idP)
+{
+    return get_id_by_sys_id(enc_sys_id, pd_sys_id, 0, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_sys_id_from_history(char *enc_sys_id, char *pd_sys_id, int *enc_idP, int *port_idP)
+{
+    return get_id_by_sys_id(enc_sys_id, pd_sys_id, 1, enc_idP, port_idP);
+}
+
+static int get_id_by_sys_name(char *pd_sys_name, int history, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    if(!strncmp(pd_sys_name, "/dev/", 5))
+        pd_sys_name += 5;
+    snprintf(probe.sys_name, sizeof(probe.sys_name), "%s", pd_sys_name);
+    return get_entry(&probe, PD_REG_BY_SYS_NAME, history, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_sys_name(char *pd_sys_name, int *enc_idP, int *port_idP)
+{
+    return get_id_by_sys_name(pd_sys_name, 0, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_sys_name_from_history(char *pd_sys_name, int *enc_idP, int *port_idP)
+{
+    return get_id_by_sys_name(pd_sys_name, 1, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_sg_name(char *sg_name, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    if(!strncmp(sg_name, "/dev/", 5))
+        sg_name += 5;
+    snprintf(probe.sg_name, sizeof(probe.sg_name), "%s", sg_name);
+    return get_entry(&probe, PD_REG_BY_SG_NAME, 0, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_dev_no(dev_t dev_no, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    probe.dev_no = dev_no;
+    return get_entry(&probe, PD_REG_BY_DEV_NO, 0, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_wwn(char *wwn, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    snprintf(probe.wwn, sizeof(probe.wwn), "%s", wwn);
+    return get_entry(&probe, PD_REG_BY_WWN, 0, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_id_by_serial(char *serial, int *enc_idP, int *port_idP)
+{
+    struct pd_reg_entry probe;
+
+    snprintf(probe.serial, sizeof(probe.serial), "%s", serial);
+    return get_entry(&probe, PD_REG_BY_SERIAL, 0, NULL, enc_idP, port_idP);
+}
+
+int pd_registry_get_dev_no_by_id(int enc_id, int port_id, dev_t *dev_noP)
+{
+    struct pd_reg_entry disk;
+
+    if(pd_registry_get(PD_MAKE_DEV_ID(enc_id, port_id), &disk) < 0 || disk.dev_no == 0)
+    {
+        return -1;
+    }
+    *dev_noP = disk.dev_no;
+    return 0;
+}
+
+int pd_registry_get_sys_name_by_wwn(char *wwn, char *sys_name, unsigned int buf_len)
+{
+    struct pd_reg_entry probe;
+    struct pd_reg_entry disk;
+
+    snprintf(probe.wwn, sizeof(probe.wwn), "%s", wwn);
+    if(get_entry(&probe, PD_REG_BY_WWN, 0, &disk, NULL, NULL) < 0)
+    {
+        return -1;
+    }
+    snprintf(sys_name, buf_len, "%s", disk.sys_name);
+    return 0;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i;
+    int enc_id, port_id;
+    struct pd_reg_entry disk;
+
+    i = pd_registry_load();
+    printf("load: %d, generation: %lu\n", i, pd_registry_get_generation());
+    for(i = 1 ; i < argc ; i++)
+    {
+        /* pd_registry [sys name | sg name | wwn | serial] ... */
+        if(pd_registry_get_id_by_sys_name_from_history(argv[i], &enc_id, &port_id) == 0 ||
+           pd_registry_get_id_by_sg_name(argv[i], &enc_id, &port_id) == 0 ||
+           pd_registry_get_id_by_wwn(argv[i], &enc_id, &port_id) == 0 ||
+           pd_registry_get_id_by_serial(argv[i], &enc_id, &port_id) == 0)
+        {
+            memset(&disk, 0, sizeof(disk));
+            pd_registry_get(PD_MAKE_DEV_ID(enc_id, port_id), &disk);
+            printf("(%s, enc_id, port_id, sys_name, sg_name, wwn, serial) = (%d, %d, %s, %s, %s, %s)\n",
+                   argv[i], enc_id, port_id, disk.sys_name, disk.sg_name, disk.wwn, disk.serial);
+        }
+        else
+        {
+            printf("(%s) not found\n", argv[i]);
+        }
+    }
+    return 0;
+}
+#endif
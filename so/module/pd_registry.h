@@ -0,0 +1,67 @@
+#ifndef _PD_REGISTRY_H
+#define _PD_REGISTRY_H
+
+#include <sys/types.h>
+
+#define PD_REG_MAX              (MAX_SE_NUM * MAX_PD_NUM + 512)     /* present disks plus history */
+#define PD_REG_GROW             64                                  /* first pool size, doubled up to PD_REG_MAX */
+#define PD_REG_PENDING_MAX      64                                  /* hotplugged disks the HAL did not know yet */
+#define PD_REG_PENDING_RETRY_SEC 1
+#define PD_REG_HASH_SIZE        4096                                /* power of 2 */
+#define PD_REG_SG_NAME_LEN      16
+
+typedef enum _PD_REG_INDEX
+{
+    PD_REG_BY_DEV_ID = 0,
+    PD_REG_BY_SYS_ID,                   /*!< enc_sys_id + pd_sys_id */
+    PD_REG_BY_SYS_NAME,
+    PD_REG_BY_SG_NAME,
+    PD_REG_BY_DEV_NO,
+    PD_REG_BY_WWN,
+    PD_REG_BY_SERIAL,
+    PD_REG_INDEX_NUM,
+} PD_REG_INDEX;
+
+/*
+ * One physical disk, present or removed. A removed disk stays in every index
+ * as history until its slot is reused by a newer disk.
+ */
+struct pd_reg_entry {
+    PD_DEV_ID dev_id;                   /*!< PD_MAKE_DEV_ID(enc_id, port_id) */
+    char enc_sys_id[MAX_SYS_ID_LEN];
+    char pd_sys_id[MAX_SYS_ID_LEN];
+    char sys_name[MAX_PD_SYS_NAME];     /*!< "sda" */
+    char sg_name[PD_REG_SG_NAME_LEN];   /*!< "sg1" */
+    dev_t dev_no;
+    char wwn[MAX_WWN_LEN];
+    char serial[MAX_SERIAL_NO_LEN];
+    int present;
+    unsigned long added_gen;
+    unsigned long removed_gen;          /*!< 0 while present */
+    int next[PD_REG_INDEX_NUM];         /*!< hash chains, -1 terminated */
+};
+
+/* updates are applied between begin and commit, readers never see half of them */
+void pd_registry_begin();
+int pd_registry_add(const struct pd_reg_entry *disk);
+int pd_registry_remove(PD_DEV_ID dev_id);
+int pd_registry_remove_by_sys_name(const char *sys_name);
+unsigned long pd_registry_commit();
+unsigned long pd_registry_get_generation();
+
+int pd_registry_load();
+int pd_registry_start_hotplug();
+
+int pd_registry_get(PD_DEV_ID dev_id, struct pd_reg_entry *disk);
+int pd_registry_get_id_by_sys_id(char *enc_sys_id, char *pd_sys_id, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_sys_id_from_history(char *enc_sys_id, char *pd_sys_id, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_sys_name(char *pd_sys_name, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_sys_name_from_history(char *pd_sys_name, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_sg_name(char *sg_name, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_dev_no(dev_t dev_no, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_wwn(char *wwn, int *enc_idP, int *port_idP);
+int pd_registry_get_id_by_serial(char *serial, int *enc_idP, int *port_idP);
+int pd_registry_get_dev_no_by_id(int enc_id, int port_id, dev_t *dev_noP);
+int pd_registry_get_sys_name_by_wwn(char *wwn, char *sys_name, unsigned int buf_len);
+
+#endif
@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "hal.h"
+#include "uevent.h"
+#include "phy_track.h"
+
+/*
+ * Error rates of phys from their cumulative counters.
+ * Every sample stores its deltas in a fixed ring per phy, the sums over the
+ * ring are updated as a sample comes in and the oldest one drops out, so the
+ * windowed rate costs the same at any uptime and memory is fixed at
+ * PHY_TRACK_MAX phys. A phy is flagged when its invalid dword or disparity
+ * rate over the window passes PHY_TRACK_RATE_THR and PHY_TRACK_JUMP times
+ * its own long term rate, or passes PHY_TRACK_ABS_THR so a fault the long
+ * term rate has learned stays flagged. The long term rate starts from the
+ * first full window, a steady rate from boot is not a jump.
+ * SATA phys are kept as port_id | PHY_TRACK_SATA next to the expander phys
+ * of the same enclosure.
+ */
+
+#define PHY_TRACK_SATA  0x10000
+
+static struct phy_track tracks[PHY_TRACK_MAX];
+static int heads[PHY_TRACK_HASH_SIZE];
+static int applied[MAX_SE_NUM];         /* REXP error handling turned on, track_lock */
+static pthread_mutex_t track_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void __attribute__((constructor)) phy_track_init()
+{
+    int i;
+
+    for(i = 0 ; i < PHY_TRACK_HASH_SIZE ; i++)
+        heads[i] = -1;
+    for(i = 0 ; i < PHY_TRACK_MAX ; i++)
+        tracks[i].enc_id = -1;
+}
+
+static uint32_t track_hash(int enc_id, int phy_id)
+{
+    return ((uint32_t) enc_id * 2654435761u ^ (uint32_t) phy_id * 40503u) & (PHY_TRACK_HASH_SIZE - 1);
+}
+
+/* track_lock held */
+static struct phy_track *get_track(int enc_id, int phy_id, int create)
+{
+    int i;
+    uint32_t h = track_hash(enc_id, phy_id);
+
+    for(i = heads[h] ; i >= 0 ; i = tracks[i].next)
+    {
+        if(tracks[i].enc_id == enc_id && tracks[i].phy_id == phy_id)
+            return &tracks[i];
+    }
+    if(!create)
+    {
+        return NULL;
+    }
+    for(i = 0 ; i < PHY_TRACK_MAX ; i++)
+    {
+        if(tracks[i].enc_id == -1)
+            break;
+    }
+    if(i == PHY_TRACK_MAX)
+    {
+        return NULL;
+    }
+    memset(&tracks[i], 0, sizeof(tracks[i]));
+    tracks[i].enc_id = enc_id;
+    tracks[i].phy_id = phy_id;
+    tracks[i].next = heads[h];
+    heads[h] = i;
+    return &tracks[i];
+}
+
+/* track_lock held */
+static uint32_t window_rate(struct phy_track *t, int c)
+{
+    if(t->win_dt == 0)
+        return 0;
+    return t->win_sum[c] * 60 / t->win_dt;
+}
+
+/*
+ * Add one sample of raw counters.
+ * @return 1 when the phy is flagged, 0 when not, -1 when the table is full.
+ * track_lock held.
+ */
+static int add_sample(int enc_id, int phy_id, uint64_t *cnt, time_t now)
+{
+    int c;
+    uint32_t rate;
+    uint64_t sample_rate;
+    struct phy_track *t;
+    struct phy_sample *s;
+
+    if((t = get_track(enc_id, phy_id, 1)) == NULL)
+    {
+        return -1;
+    }
+    if(t->stamp == 0 || now <= t->stamp)
+    {
+        /* first sample, or a second one within the same second: nothing to rate yet */
+        if(t->stamp == 0)
+        {
+            memcpy(t->last, cnt, sizeof(t->last));
+            t->stamp = now;
+        }
+        return t->flagged;
+    }
+
+    s = &t->ring[t->head];
+    if(t->num == PHY_TRACK_SAMPLES)
+    {
+        t->win_dt -= s->dt;
+        for(c = 0 ; c < PHY_CNT_NUM ; c++)
+            t->win_sum[c] -= s->delta[c];
+    }
+    else
+    {
+        t->num++;
+    }
+    s->dt = now - t->stamp;
+    t->win_dt += s->dt;
+    for(c = 0 ; c < PHY_CNT_NUM ; c++)
+    {
+        /* a counter that went back was cleared, count from zero */
+        uint64_t d = cnt[c] >= t->last[c] ? cnt[c] - t->last[c] : cnt[c];
+        s->delta[c] = d > 0xffffffff ? 0xffffffff : d;
+        t->win_sum[c] += s->delta[c];
+    }
+    t->head = (t->head + 1) % PHY_TRACK_SAMPLES;
+    memcpy(t->last, cnt, sizeof(t->last));
+    t->stamp = now;
+
+    if(!t->seeded && t->num < PHY_TRACK_SAMPLES)
+    {
+        /* no long term rate yet, only the absolute threshold applies */
+        t->flagged = 0;
+        for(c = PHY_CNT_INVD_DW ; c <= PHY_CNT_DISP ; c++)
+        {
+            if(window_rate(t, c) >= PHY_TRACK_ABS_THR)
+                t->flagged = 1;
+        }
+        if(!t->flagged)
+            t->handled = 0;
+        return t->flagged;
+    }
+
+    t->flagged = 0;
+    for(c = 0 ; c < PHY_CNT_NUM ; c++)
+    {
+        rate = window_rate(t, c);
+        if(!t->seeded)
+        {
+            t->base[c] = (rate > 0xffffff ? 0xffffff : rate) << PHY_TRACK_EWMA_SHIFT;
+            continue;
+        }
+        if((c == PHY_CNT_INVD_DW || c == PHY_CNT_DISP) &&
+           ((rate >= PHY_TRACK_RATE_THR && rate >= PHY_TRACK_JUMP * (t->base[c] >> PHY_TRACK_EWMA_SHIFT)) ||
+            rate >= PHY_TRACK_ABS_THR))
+        {
+            t->flagged = 1;
+        }
+        sample_rate = (uint64_t) s->delta[c] * 60 / s->dt;
+        if(sample_rate > 0xffffff)
+            sample_rate = 0xffffff;     /* room for the EWMA scale in 32 bits */
+        t->base[c] = t->base[c] - (t->base[c] >> PHY_TRACK_EWMA_SHIFT) + sample_rate;
+    }
+    if(!t->seeded)
+    {
+        /* the first full window is the long term rate, judged from the next sample on */
+        t->seeded = 1;
+        for(c = PHY_CNT_INVD_DW ; c <= PHY_CNT_DISP ; c++)
+        {
+            if(window_rate(t, c) >= PHY_TRACK_ABS_THR)
+                t->flagged = 1;
+        }
+    }
+    if(!t->flagged)
+        t->handled = 0;
+    return t->flagged;
+}
+
+int phy_track_sas(int enc_id, int phy_id, SAS_PHY_ERR_LOG *log, time_t now)
+{
+    int ret;
+    uint64_t cnt[PHY_CNT_NUM];
+
+    cnt[PHY_CNT_INVD_DW] = log->invd_dw_cnt;
+    cnt[PHY_CNT_DISP] = log->runn_disp_err_cnt;
+    cnt[PHY_CNT_LOSS_SYNC] = log->loss_dw_sync_cnt;
+    cnt[PHY_CNT_RST_PRBM] = log->phy_rst_prbm_cnt;
+    pthread_mutex_lock(&track_lock);
+    ret = add_sample(enc_id, phy_id, cnt, now);
+    pthread_mutex_unlock(&track_lock);
+    return ret;
+}
+
+/* SATA phy event counters: data FIS errors, non-data FIS errors, device to host, host to device */
+int phy_track_sata(int enc_id, int port_id, SATA_PHY_EVENT_INFO *ev, time_t now)
+{
+    int ret;
+    uint64_t cnt[PHY_CNT_NUM];
+
+    cnt[PHY_CNT_INVD_DW] = ev->data_ecnt.valid ? ev->data_ecnt.cnt : 0;
+    cnt[PHY_CNT_DISP] = ev->ndata_ecnt.valid ? ev->ndata_ecnt.cnt : 0;
+    cnt[PHY_CNT_LOSS_SYNC] = (ev->d2h_data_ecnt.valid ? ev->d2h_data_ecnt.cnt : 0) +
+                             (ev->d2h_ndata_ecnt.valid ? ev->d2h_ndata_ecnt.cnt : 0);
+    cnt[PHY_CNT_RST_PRBM] = (ev->h2d_data_ecnt.valid ? ev->h2d_data_ecnt.cnt : 0) +
+                            (ev->h2d_ndata_ecnt.valid ? ev->h2d_ndata_ecnt.cnt : 0);
+    pthread_mutex_lock(&track_lock);
+    ret = add_sample(enc_id, port_id | PHY_TRACK_SATA, cnt, now);
+    pthread_mutex_unlock(&track_lock);
+    return ret;
+}
+
+/* track_lock held */
+static void fill_rate(struct phy_track *t, struct phy_rate *rate)
+{
+    int c;
+
+    rate->enc_id = t->enc_id;
+    rate->phy_id = t->phy_id;
+    rate->flagged = t->flagged;
+    for(c = 0 ; c < PHY_CNT_NUM ; c++)
+        rate->rate[c] = window_rate(t, c);
+}
+
+int phy_track_get_rate(int enc_id, int phy_id, struct phy_rate *rate)
+{
+    struct phy_track *t;
+
+    pthread_mutex_lock(&track_lock);
+    if((t = get_track(enc_id, phy_id, 0)) == NULL)
+    {
+        pthread_mutex_unlock(&track_lock);
+        return -1;
+    }
+    fill_rate(t, rate);
+    pthread_mutex_unlock(&track_lock);
+    return 0;
+}
+
+/*
+ * Flagged phys of enc_id, every enclosure with -1.
+ * @return number of entries in rates.
+ */
+int phy_track_get_flagged(int enc_id, struct phy_rate *rates, int max)
+{
+    int i, num = 0;
+
+    pthread_mutex_lock(&track_lock);
+    for(i = 0 ; i < PHY_TRACK_MAX && num < max ; i++)
+    {
+        if(tracks[i].enc_id == -1 || !tracks[i].flagged || (enc_id != -1 && tracks[i].enc_id != enc_id))
+            continue;
+        fill_rate(&tracks[i], &rates[num++]);
+    }
+    pthread_mutex_unlock(&track_lock);
+    return num;
+}
+
+/*
+ * Hand the flagged phys of enc_id to the REXP: its error handling (default
+ * threshold, reset count and polling) is turned on when a phy is flagged, the
+ * expander decides on the links itself. A phy that comes back under the
+ * thresholds and is flagged again is reported again, and the error handling
+ * is set again then in case the expander lost it.
+ * @param[out] rates Phys flagged since the last call, at most max.
+ * @return number of entries in rates, -1 for a bad enc_id.
+ */
+int phy_track_apply(int enc_id, struct phy_rate *rates, int max)
+{
+    int i, num = 0, new_num = 0;
+    int enable;
+
+    if(enc_id < 0 || enc_id >= MAX_SE_NUM)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&track_lock);
+    for(i = 0 ; i < PHY_TRACK_MAX ; i++)
+    {
+        if(tracks[i].enc_id != enc_id || !tracks[i].flagged)
+            continue;
+        num++;
+        if(!tracks[i].handled && new_num < max)
+        {
+            tracks[i].handled = 1;
+            fill_rate(&tracks[i], &rates[new_num++]);
+        }
+    }
+    enable = num > 0 && (!applied[enc_id] || new_num > 0);
+    pthread_mutex_unlock(&track_lock);
+
+    /* the REXP setting goes out without the lock, samples keep coming in */
+    if(enable && SE_Set_REXP_Phys_Err_Handling_Of_Ports(enc_id, 1, 1, 0, 0, 0) == 0)
+    {
+        pthread_mutex_lock(&track_lock);
+        applied[enc_id] = 1;
+        pthread_mutex_unlock(&track_lock);
+    }
+    return new_num;
+}
+
+/* the enclosure is gone, drop its phys */
+void phy_track_forget(int enc_id)
+{
+    int i;
+
+    pthread_mutex_lock(&track_lock);
+    for(i = 0 ; i < PHY_TRACK_HASH_SIZE ; i++)
+        heads[i] = -1;
+    for(i = 0 ; i < PHY_TRACK_MAX ; i++)
+    {
+        uint32_t h;
+
+        if(tracks[i].enc_id == enc_id)
+            tracks[i].enc_id = -1;
+        if(tracks[i].enc_id == -1)
+            continue;
+        h = track_hash(tracks[i].enc_id, tracks[i].phy_id);
+        tracks[i].next = heads[h];
+        heads[h] = i;
+    }
+    if(enc_id >= 0 && enc_id < MAX_SE_NUM)
+        applied[enc_id] = 0;
+    pthread_mutex_unlock(&track_lock);
+}
+
+/* enclosure events carry no enc_id, drop the ones the HAL no longer has */
+static void hotplug_handler(struct uevent *ev, void *arg)
+{
+    int i, enc_id;
+    int known[MAX_SE_NUM];
+
+    (void) arg;
+    if(ev->action != UEVENT_ADD && ev->action != UEVENT_REMOVE && ev->action != UEVENT_RESYNC)
+    {
+        return;
+    }
+    memset(known, 0, sizeof(known));
+    pthread_mutex_lock(&track_lock);
+    for(i = 0 ; i < PHY_TRACK_MAX ; i++)
+    {
+        if(tracks[i].enc_id >= 0 && tracks[i].enc_id < MAX_SE_NUM)
+            known[tracks[i].enc_id] = 1;
+    }
+    pthread_mutex_unlock(&track_lock);
+    for(enc_id = 0 ; enc_id < MAX_SE_NUM ; enc_id++)
+    {
+        if(known[enc_id] && SE_Is_Exist(enc_id) != 1)
+            phy_track_forget(enc_id);
+    }
+}
+
+/*
+ * Follow enclosure add/remove events, uevent_start() (or
+ * adapter_start_discovery()) delivers them.
+ */
+int phy_track_start_hotplug()
+{
+    return uevent_register_handler("enclosure", hotplug_handler, NULL);
+}
+
+#ifdef UNIT_TEST
+/* only the flagging is tested, nothing goes out to a real enclosure */
+int SE_Set_REXP_Phys_Err_Handling_Of_Ports(IN int enc_id, IN int enable,
+    IN int def, IN uint8_t err_thr, IN uint8_t rst_cnt, IN uint8_t poll_sec)
+{
+    (void) def;
+    (void) err_thr;
+    (void) rst_cnt;
+    (void) poll_sec;
+    printf("    REXP error handling of enclosure %d: %d\n", enc_id, enable);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, t, num, new_num;
+    SAS_PHY_ERR_LOG log;
+    struct phy_rate rates[MAX_PHY_NUM_OF_REXP];
+    struct phy_rate new_rates[MAX_PHY_NUM_OF_REXP];
+
+    /* 8 phys sampled every 10 s for an hour, phy 3 has a steady trickle, phy 5 goes bad after 30 minutes */
+    memset(&log, 0, sizeof(log));
+    for(t = 10 ; t <= 3600 ; t += 10)
+    {
+        for(i = 0 ; i < 8 ; i++)
+        {
+            log.invd_dw_cnt = i == 3 ? t / 2 : 0;
+            log.runn_disp_err_cnt = i == 5 && t > 1800 ? (t - 1800) * 3 : 0;
+            phy_track_sas(0, i, &log, t);
+        }
+        if(t % 600 == 0 || t == 1830)
+        {
+            new_num = phy_track_apply(0, new_rates, MAX_PHY_NUM_OF_REXP);
+            num = phy_track_get_flagged(0, rates, MAX_PHY_NUM_OF_REXP);
+            printf("t=%d flagged=%d new=%d", t, num, new_num);
+            for(i = 0 ; i < num ; i++)
+                printf(" (phy %d, invd_dw %u/min, disp %u/min)", rates[i].phy_id, rates[i].rate[PHY_CNT_INVD_DW],
+                       rates[i].rate[PHY_CNT_DISP]);
+            printf("\n");
+        }
+    }
+    phy_track_get_rate(0, 3, &rates[0]);
+    printf("phy 3 steady: invd_dw %u/min flagged %d\n", rates[0].rate[PHY_CNT_INVD_DW], rates[0].flagged);
+    printf("table: %zu bytes for %d phys\n", sizeof(tracks), PHY_TRACK_MAX);
+    return 0;
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef _PHY_TRACK_H
+#define _PHY_TRACK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define PHY_TRACK_MAX           (MAX_SE_NUM * MAX_PHY_NUM_OF_REXP)
+#define PHY_TRACK_HASH_SIZE     4096    /* power of 2 */
+#define PHY_TRACK_SAMPLES       16      /* ring of deltas per phy, the rate window */
+#define PHY_TRACK_RATE_THR      10      /* errors per minute over the window */
+#define PHY_TRACK_JUMP          4       /* times the long term rate */
+#define PHY_TRACK_ABS_THR       120     /* errors per minute flagged whatever the long term rate */
+#define PHY_TRACK_EWMA_SHIFT    8       /* baseline weight 1/256 per sample, much slower than the window */
+
+typedef enum _PHY_CNT
+{
+    PHY_CNT_INVD_DW = 0,                /*!< SAS invalid dword, SATA data FIS errors */
+    PHY_CNT_DISP,                       /*!< SAS running disparity, SATA non-data FIS errors */
+    PHY_CNT_LOSS_SYNC,
+    PHY_CNT_RST_PRBM,
+    PHY_CNT_NUM,
+} PHY_CNT;
+
+struct phy_sample {
+    uint32_t dt;                        /*!< seconds since the previous sample */
+    uint32_t delta[PHY_CNT_NUM];
+};
+
+struct phy_track {
+    int enc_id;                         /*!< -1 for a free slot */
+    int phy_id;
+    int next;                           /*!< hash chain */
+    time_t stamp;
+    uint64_t last[PHY_CNT_NUM];         /*!< raw counters of the last sample */
+    struct phy_sample ring[PHY_TRACK_SAMPLES];
+    int head;
+    int num;
+    uint32_t win_dt;                    /*!< sums over the ring, kept as samples come and go */
+    uint64_t win_sum[PHY_CNT_NUM];
+    uint32_t base[PHY_CNT_NUM];         /*!< EWMA of the per minute rate, << PHY_TRACK_EWMA_SHIFT */
+    int seeded;                         /*!< base starts from the first full window */
+    int flagged;
+    int handled;                        /*!< phy_track_apply() reported this flagged episode */
+};
+
+struct phy_rate {
+    int enc_id;
+    int phy_id;
+    uint32_t rate[PHY_CNT_NUM];         /*!< per minute over the window */
+    int flagged;
+};
+
+int phy_track_sas(int enc_id, int phy_id, SAS_PHY_ERR_LOG *log, time_t now);
+int phy_track_sata(int enc_id, int port_id, SATA_PHY_EVENT_INFO *ev, time_t now);
+int phy_track_get_rate(int enc_id, int phy_id, struct phy_rate *rate);
+int phy_track_get_flagged(int enc_id, struct phy_rate *rates, int max);
+int phy_track_apply(int enc_id, struct phy_rate *rates, int max);
+void phy_track_forget(int enc_id);
+int phy_track_start_hotplug();
+
+#endif
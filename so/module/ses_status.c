@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <scsi/sg.h>
+
+#include "hal.h"
+#include "adapter.h"
+#include "uevent.h"
+#include "ses_status.h"
+
+/*
+ * SES status of an enclosure in one RECEIVE DIAGNOSTIC RESULTS per poll.
+ * Configuration (page 1) is read once for the element layout, every poll
+ * reads Enclosure Status (page 2) and decodes all of its elements into a
+ * snapshot. The per-element getters answer from the snapshot while it is
+ * younger than SES_STATUS_TTL_SEC, so a fan, temperature and PSU walk over an
+ * enclosure costs one command instead of one per sensor. Page 1 is read again
+ * when the generation code of page 2 no longer matches it.
+ * ses_status_hm_get_temperature() takes the HAL's enc_id and falls back to
+ * HM_Get_Temperature() when the enclosure does not answer SES, the snapshot
+ * producer of hal_snapshot.c reads every temperature through it.
+ */
+
+struct ses_slot {
+    struct ses_enc enc;
+    int used;
+    time_t failed;                      /* of the last failed read, 0 after a good one */
+    pthread_mutex_t lock;
+};
+
+static struct ses_slot slots[SES_MAX_ENC];
+static pthread_mutex_t slot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* slot locks live as long as the table, a reused slot keeps its lock */
+static void __attribute__((constructor)) ses_status_init()
+{
+    int i;
+
+    for(i = 0 ; i < SES_MAX_ENC ; i++)
+        pthread_mutex_init(&slots[i].lock, NULL);
+}
+
+static time_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint32_t get_be32(unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/* @return bytes received, -1 on failure */
+static int receive_diagnostic(const char *sg_name, unsigned char page, unsigned char *buf, int len)
+{
+    int fd;
+    char path[64];
+    unsigned char cmd[6] = {0x1c, 0x01, page, len >> 8, len, 0};
+    unsigned char sense[32];
+    sg_io_hdr_t io_hdr;
+
+    snprintf(path, sizeof(path), "/dev/%s", sg_name);
+    if((fd = open(path, O_RDWR)) < 0)
+    {
+        return -1;
+    }
+    memset(&io_hdr, 0, sizeof(sg_io_hdr_t));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = sizeof(cmd);
+    io_hdr.mx_sb_len = sizeof(sense);
+    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = len;
+    io_hdr.dxferp = buf;
+    io_hdr.cmdp = cmd;
+    io_hdr.sbp = sense;
+    io_hdr.timeout = 20000;
+    if(ioctl(fd, SG_IO, &io_hdr) < 0 || (io_hdr.info & SG_INFO_OK_MASK) != SG_INFO_OK)
+    {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    len -= io_hdr.resid;
+    if(len < 8 || buf[0] != page)
+    {
+        return -1;
+    }
+    return len;
+}
+
+/* page 1: enclosure descriptors, then the type descriptor headers in page 2 order */
+static int read_config(struct ses_enc *e, unsigned char *buf)
+{
+    int i, len, off;
+    int subenc_num, type_num = 0;
+
+    e->type_num = 0;
+    e->conf_num = 0;
+    e->elem_num = 0;
+    if((len = receive_diagnostic(e->sg_name, 0x01, buf, SES_PAGE_LEN)) < 0)
+    {
+        return -1;
+    }
+    if(len > 4 + ((buf[2] << 8) | buf[3]))
+        len = 4 + ((buf[2] << 8) | buf[3]);
+    e->gen_code = get_be32(buf + 4);
+    subenc_num = buf[1] + 1;
+    for(i = 0, off = 8 ; i < subenc_num ; i++)
+    {
+        if(off + 4 > len)
+            return -1;
+        type_num += buf[off + 2];
+        off += buf[off + 3] + 4;
+    }
+    for(i = 0 ; i < type_num && i < SES_MAX_TYPE && off + 4 <= len ; i++, off += 4)
+    {
+        e->types[i].type = buf[off];
+        e->types[i].num = buf[off + 1];
+        e->types[i].subenc_id = buf[off + 2];
+        e->conf_num += buf[off + 1];
+    }
+    e->type_num = i;
+    return 0;
+}
+
+static void decode_elem(struct ses_elem *el, unsigned char *p)
+{
+    memcpy(el->raw, p, 4);
+    el->status = p[0] & 0x0f;
+    el->fail = el->status == SES_STATUS_CRITICAL || el->status == SES_STATUS_UNRECOVERABLE;
+    el->off = 0;
+    el->value = 0;
+    switch(el->type)
+    {
+        case SES_TYPE_COOLING:
+            el->value = (((p[1] & 0x07) << 8) | p[2]) * 10;
+            el->fail = !!(p[3] & 0x40);
+            el->off = !!(p[3] & 0x10);
+            break;
+        case SES_TYPE_TEMPERATURE:
+            /* 0 is reserved, the rest is offset by 20 */
+            el->value = p[2] ? p[2] - 20 : 0;
+            break;
+        case SES_TYPE_POWER_SUPPLY:
+            el->fail = !!(p[3] & 0x40);
+            el->off = !!(p[3] & 0x10);
+            break;
+        case SES_TYPE_DEVICE_SLOT:
+        case SES_TYPE_ARRAY_DEVICE_SLOT:
+            /* FAULT SENSED, 0x20 is only the fault LED requested */
+            el->fail = !!(p[3] & 0x40);
+            el->off = !!(p[3] & 0x10);
+            break;
+        case SES_TYPE_VOLTAGE:
+            el->value = (short) ((p[2] << 8) | p[3]);
+            el->fail = !!(p[1] & 0x0f);
+            break;
+        case SES_TYPE_CURRENT:
+            el->value = (p[2] << 8) | p[3];
+            el->fail = !!(p[1] & 0x0a);
+            break;
+    }
+}
+
+/* e's lock held */
+static int read_status(struct ses_enc *e)
+{
+    int i, j, n, len, off, type_off, retry;
+    unsigned char *buf;
+
+    if((buf = (unsigned char*) malloc(SES_PAGE_LEN)) == NULL)
+    {
+        return -1;
+    }
+    for(retry = 0 ; retry < 2 ; retry++)
+    {
+        if(e->type_num == 0 && read_config(e, buf) != 0)
+            break;
+        /* one overall element per type and one per possible element, whatever the last read decoded */
+        len = 8 + 4 * (e->type_num + e->conf_num);
+        if(len > SES_PAGE_LEN)
+            len = SES_PAGE_LEN;
+        e->reads++;
+        if((len = receive_diagnostic(e->sg_name, 0x02, buf, len)) < 0)
+            break;
+        if(get_be32(buf + 4) != e->gen_code)
+        {
+            /* the configuration changed (a PSU or a fan module swapped) */
+            e->type_num = 0;
+            continue;
+        }
+        for(i = 0, n = 0, type_off = 8 ; i < e->type_num ; i++)
+        {
+            /* overall element, then the possible ones; the next type starts after all of them */
+            off = type_off + 4;
+            type_off += 4 * (1 + e->types[i].num);
+            for(j = 0 ; j < e->types[i].num ; j++, off += 4)
+            {
+                if(off + 4 > len || n == SES_MAX_ELEM)
+                    break;
+                e->elems[n].type = e->types[i].type;
+                e->elems[n].subenc_id = e->types[i].subenc_id;
+                e->elems[n].index = j;
+                decode_elem(&e->elems[n], buf + off);
+                n++;
+            }
+        }
+        e->elem_num = n;
+        e->stamp = now_sec();
+        free(buf);
+        return 0;
+    }
+    free(buf);
+    return -1;
+}
+
+static struct ses_slot *get_slot(const char *sg_name)
+{
+    int i, free_slot = -1;
+    struct ses_slot *s = NULL;
+
+    pthread_mutex_lock(&slot_lock);
+    for(i = 0 ; i < SES_MAX_ENC ; i++)
+    {
+        if(slots[i].used && !strcmp(slots[i].enc.sg_name, sg_name))
+        {
+            s = &slots[i];
+            break;
+        }
+        if(!slots[i].used && free_slot == -1)
+            free_slot = i;
+    }
+    if(s == NULL && free_slot != -1)
+    {
+        s = &slots[free_slot];
+        pthread_mutex_lock(&s->lock);
+        memset(&s->enc, 0, sizeof(s->enc));
+        snprintf(s->enc.sg_name, sizeof(s->enc.sg_name), "%s", sg_name);
+        s->failed = 0;
+        s->used = 1;
+        pthread_mutex_unlock(&s->lock);
+    }
+    pthread_mutex_unlock(&slot_lock);
+    return s;
+}
+
+/*
+ * The slot of sg_name with its lock held. The slot may be forgotten or given
+ * to another name between get_slot() and the lock, it is looked up again then.
+ */
+static struct ses_slot *lock_slot(const char *sg_name)
+{
+    int i;
+    struct ses_slot *s;
+
+    for(i = 0 ; i < 3 ; i++)
+    {
+        if((s = get_slot(sg_name)) == NULL)
+        {
+            return NULL;
+        }
+        pthread_mutex_lock(&s->lock);
+        if(s->used && !strcmp(s->enc.sg_name, sg_name))
+        {
+            return s;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Lock the slot of sg_name with a snapshot younger than SES_STATUS_TTL_SEC,
+ * reading page 2 when it is older. A failed read is not repeated for
+ * SES_STATUS_FAIL_SEC, so the HAL fallback of a non SES enclosure stays cheap.
+ */
+static struct ses_slot *lock_fresh(const char *sg_name)
+{
+    struct ses_slot *s;
+
+    if((s = lock_slot(sg_name)) == NULL)
+    {
+        return NULL;
+    }
+    if(s->enc.stamp == 0 || now_sec() - s->enc.stamp >= SES_STATUS_TTL_SEC)
+    {
+        if(s->failed && now_sec() - s->failed < SES_STATUS_FAIL_SEC)
+        {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        if(read_status(&s->enc) != 0)
+        {
+            s->failed = now_sec();
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        s->failed = 0;
+    }
+    return s;
+}
+
+/* read page 2 now, whatever the age of the snapshot */
+int ses_status_refresh(const char *sg_name)
+{
+    int ret;
+    struct ses_slot *s;
+
+    if((s = lock_slot(sg_name)) == NULL)
+    {
+        return -1;
+    }
+    ret = read_status(&s->enc);
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+/* s->lock held */
+static struct ses_elem *find_elem(struct ses_enc *e, SES_ELEM_TYPE type, int index)
+{
+    int i;
+
+    for(i = 0 ; i < e->elem_num ; i++)
+    {
+        if(e->elems[i].type == type && index-- == 0)
+            return &e->elems[i];
+    }
+    return NULL;
+}
+
+/* @return number of elements of type, -1 when the enclosure does not answer */
+int ses_status_get_num(const char *sg_name, SES_ELEM_TYPE type)
+{
+    int i, num = 0;
+    struct ses_slot *s;
+
+    if((s = lock_fresh(sg_name)) == NULL)
+    {
+        return -1;
+    }
+    for(i = 0 ; i < s->enc.elem_num ; i++)
+    {
+        if(s->enc.elems[i].type == type)
+            num++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return num;
+}
+
+/*
+ * index counts the elements of type over all subenclosures, 0 based.
+ * @retval 0 Success.
+ * @retval -1 The enclosure does not answer or has no such element.
+ */
+int ses_status_get_elem(const char *sg_name, SES_ELEM_TYPE type, int index, struct ses_elem *elem)
+{
+    int ret = -1;
+    struct ses_elem *el;
+    struct ses_slot *s;
+
+    if((s = lock_fresh(sg_name)) == NULL)
+    {
+        return -1;
+    }
+    if((el = find_elem(&s->enc, type, index)) != NULL)
+    {
+        *elem = *el;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+int ses_status_get_fan(const char *sg_name, int index, unsigned int *rpmP, unsigned int *failP)
+{
+    struct ses_elem el;
+
+    if(ses_status_get_elem(sg_name, SES_TYPE_COOLING, index, &el) != 0)
+    {
+        return -1;
+    }
+    *rpmP = el.value;
+    *failP = el.fail;
+    return 0;
+}
+
+int ses_status_get_temp(const char *sg_name, int index, int *tempP)
+{
+    struct ses_elem el;
+
+    if(ses_status_get_elem(sg_name, SES_TYPE_TEMPERATURE, index, &el) != 0 || el.raw[2] == 0)
+    {
+        return -1;
+    }
+    *tempP = el.value;
+    return 0;
+}
+
+int ses_status_get_psu(const char *sg_name, int index, unsigned int *failP)
+{
+    struct ses_elem el;
+
+    if(ses_status_get_elem(sg_name, SES_TYPE_POWER_SUPPLY, index, &el) != 0)
+    {
+        return -1;
+    }
+    *failP = el.fail || el.status == SES_STATUS_NOT_INSTALLED;
+    return 0;
+}
+
+/* array device slots, or plain device slots when the enclosure has none */
+int ses_status_get_slot(const char *sg_name, int index, int *installedP, int *offP)
+{
+    struct ses_elem el;
+
+    if(ses_status_get_elem(sg_name, SES_TYPE_ARRAY_DEVICE_SLOT, index, &el) != 0 &&
+       ses_status_get_elem(sg_name, SES_TYPE_DEVICE_SLOT, index, &el) != 0)
+    {
+        return -1;
+    }
+    *installedP = el.status != SES_STATUS_NOT_INSTALLED && el.status != SES_STATUS_UNSUPPORTED;
+    *offP = el.off;
+    return 0;
+}
+
+int ses_status_get_snapshot(const char *sg_name, struct ses_enc *enc)
+{
+    struct ses_slot *s;
+
+    if((s = lock_fresh(sg_name)) == NULL)
+    {
+        return -1;
+    }
+    *enc = s->enc;
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/* the enclosure is gone, its layout is read again if the name comes back; NULL forgets every one */
+void ses_status_forget(const char *sg_name)
+{
+    int i;
+
+    pthread_mutex_lock(&slot_lock);
+    for(i = 0 ; i < SES_MAX_ENC ; i++)
+    {
+        if(slots[i].used && (sg_name == NULL || !strcmp(slots[i].enc.sg_name, sg_name)))
+        {
+            pthread_mutex_lock(&slots[i].lock);
+            slots[i].used = 0;
+            pthread_mutex_unlock(&slots[i].lock);
+        }
+    }
+    pthread_mutex_unlock(&slot_lock);
+}
+
+static void hotplug_handler(struct uevent *ev, void *arg)
+{
+    (void) arg;
+    if(ev->action == UEVENT_RESYNC)
+        ses_status_forget(NULL);
+    else if((ev->action == UEVENT_ADD || ev->action == UEVENT_REMOVE) && ev->devname[0])
+        ses_status_forget(ev->devname);
+}
+
+/*
+ * Follow scsi_generic add/remove events, a node that comes back may be
+ * another enclosure. adapter_start_discovery() registers it.
+ */
+int ses_status_start_hotplug()
+{
+    return uevent_register_handler("scsi_generic", hotplug_handler, NULL);
+}
+
+static int get_sg_name(int enc_id, char *sg_name, int buf_len)
+{
+    if(se_lookup_sys_id(enc_id, sg_name, buf_len) != 0 || strncmp(sg_name, "sg", 2))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/* TEMP_SYSTEM1.. are the temperature elements in page 2 order */
+int ses_status_hm_get_temperature(int enc_id, TEMP_INDEX temp_index, double *dValueP)
+{
+    int temp;
+    char sg_name[32];
+
+    if(temp_index >= TEMP_SYSTEM1 && temp_index <= TEMP_SYSTEM4 && get_sg_name(enc_id, sg_name, sizeof(sg_name)) == 0 &&
+       ses_status_get_num(sg_name, SES_TYPE_TEMPERATURE) >= 0)
+    {
+        if(ses_status_get_temp(sg_name, temp_index - TEMP_SYSTEM1, &temp) != 0)
+            return -1;
+        *dValueP = temp;
+        return 0;
+    }
+    return HM_Get_Temperature(enc_id, temp_index, dValueP);
+}
@@ -0,0 +1,85 @@
+#ifndef _SES_STATUS_H
+#define _SES_STATUS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define SES_MAX_ENC             24      /* MAX_SE_NUM */
+#define SES_MAX_TYPE            64      /* type descriptor headers of page 1 */
+#define SES_MAX_ELEM            512
+#define SES_PAGE_LEN            65532
+#define SES_STATUS_TTL_SEC      2       /* getters within this reuse the last page 2 */
+#define SES_STATUS_FAIL_SEC     30      /* a name that is no SES device is not asked again before this */
+
+typedef enum _SES_ELEM_TYPE
+{
+    SES_TYPE_DEVICE_SLOT = 0x01,
+    SES_TYPE_POWER_SUPPLY = 0x02,
+    SES_TYPE_COOLING = 0x03,
+    SES_TYPE_TEMPERATURE = 0x04,
+    SES_TYPE_ENCLOSURE = 0x0e,
+    SES_TYPE_VOLTAGE = 0x12,
+    SES_TYPE_CURRENT = 0x13,
+    SES_TYPE_ARRAY_DEVICE_SLOT = 0x17,
+} SES_ELEM_TYPE;
+
+typedef enum _SES_ELEM_STATUS
+{
+    SES_STATUS_UNSUPPORTED = 0,
+    SES_STATUS_OK,
+    SES_STATUS_CRITICAL,
+    SES_STATUS_NONCRITICAL,
+    SES_STATUS_UNRECOVERABLE,
+    SES_STATUS_NOT_INSTALLED,
+    SES_STATUS_UNKNOWN,
+    SES_STATUS_NOT_AVAILABLE,
+    SES_STATUS_NO_ACCESS,
+} SES_ELEM_STATUS;
+
+/*
+ * One element of page 2, decoded by its type.
+ */
+struct ses_elem {
+    uint8_t type;                       /*!< SES_ELEM_TYPE */
+    uint8_t subenc_id;
+    uint16_t index;                     /*!< 0 based within the type */
+    uint8_t status;                     /*!< SES_ELEM_STATUS */
+    uint8_t fail;
+    uint8_t off;                        /*!< power supply or device slot turned off */
+    int value;                          /*!< cooling rpm, temperature Celsius, voltage 10 mV, current 10 mA */
+    uint8_t raw[4];
+};
+
+struct ses_type {
+    uint8_t type;
+    uint8_t num;                        /*!< number of possible elements */
+    uint8_t subenc_id;
+};
+
+struct ses_enc {
+    char sg_name[32];                   /*!< "sg5" */
+    uint32_t gen_code;                  /*!< of page 1, page 2 must carry the same */
+    int type_num;
+    struct ses_type types[SES_MAX_TYPE];
+    int conf_num;                       /*!< possible elements of page 1, sizes the page 2 read */
+    int elem_num;                       /*!< elements decoded from the last page 2 */
+    struct ses_elem elems[SES_MAX_ELEM];
+    time_t stamp;                       /*!< CLOCK_MONOTONIC seconds of elems */
+    unsigned long reads;                /*!< page 2 commands sent */
+};
+
+int ses_status_refresh(const char *sg_name);
+int ses_status_get_num(const char *sg_name, SES_ELEM_TYPE type);
+int ses_status_get_elem(const char *sg_name, SES_ELEM_TYPE type, int index, struct ses_elem *elem);
+int ses_status_get_fan(const char *sg_name, int index, unsigned int *rpmP, unsigned int *failP);
+int ses_status_get_temp(const char *sg_name, int index, int *tempP);
+int ses_status_get_psu(const char *sg_name, int index, unsigned int *failP);
+int ses_status_get_slot(const char *sg_name, int index, int *installedP, int *offP);
+int ses_status_get_snapshot(const char *sg_name, struct ses_enc *enc);
+void ses_status_forget(const char *sg_name);
+int ses_status_start_hotplug();
+
+/* HM_Get_Temperature() answered from the snapshot of an SES enclosure, the HAL call otherwise */
+int ses_status_hm_get_temperature(int enc_id, TEMP_INDEX temp_index, double *dValueP);
+
+#endif
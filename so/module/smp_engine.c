@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/bsg.h>
+#include <scsi/sg.h>
+
+#include "hal.h"
+#include "smp_engine.h"
+
+/*
+ * SMP requests through the bsg node of an expander.
+ * smp_collect() reads REPORT PHY ERROR LOG (and DISCOVER) of every phy of
+ * every given expander with a shared pool of workers. The work list
+ * interleaves the expanders, so each one has about SMP_DEPTH requests in
+ * flight and a slow expander does not hold back the others.
+ */
+
+#define SMP_FRAME_REQUEST       0x40
+#define SMP_FRAME_RESPONSE      0x41
+#define SMP_REPORT_GENERAL      0x00
+#define SMP_DISCOVER            0x10
+#define SMP_REPORT_PHY_ERR_LOG  0x11
+
+static uint32_t get_be32(unsigned char *p)
+{
+    return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t get_be64(unsigned char *p)
+{
+    return ((uint64_t) get_be32(p) << 32) | get_be32(p + 4);
+}
+
+/*
+ * One SMP function, req and resp include the 4 CRC bytes the HBA fills in.
+ * @retval 0 Success.
+ * @retval -1 SG_IO failed or the transport reported an error.
+ * @retval -2 The expander answered with a function result other than accepted.
+ */
+static int smp_send(int fd, unsigned char *req, int req_len, unsigned char *resp, int resp_len)
+{
+    unsigned char cmd[16];
+    struct sg_io_v4 hdr;
+
+    memset(cmd, 0, sizeof(cmd));
+    memset(resp, 0, resp_len);
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.guard = 'Q';
+    hdr.protocol = BSG_PROTOCOL_SCSI;
+    hdr.subprotocol = BSG_SUB_PROTOCOL_SCSI_TRANSPORT;
+    hdr.request_len = sizeof(cmd);
+    hdr.request = (uintptr_t) cmd;
+    hdr.dout_xfer_len = req_len;
+    hdr.dout_xferp = (uintptr_t) req;
+    hdr.din_xfer_len = resp_len;
+    hdr.din_xferp = (uintptr_t) resp;
+    hdr.timeout = SMP_TIMEOUT;
+    if(ioctl(fd, SG_IO, &hdr) < 0 || hdr.transport_status || hdr.device_status || hdr.driver_status)
+    {
+        return -1;
+    }
+    if(resp[0] != SMP_FRAME_RESPONSE || resp[1] != req[1])
+    {
+        return -1;
+    }
+    return resp[2] == 0 ? 0 : -2;
+}
+
+int smp_report_general(int fd, int *phy_numP)
+{
+    int ret;
+    unsigned char req[8] = {SMP_FRAME_REQUEST, SMP_REPORT_GENERAL, 0, 0};
+    unsigned char resp[64];
+
+    if((ret = smp_send(fd, req, sizeof(req), resp, sizeof(resp))) != 0)
+    {
+        return ret;
+    }
+    *phy_numP = resp[9];
+    return 0;
+}
+
+int smp_report_phy_err_log(int fd, int phy_id, SAS_PHY_ERR_LOG *log)
+{
+    int ret;
+    unsigned char req[16] = {SMP_FRAME_REQUEST, SMP_REPORT_PHY_ERR_LOG, 0, 0};
+    unsigned char resp[32];
+
+    req[9] = phy_id;
+    if((ret = smp_send(fd, req, sizeof(req), resp, sizeof(resp))) != 0)
+    {
+        return ret;
+    }
+    log->invd_dw_cnt = get_be32(resp + 12);
+    log->runn_disp_err_cnt = get_be32(resp + 16);
+    log->loss_dw_sync_cnt = get_be32(resp + 20);
+    log->phy_rst_prbm_cnt = get_be32(resp + 24);
+    return 0;
+}
+
+int smp_discover(int fd, int phy_id, struct smp_disc *disc)
+{
+    int ret;
+    unsigned char req[16] = {SMP_FRAME_REQUEST, SMP_DISCOVER, 0, 0};
+    unsigned char resp[124];
+
+    req[9] = phy_id;
+    if((ret = smp_send(fd, req, sizeof(req), resp, sizeof(resp))) != 0)
+    {
+        return ret;
+    }
+    disc->att_dev_type = (resp[12] >> 4) & 0x07;
+    disc->link_rate = resp[13] & 0x0f;
+    disc->att_sas_addr = get_be64(resp + 24);
+    disc->sas_addr = get_be64(resp + 16);
+    disc->att_phy_id = resp[32];
+    disc->change_cnt = resp[42];
+    return 0;
+}
+
+struct smp_work {
+    struct smp_exp *exps;
+    int *fds;
+    int num;                            /* expanders */
+    int max_phy;
+    int discover;
+    int next;
+    pthread_mutex_t lock;               /* for the valid bitmaps */
+};
+
+static void *smp_worker(void *arg)
+{
+    int i, e, phy;
+    struct smp_work *work = (struct smp_work*) arg;
+
+    while((i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->num * work->max_phy)
+    {
+        struct smp_exp *exp;
+
+        e = i % work->num;
+        phy = i / work->num;
+        exp = &work->exps[e];
+        if(work->fds[e] < 0 || phy >= exp->phy_num)
+            continue;
+        if(smp_report_phy_err_log(work->fds[e], phy, &exp->err_log[phy]) != 0)
+            continue;
+        if(work->discover && smp_discover(work->fds[e], phy, &exp->disc[phy]) != 0)
+            continue;
+        pthread_mutex_lock(&work->lock);
+        exp->valid |= 1ULL << phy;
+        pthread_mutex_unlock(&work->lock);
+    }
+    return NULL;
+}
+
+/*
+ * Sample every phy of num expanders, DISCOVER too when discover is set.
+ * exps[].bsg_name is the input, everything else is filled.
+ * @return number of expanders that answered.
+ */
+int smp_collect(struct smp_exp *exps, int num, int discover)
+{
+    int i, answered = 0;
+    int thread_num;
+    int fds[MAX_SE_NUM];
+    char path[96];
+    pthread_t tids[SMP_MAX_THREADS];
+    struct smp_work work;
+
+    if(num > MAX_SE_NUM)
+        num = MAX_SE_NUM;
+    memset(&work, 0, sizeof(work));
+    work.exps = exps;
+    work.fds = fds;
+    work.num = num;
+    work.discover = discover;
+    pthread_mutex_init(&work.lock, NULL);
+    for(i = 0 ; i < num ; i++)
+    {
+        struct smp_exp *exp = &exps[i];
+
+        exp->phy_num = 0;
+        exp->valid = 0;
+        exp->ret = -1;
+        memset(exp->err_log, 0, sizeof(exp->err_log));
+        memset(exp->disc, 0, sizeof(exp->disc));
+        if(strchr(exp->bsg_name, '/'))
+            snprintf(path, sizeof(path), "%s", exp->bsg_name);
+        else
+            snprintf(path, sizeof(path), "/dev/bsg/%s", exp->bsg_name);
+        if((fds[i] = open(path, O_RDWR)) < 0)
+            continue;
+        if(smp_report_general(fds[i], &exp->phy_num) != 0)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+            continue;
+        }
+        if(exp->phy_num > MAX_PHY_NUM_OF_REXP)
+            exp->phy_num = MAX_PHY_NUM_OF_REXP;
+        if(exp->phy_num > work.max_phy)
+            work.max_phy = exp->phy_num;
+        exp->ret = 0;
+        answered++;
+    }
+
+    thread_num = num * SMP_DEPTH - 1;
+    if(thread_num > SMP_MAX_THREADS)
+        thread_num = SMP_MAX_THREADS;
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        if(pthread_create(&tids[i], NULL, smp_worker, &work) != 0)
+            break;
+    }
+    thread_num = i;
+    smp_worker(&work);
+    for(i = 0 ; i < thread_num ; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+
+    for(i = 0 ; i < num ; i++)
+    {
+        if(fds[i] >= 0)
+            close(fds[i]);
+    }
+    pthread_mutex_destroy(&work.lock);
+    return answered;
+}
+
+#ifdef UNIT_TEST
+int main(int argc, char *argv[])
+{
+    int i, j, num;
+    int id_ary[MAX_SE_NUM];
+    static struct smp_exp exps[MAX_SE_NUM];
+    static ENCLOSURE_INFO info;
+
+    /* smp_engine [expander-6:0 ...], the bsg names of the HAL enclosures by default */
+    if(argc > 1)
+    {
+        for(num = 0 ; num < argc - 1 && num < MAX_SE_NUM ; num++)
+            snprintf(exps[num].bsg_name, sizeof(exps[num].bsg_name), "%s", argv[num + 1]);
+    }
+    else
+    {
+        int enc_num = SE_Enumerate(id_ary, MAX_SE_NUM, NULL, NULL);
+        for(i = 0, num = 0 ; i < enc_num && i < MAX_SE_NUM ; i++)
+        {
+            memset(&info, 0, sizeof(info));
+            if(SE_Get_Info(id_ary[i], &info) < 0 || info.exp_ext_info.bsg_name[0] == '\0')
+                continue;
+            snprintf(exps[num].bsg_name, sizeof(exps[num].bsg_name), "%s", info.exp_ext_info.bsg_name);
+            num++;
+        }
+    }
+    printf("answered: %d\n", smp_collect(exps, num, 1));
+    for(i = 0 ; i < num ; i++)
+    {
+        printf("(bsg, phy_num, ret) = (%s, %d, %d)\n", exps[i].bsg_name, exps[i].phy_num, exps[i].ret);
+        for(j = 0 ; j < exps[i].phy_num ; j++)
+        {
+            if(!(exps[i].valid & (1ULL << j)))
+                continue;
+            printf("    (phy, invd_dw, disp, loss_sync, rst_prbm, att_addr, rate) = (%d, %u, %u, %u, %u, %016llx, %x)\n", j,
+                   exps[i].err_log[j].invd_dw_cnt, exps[i].err_log[j].runn_disp_err_cnt,
+                   exps[i].err_log[j].loss_dw_sync_cnt, exps[i].err_log[j].phy_rst_prbm_cnt,
+                   (unsigned long long) exps[i].disc[j].att_sas_addr, exps[i].disc[j].link_rate);
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,36 @@
+#ifndef _SMP_ENGINE_H
+#define _SMP_ENGINE_H
+
+#include <stdint.h>
+
+#define SMP_DEPTH               4       /* requests in flight per expander */
+#define SMP_MAX_THREADS         32
+#define SMP_TIMEOUT             5000    /* ms */
+
+/*
+ * DISCOVER response fields the phy health checks use.
+ */
+struct smp_disc {
+    uint64_t sas_addr;
+    uint64_t att_sas_addr;
+    uint8_t att_phy_id;
+    uint8_t att_dev_type;               /*!< 0 none, 1 end device, 2 expander, 3 fanout expander */
+    uint8_t link_rate;                  /*!< negotiated logical link rate, 0x8 1.5G ... 0xb 12G */
+    uint8_t change_cnt;                 /*!< phy change count */
+};
+
+struct smp_exp {
+    char bsg_name[64];                  /*!< EXP_EXT_INFO.bsg_name, "expander-6:0" or a /dev path */
+    int phy_num;                        /*!< from REPORT GENERAL, at most MAX_PHY_NUM_OF_REXP */
+    uint64_t valid;                     /*!< bitmap of the phys that answered */
+    SAS_PHY_ERR_LOG err_log[MAX_PHY_NUM_OF_REXP];
+    struct smp_disc disc[MAX_PHY_NUM_OF_REXP];
+    int ret;                            /*!< 0, or -1 when the expander did not answer at all */
+};
+
+int smp_report_general(int fd, int *phy_numP);
+int smp_report_phy_err_log(int fd, int phy_id, SAS_PHY_ERR_LOG *log);
+int smp_discover(int fd, int phy_id, struct smp_disc *disc);
+int smp_collect(struct smp_exp *exps, int num, int discover);
+
+#endif
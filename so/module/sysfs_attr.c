@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "sysfs_attr.h"
+
+/*
+ * Strip leading/trailing whitespace and the trailing newline in place.
+ * @return buf
+ */
+char *sysfs_strip(char *buf)
+{
+    int len = strlen(buf);
+    int s = 0;
+
+    while(len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' ' || buf[len - 1] == '\t'))
+    {
+        buf[--len] = '\0';
+    }
+    while(buf[s] == ' ' || buf[s] == '\t')
+    {
+        s++;
+    }
+    if(s > 0)
+    {
+        memmove(buf, buf + s, len - s + 1);
+    }
+    return buf;
+}
+
+static int sysfs_pread(int fd, char *buf, int buf_len)
+{
+    int ret;
+
+    if(buf_len <= 0)
+    {
+        return -1;
+    }
+    do
+    {
+        ret = pread(fd, buf, buf_len - 1, 0);
+    } while(ret < 0 && errno == EINTR);
+    if(ret < 0)
+    {
+        buf[0] = '\0';
+        return -1;
+    }
+    buf[ret] = '\0';
+    sysfs_strip(buf);
+    return 0;
+}
+
+/* base 10 for the decimal attributes, "08" is 8; base 16 for idVendor style ones, "0x" optional */
+static int sysfs_parse_int(char *buf, long *val, int base)
+{
+    char *end;
+
+    errno = 0;
+    *val = strtol(buf, &end, base);
+    if(errno != 0 || end == buf)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read a sysfs attribute with a single open/pread/close, no shell.
+ * @retval 0 Success, buf holds the stripped value.
+ * @retval -1 The attribute can not be read, buf is empty.
+ */
+int sysfs_attr_read(const char *path, char *buf, int buf_len)
+{
+    int fd;
+    int ret;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        if(buf_len > 0)
+        {
+            buf[0] = '\0';
+        }
+        return -1;
+    }
+    ret = sysfs_pread(fd, buf, buf_len);
+    close(fd);
+    return ret;
+}
+
+int sysfs_attr_read_int(const char *path, long *val)
+{
+    char buf[64];
+
+    if(sysfs_attr_read(path, buf, sizeof(buf)) < 0)
+    {
+        return -1;
+    }
+    return sysfs_parse_int(buf, val, 10);
+}
+
+/* a hex attribute ("0bda", "0x8086") */
+int sysfs_attr_read_hex(const char *path, long *val)
+{
+    char buf[64];
+
+    if(sysfs_attr_read(path, buf, sizeof(buf)) < 0)
+    {
+        return -1;
+    }
+    return sysfs_parse_int(buf, val, 16);
+}
+
+/*
+ * sysfs_attr_read() with a printf style path.
+ */
+int sysfs_attr_readf(char *buf, int buf_len, const char *fmt, ...)
+{
+    char path[SYSFS_ATTR_PATH_LEN];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(path, sizeof(path), fmt, ap);
+    va_end(ap);
+    return sysfs_attr_read(path, buf, buf_len);
+}
+
+int sysfs_attr_open(struct sysfs_attr *attr, const char *path)
+{
+    snprintf(attr->path, sizeof(attr->path), "%s", path);
+    attr->fd = open(path, O_RDONLY | O_CLOEXEC);
+    return attr->fd < 0 ? -1 : 0;
+}
+
+int sysfs_attr_reread(struct sysfs_attr *attr, char *buf, int buf_len)
+{
+    if(attr->fd < 0)
+    {
+        return sysfs_attr_read(attr->path, buf, buf_len);
+    }
+    return sysfs_pread(attr->fd, buf, buf_len);
+}
+
+int sysfs_attr_reread_int(struct sysfs_attr *attr, long *val)
+{
+    char buf[64];
+
+    if(sysfs_attr_reread(attr, buf, sizeof(buf)) < 0)
+    {
+        return -1;
+    }
+    return sysfs_parse_int(buf, val, 10);
+}
+
+void sysfs_attr_close(struct sysfs_attr *attr)
+{
+    if(attr->fd >= 0)
+    {
+        close(attr->fd);
+    }
+    attr->fd = -1;
+}
+
+#ifdef UNIT_TEST
+#include <time.h>
+
+int main(int argc, char *argv[])
+{
+    int i;
+    int ret;
+    long val = 0;
+    char buf[256];
+    struct timespec t0, t1;
+    struct sysfs_attr attr;
+
+    if(argc < 2)
+    {
+        printf("usage: %s <sysfs attribute>\n", argv[0]);
+        return 1;
+    }
+    ret = sysfs_attr_read(argv[1], buf, sizeof(buf));
+    printf("(ret, buf) = (%d, %s)\n", ret, buf);
+    ret = sysfs_attr_read_int(argv[1], &val);
+    printf("(ret, int) = (%d, %ld)\n", ret, val);
+    ret = sysfs_attr_read_hex(argv[1], &val);
+    printf("(ret, hex) = (%d, %ld)\n", ret, val);
+
+    sysfs_attr_open(&attr, argv[1]);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(i = 0 ; i < 1000 ; i++)
+    {
+        sysfs_attr_reread(&attr, buf, sizeof(buf));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sysfs_attr_close(&attr);
+    printf("reread: %ld ns/read\n", ((t1.tv_sec - t0.tv_sec) * 1000000000L + t1.tv_nsec - t0.tv_nsec) / 1000);
+    return 0;
+}
+#endif
@@ -0,0 +1,26 @@
+#ifndef _SYSFS_ATTR_H
+#define _SYSFS_ATTR_H
+
+#define SYSFS_ATTR_PATH_LEN 256
+
+/*
+ * A sysfs attribute kept open, sysfs regenerates the value on every
+ * read at offset 0 so it can be re-read without reopening.
+ */
+struct sysfs_attr {
+    char path[SYSFS_ATTR_PATH_LEN];
+    int fd;
+};
+
+char *sysfs_strip(char *buf);
+int sysfs_attr_read(const char *path, char *buf, int buf_len);
+int sysfs_attr_read_int(const char *path, long *val);
+int sysfs_attr_read_hex(const char *path, long *val);
+int sysfs_attr_readf(char *buf, int buf_len, const char *fmt, ...);
+
+int sysfs_attr_open(struct sysfs_attr *attr, const char *path);
+int sysfs_attr_reread(struct sysfs_attr *attr, char *buf, int buf_len);
+int sysfs_attr_reread_int(struct sysfs_attr *attr, long *val);
+void sysfs_attr_close(struct sysfs_attr *attr);
+
+#endif
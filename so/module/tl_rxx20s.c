@@ -1,6 +1,11 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "hal.h"
+#include "adapter.h"
+#include "ses_status.h"
 
-int find_module_by_enc_sysid(char *enc_sys_id)
+MODULE_API int find_module_by_enc_sysid(char *enc_sys_id)
 {
     int ret;
     ret = comm_sys_check_is_sas_expander(enc_sys_id);
@@ -10,32 +15,112 @@ int find_module_by_enc_sysid(char *enc_sys_id)
 
 
 /*
- * @param enc_sys_id system dependent enclosure identifier. (ex: sg5)
+ * Sensor counts from one SES snapshot, page 2 is read at most once per
+ * SES_STATUS_TTL_SEC however often the enclosure info is asked for; the
+ * fan/temperature/PSU getters that follow in the same poll share it.
  */
-int get_enc_info(char *enc_sys_id, ENCLOSURE_INFO *enc_info)
+static void fill_ses_status(struct ses_enc *enc, ENCLOSURE_INFO *enc_info)
+{
+    int i;
+    int fan = 0, temp = 0, slot = 0, array_slot = 0;
+
+    for(i = 0 ; i < enc->elem_num ; i++)
+    {
+        switch(enc->elems[i].type)
+        {
+            case SES_TYPE_COOLING:
+                fan++;
+                break;
+            case SES_TYPE_TEMPERATURE:
+                temp++;
+                break;
+            case SES_TYPE_DEVICE_SLOT:
+                slot++;
+                break;
+            case SES_TYPE_ARRAY_DEVICE_SLOT:
+                array_slot++;
+                break;
+        }
+    }
+    if(fan > 0)
+        enc_info->max_fan_num = fan;
+    if(temp > 0)
+        enc_info->max_temp_num = temp;
+    if(array_slot > 0 || slot > 0)
+        enc_info->max_disk_num = array_slot > 0 ? array_slot : slot;
+}
+
+/* enc is scratch space for the snapshot */
+static int get_enc_info_ses(char *enc_sys_id, ENCLOSURE_INFO *enc_info, struct ses_enc *enc)
 {
     int ret;
-    printf("Hello World\n");
+
     ret = sas_expander_getinfo(enc_sys_id, enc_info);
     printf("(func, enc_sys_id, ret) = (%s, %s, %d)\n", __func__, enc_sys_id, ret);
+    if(ret == 0 && enc != NULL && ses_status_get_snapshot(enc_sys_id, enc) == 0)
+    {
+        fill_ses_status(enc, enc_info);
+    }
+    return ret;
+}
+
+/*
+ * @param enc_sys_id system dependent enclosure identifier. (ex: sg5)
+ */
+MODULE_API int get_enc_info(char *enc_sys_id, ENCLOSURE_INFO *enc_info)
+{
+    int ret;
+    struct ses_enc *enc = malloc(sizeof(struct ses_enc));
+
+    printf("Hello World\n");
+    ret = get_enc_info_ses(enc_sys_id, enc_info, enc);
+    free(enc);
     return ret;
 }
 
-int write_enc_conf(int enc_id, ENCLOSURE_INFO *enc_info)
+/*
+ * Every enclosure of the group with one SES snapshot (one page 2 read at
+ * most) for its sensor counts, an enclosure listed twice is read once.
+ */
+MODULE_API int mod_get_enc_info_batch(char *enc_sys_ids[], int count, ENCLOSURE_INFO *enc_infos[], int rets[])
+{
+    int i, j;
+    struct ses_enc *enc = malloc(sizeof(struct ses_enc));
+
+    for(i = 0 ; i < count ; i++)
+    {
+        for(j = 0 ; j < i ; j++)
+        {
+            if(!strcmp(enc_sys_ids[i], enc_sys_ids[j]))
+                break;
+        }
+        if(j < i)
+        {
+            *enc_infos[i] = *enc_infos[j];
+            rets[i] = rets[j];
+            continue;
+        }
+        rets[i] = get_enc_info_ses(enc_sys_ids[i], enc_infos[i], enc);
+    }
+    free(enc);
+    return 0;
+}
+
+MODULE_API int write_enc_conf(int enc_id, ENCLOSURE_INFO *enc_info)
 {
     int ret = -1;
     printf("(func, enc_id, ret) = (%s, %d, %d)\n", __func__, enc_id, ret);
     return ret;
 }
 
-int pd_scan(int enc_id)
+MODULE_API int pd_scan(int enc_id)
 {
     int ret = -1;
     printf("(func, enc_id, ret) = (%s, %d, %d)\n", __func__, enc_id, ret);
     return ret;
 }
 
-int se_attach_specific(char *enc_sys_id, int enc_id)
+MODULE_API int se_attach_specific(char *enc_sys_id, int enc_id)
 {
     int ret = -1;
     ret = se_sys_set_7_segment_led(enc_sys_id, enc_id); 
@@ -43,6 +128,20 @@ int se_attach_specific(char *enc_sys_id, int enc_id)
     return 0;
 }
 
+#ifdef STATIC_MODULES
+static struct module_ops tl_rxx20s_ops = {
+    "tl_rxx20s",
+    find_module_by_enc_sysid,
+    get_enc_info,
+    write_enc_conf,
+    pd_scan,
+    se_attach_specific,
+    mod_get_enc_info_batch,
+};
+
+ADAPTER_MODULE(tl_rxx20s_ops)
+#endif
+
 #ifdef UNIT_TEST
 void test_tl_r20xxs(char *enc_sys_id)
 {
@@ -51,9 +150,29 @@ void test_tl_r20xxs(char *enc_sys_id)
     se_sys_getinfo(enc_sys_id);
 }
 
+void test_ses_status(char *enc_sys_id)
+{
+    int i, num, temp, installed, off;
+    unsigned int rpm, fail;
+
+    for(i = 0 ; ses_status_get_fan(enc_sys_id, i, &rpm, &fail) == 0 ; i++)
+        printf("(fan, rpm, fail) = (%d, %u, %u)\n", i, rpm, fail);
+    num = ses_status_get_num(enc_sys_id, SES_TYPE_TEMPERATURE);
+    for(i = 0 ; i < num ; i++)
+    {
+        if(ses_status_get_temp(enc_sys_id, i, &temp) == 0)
+            printf("(temp, celsius) = (%d, %d)\n", i, temp);
+    }
+    for(i = 0 ; ses_status_get_psu(enc_sys_id, i, &fail) == 0 ; i++)
+        printf("(psu, fail) = (%d, %u)\n", i, fail);
+    for(i = 0 ; ses_status_get_slot(enc_sys_id, i, &installed, &off) == 0 ; i++)
+        printf("(slot, installed, off) = (%d, %d, %d)\n", i, installed, off);
+}
+
 int main(int argc, char *argv[])
 {
     test_tl_r20xxs(argv[1]);
+    test_ses_status(argv[1]);
 }
 
 #endif
@@ -1,4 +1,7 @@
 #include "tr.h"
+#include "adapter.h"
+#include "sysfs_attr.h"
+#include "usb_topo.h"
 
 void str_strip(char *buf)
 {
@@ -16,77 +19,24 @@ void str_strip(char *buf)
     
 }
 
-int hal_popen(char *cmd, char *buf)
-{
-    FILE *fp = NULL;
-    char buf1[MAX_BUF_LEN] = {0};
-
-    fp = popen(cmd, "r");
-    if (fp)
-    {
-        fgets(buf1, sizeof(buf1), fp);
-        pclose(fp);
-    }
-    else
-    {
-        return -1;
-    }
-	str_strip(buf1);
-    sprintf(buf, "%s", buf1);
-    return 0;
-}
-
-
 int get_vendor(char *pd_sys_id, char *buf)
 {
-    char cmd[MAX_CMD_LEN] = {0};
-    sprintf(cmd, "/bin/cat /sys/class/scsi_generic/%s/device/vendor", pd_sys_id);
-    hal_popen(cmd, buf);
+    return sysfs_attr_readf(buf, MAX_BUF_LEN, "/sys/class/scsi_generic/%s/device/vendor", pd_sys_id);
 }
 
 int get_model(char *pd_sys_id, char *buf)
 {
-    char cmd[MAX_CMD_LEN] = {0};
-    sprintf(cmd, "/bin/cat /sys/class/scsi_generic/%s/device/model", pd_sys_id); 
-    hal_popen(cmd, buf);
+    return sysfs_attr_readf(buf, MAX_BUF_LEN, "/sys/class/scsi_generic/%s/device/model", pd_sys_id);
 }
 
 int get_sg_path(char *pd_sys_id, char *buf)
 {
-    char path[MAX_PATH_LEN];
-    int ret = -1;
-    sprintf(path, "/sys/class/scsi_generic/%s", pd_sys_id);
-
-    ret = readlink(path, buf, MAX_BUF_LEN);
-    if(ret == -1)
-        return ret;
-
-    return 0;
+    return usb_topo_get_sg_path(pd_sys_id, buf, MAX_BUF_LEN);
 }
 
 int get_usb_bus(char *pd_sys_id, char *buf)
 {
-    char *s,*e;
-    char tbuf[MAX_BUF_LEN] = {0};
-
-    get_sg_path(pd_sys_id, tbuf);
-
-    e = strstr(tbuf,"host");
-    if (!e)
-        return -1;
-
-    *--e = 0;
-
-    s = rindex(tbuf,'/') + 1;
-
-    strcpy(buf, s);
-    *e = '/';
-
-    if ((e = strchr(buf, ':')) != NULL)
-    {
-        *e = 0;
-    }
-    return 0;
+    return usb_topo_get_usb_bus(pd_sys_id, buf, MAX_BUF_LEN);
 }
 
 int get_enc_sys_id(char *pd_sys_id, char *buf)
@@ -101,23 +51,19 @@ int get_enc_sys_id(char *pd_sys_id, char *buf)
 int _get_enc_usb_bus_speed(char *pd_sys_id, char *buf)
 {
     char tbuf[MAX_BUF_LEN] = {0};
-    char cmd[MAX_CMD_LEN] = {0};
     
     get_usb_bus(pd_sys_id, tbuf);
     
-    sprintf(cmd, "/bin/cat /sys/bus/usb/devices/%s/speed", tbuf); 
-    hal_popen(cmd, buf);
+    return sysfs_attr_readf(buf, MAX_BUF_LEN, "/sys/bus/usb/devices/%s/speed", tbuf);
 }
 
 int get_usb_bus_version(char *pd_sys_id, char *buf)
 {
     char tbuf[MAX_BUF_LEN] = {0};
-    char cmd[MAX_CMD_LEN] = {0};
     
     get_usb_bus(pd_sys_id, tbuf);
     
-    sprintf(cmd, "/bin/cat /sys/bus/usb/devices/%s/version", tbuf); 
-    hal_popen(cmd, buf);
+    return sysfs_attr_readf(buf, MAX_BUF_LEN, "/sys/bus/usb/devices/%s/version", tbuf);
 }
 
 int tr_convert_speed(char *pd_sys_id, int default_type)
@@ -156,50 +102,17 @@ int get_enc_usb_bus_speed(char *pd_sys_id, char *buf)
 
 int get_usb_layer(char *pd_sys_id, char *buf)
 {
-	int i;
-	int layer = 0;
-    char tbuf[MAX_BUF_LEN] = {0};
-
-    get_usb_bus(pd_sys_id, tbuf);
-
-	for (i = 0; i < strlen(tbuf); i++)
-	{
-		if (tbuf[i] == '.')
-			layer ++;
-	}
-	return layer;
-	
+	return usb_topo_get_layer(pd_sys_id);
 }
 
 int get_enc_upper_usb_bus(char *pd_sys_id, char *buf)
 {
-	char path[MAX_PATH_LEN] = {0};
-    char tbuf[MAX_BUF_LEN] = {0};
-	char *s, *e;
-
-    get_usb_bus(pd_sys_id, tbuf);
-	get_sg_path(pd_sys_id, path);
-	
-	e = strstr(path, tbuf) - 1;
-	*e = 0;
-	s = rindex(path, '/') + 1;
-	sprintf(buf, "%s", s);
-	return 0;	
+	return usb_topo_get_upper_usb_bus(pd_sys_id, buf, MAX_BUF_LEN);
 }
 
 int get_enc_parent_sys_id(char *pd_sys_id, char *buf)
 {
-	int layer = get_usb_layer(pd_sys_id, NULL);	
-
-	if(layer <= 2)
-	{
-		strcpy(buf, "root_usb");	
-	}
-	else
-	{
-		get_enc_upper_usb_bus(pd_sys_id, buf);	
-	}
-	return 0;
+	return usb_topo_get_parent_sys_id(pd_sys_id, buf, MAX_BUF_LEN);
 }
 
 typedef int (*encfunc)(char *pd_sys_id, ENCLOSURE_INFO *enc_info);
@@ -225,7 +138,19 @@ encfunc encfarr[2] = {
 	set_enc_parent_sys_id,
 };
 
-int get_enc_info(char *pd_sys_id, ENCLOSURE_INFO *enc_info)
+/*
+ * TR enclosures are USB attached, their sg device sits under a usb port.
+ */
+MODULE_API int find_module_by_enc_sysid(char *pd_sys_id)
+{
+    char tbuf[MAX_BUF_LEN] = {0};
+
+    if(get_sg_path(pd_sys_id, tbuf) < 0 || strstr(tbuf, "/usb") == NULL)
+        return -1;
+    return 0;
+}
+
+MODULE_API int get_enc_info(char *pd_sys_id, ENCLOSURE_INFO *enc_info)
 {
 	int i;
 	for(i = 0 ; i < 2 ; i++)
@@ -234,11 +159,73 @@ int get_enc_info(char *pd_sys_id, ENCLOSURE_INFO *enc_info)
 	}
 	printf("tr_bus_speed: %d\n", enc_info->tr_bus_speed);		
 	printf("tr_parent_sys_id: %s\n", enc_info->enc_parent_sys_id);		
+	return 0;
 }
 
-int init(char *pd_sys_id, char *buf)
+/*
+ * Disks of one TR enclosure sit behind the same usb bus, so bus speed and
+ * parent are read from sysfs once per bus and copied to the other disks.
+ */
+MODULE_API int mod_get_enc_info_batch(char *pd_sys_ids[], int count, ENCLOSURE_INFO *enc_infos[], int rets[])
+{
+	int i, j, k;
+	char (*usb_bus)[USB_TOPO_NAME_LEN];
+
+	usb_bus = calloc(count, USB_TOPO_NAME_LEN);
+	if(usb_bus == NULL)
+	{
+		for(i = 0 ; i < count ; i++)
+			rets[i] = -1;
+		return -1;
+	}
+	/* pick up sg devices that came or went since the last batch */
+	usb_topo_refresh();
+	usb_topo_get_usb_buses(pd_sys_ids, count, usb_bus, rets);
+	for(i = 0 ; i < count ; i++)
+	{
+		if(rets[i] != 0)
+			continue;
+
+		for(j = 0 ; j < i ; j++)
+		{
+			if(rets[j] == 0 && !strcmp(usb_bus[i], usb_bus[j]))
+				break;
+		}
+		if(j < i)
+		{
+			enc_infos[i]->tr_bus_speed = enc_infos[j]->tr_bus_speed;
+			sprintf(enc_infos[i]->enc_parent_sys_id, "%s", enc_infos[j]->enc_parent_sys_id);
+			continue;
+		}
+		for(k = 0 ; k < 2 ; k++)
+		{
+			encfarr[k](pd_sys_ids[i], enc_infos[i]);
+		}
+	}
+	free(usb_bus);
+	return 0;
+}
+
+/* no caller in the linked in build */
+#ifndef STATIC_MODULES
+MODULE_API int init(char *pd_sys_id, char *buf)
 {
 }
+#endif
+
+#ifdef STATIC_MODULES
+static struct module_ops tr_ops = {
+    "tr",
+    find_module_by_enc_sysid,
+    get_enc_info,
+    NULL,
+    NULL,
+    NULL,
+    mod_get_enc_info_batch,
+};
+
+ADAPTER_MODULE(tr_ops)
+#endif
 
 #ifdef UNIT_TEST
 typedef int (*func)(char *pd_sys_id, char *buf);
@@ -289,6 +276,10 @@ void test_tr(char *pd_sys_id)
 
 int main(int argc, char *argv[])
 {
+    if(argc > 2)
+    {
+        usb_topo_set_root(argv[2]);
+    }
     test_tr(argv[1]);
 }
 
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "uevent.h"
+#include "usb_topo.h"
+
+/*
+ * Kernel uevent listener, keeps the device model up to date instead of
+ * periodic rescans. Events of a hotplug burst are coalesced per device and
+ * dispatched together once the burst is quiet for UEVENT_COALESCE_MS.
+ */
+
+struct handler_entry {
+    char subsystem[32];
+    uevent_handler handler;
+    void *arg;
+};
+
+/*
+ * Modules register from their first call, the listener may be running by
+ * then. dispatch() runs a copy taken under handler_lock, so a handler that
+ * ends up registering another one does not deadlock.
+ */
+static struct handler_entry handlers[UEVENT_MAX_HANDLER];
+static int handler_num = 0;
+static pthread_mutex_t handler_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct uevent pending[UEVENT_MAX_BATCH];
+static int pending_num = 0;
+static unsigned long generation = 0;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* handlers run on a copy of the batch, outside pending_lock, one batch at a time */
+static struct uevent batch[UEVENT_MAX_BATCH];
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int uevent_fd = -1;
+static volatile int running = 0;
+static pthread_t listener;
+
+static const char *subsystems[] = {"scsi_generic", "block", "usb", "enclosure", "nvme", NULL};
+
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+int uevent_register_handler(const char *subsystem, uevent_handler handler, void *arg)
+{
+    pthread_mutex_lock(&handler_lock);
+    if(handler_num >= UEVENT_MAX_HANDLER)
+    {
+        pthread_mutex_unlock(&handler_lock);
+        return -1;
+    }
+    snprintf(handlers[handler_num].subsystem, sizeof(handlers[handler_num].subsystem), "%s", subsystem);
+    handlers[handler_num].handler = handler;
+    handlers[handler_num].arg = arg;
+    handler_num++;
+    pthread_mutex_unlock(&handler_lock);
+    return 0;
+}
+
+/*
+ * Bumped after every dispatched batch, consumers compare it to know their
+ * cached view is stale.
+ */
+unsigned long uevent_get_generation()
+{
+    return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+}
+
+static int is_watched(const char *subsystem)
+{
+    int i;
+    for(i = 0 ; subsystems[i] ; i++)
+    {
+        if(!strcmp(subsystems[i], subsystem))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Parse "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0..." (the header is optional).
+ * @retval 0 ev is filled.
+ * @retval -1 Not a kernel uevent.
+ */
+int uevent_parse(const char *buf, int len, struct uevent *ev)
+{
+    int off = 0;
+    const char *s, *v;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->action = UEVENT_OTHER;
+    if(len <= 0 || !strncmp(buf, "libudev", 7))
+    {
+        return -1;
+    }
+    while(off < len)
+    {
+        s = buf + off;
+        off += strlen(s) + 1;
+        if((v = strchr(s, '=')) == NULL)
+        {
+            continue;
+        }
+        v++;
+        if(!strncmp(s, "ACTION=", 7))
+        {
+            if(!strcmp(v, "add"))
+                ev->action = UEVENT_ADD;
+            else if(!strcmp(v, "remove"))
+                ev->action = UEVENT_REMOVE;
+            else if(!strcmp(v, "change"))
+                ev->action = UEVENT_CHANGE;
+        }
+        else if(!strncmp(s, "SUBSYSTEM=", 10))
+            snprintf(ev->subsystem, sizeof(ev->subsystem), "%s", v);
+        else if(!strncmp(s, "DEVTYPE=", 8))
+            snprintf(ev->devtype, sizeof(ev->devtype), "%s", v);
+        else if(!strncmp(s, "DEVNAME=", 8))
+            snprintf(ev->devname, sizeof(ev->devname), "%s", strncmp(v, "/dev/", 5) ? v : v + 5);
+        else if(!strncmp(s, "DEVPATH=", 8))
+            snprintf(ev->devpath, sizeof(ev->devpath), "%s", v);
+        else if(!strncmp(s, "SEQNUM=", 7))
+            ev->seqnum = strtoull(v, NULL, 10);
+    }
+    if(ev->subsystem[0] == '\0' || ev->devpath[0] == '\0')
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void dispatch(struct uevent *ev)
+{
+    int i, num;
+    struct handler_entry table[UEVENT_MAX_HANDLER];
+
+    if(!strcmp(ev->subsystem, "scsi_generic") && ev->devname[0])
+    {
+        if(ev->action == UEVENT_REMOVE)
+            usb_topo_remove_sg(ev->devname);
+        else
+            usb_topo_add_sg(ev->devname);
+    }
+    pthread_mutex_lock(&handler_lock);
+    num = handler_num;
+    memcpy(table, handlers, num * sizeof(struct handler_entry));
+    pthread_mutex_unlock(&handler_lock);
+    for(i = 0 ; i < num ; i++)
+    {
+        if(ev->action == UEVENT_RESYNC || table[i].subsystem[0] == '\0' ||
+           !strcmp(table[i].subsystem, ev->subsystem))
+        {
+            table[i].handler(ev, table[i].arg);
+        }
+    }
+}
+
+static int pending_count()
+{
+    int num;
+
+    pthread_mutex_lock(&pending_lock);
+    num = pending_num;
+    pthread_mutex_unlock(&pending_lock);
+    return num;
+}
+
+/*
+ * Take the pending events out under pending_lock and run the handlers
+ * after it is released, so the listener can keep queueing meanwhile.
+ */
+static void flush_pending()
+{
+    int i, num;
+
+    pthread_mutex_lock(&dispatch_lock);
+    pthread_mutex_lock(&pending_lock);
+    num = pending_num;
+    memcpy(batch, pending, num * sizeof(struct uevent));
+    pending_num = 0;
+    pthread_mutex_unlock(&pending_lock);
+
+    for(i = 0 ; i < num ; i++)
+    {
+        dispatch(&batch[i]);
+    }
+    if(num > 0)
+    {
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+ * The socket overran and events are gone: dispatch what is pending, rebuild
+ * the topology from sysfs and tell every handler to rescan.
+ */
+static void resync()
+{
+    struct uevent ev;
+
+    flush_pending();
+    memset(&ev, 0, sizeof(ev));
+    ev.action = UEVENT_RESYNC;
+    pthread_mutex_lock(&dispatch_lock);
+    usb_topo_refresh();
+    dispatch(&ev);
+    __atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+/*
+ * One pending entry per device, a later event overrides an earlier one:
+ * add+remove is a remove (harmless for a device nobody saw), remove+add is
+ * an add (handlers replace what they had), add+change stays an add.
+ * @return pending events after this one.
+ */
+static int queue_event(struct uevent *ev)
+{
+    int i, num;
+
+    if(!is_watched(ev->subsystem))
+    {
+        return pending_count();
+    }
+    while(1)
+    {
+        pthread_mutex_lock(&pending_lock);
+        for(i = 0 ; i < pending_num ; i++)
+        {
+            if(!strcmp(pending[i].devpath, ev->devpath))
+                break;
+        }
+        if(i < pending_num)
+        {
+            if(!(pending[i].action == UEVENT_ADD && ev->action == UEVENT_CHANGE))
+            {
+                pending[i].action = ev->action;
+            }
+            pending[i].seqnum = ev->seqnum;
+            if(ev->devname[0])
+            {
+                snprintf(pending[i].devname, sizeof(pending[i].devname), "%s", ev->devname);
+            }
+            break;
+        }
+        if(pending_num < UEVENT_MAX_BATCH)
+        {
+            pending[pending_num++] = *ev;
+            break;
+        }
+        pthread_mutex_unlock(&pending_lock);
+        flush_pending();
+    }
+    num = pending_num;
+    pthread_mutex_unlock(&pending_lock);
+    return num;
+}
+
+static void *uevent_listen(void *arg)
+{
+    int ret;
+    int timeout;
+    int num = 0;
+    long long burst_start = 0;
+    long long last_event = 0;
+    char buf[UEVENT_BUF_LEN];
+    struct uevent ev;
+    struct pollfd pfd;
+
+    pfd.fd = uevent_fd;
+    pfd.events = POLLIN;
+    while(running)
+    {
+        timeout = 500;
+        if(num > 0)
+        {
+            timeout = last_event + UEVENT_COALESCE_MS - now_ms();
+            if(burst_start + UEVENT_COALESCE_MAX_MS - now_ms() < timeout)
+                timeout = burst_start + UEVENT_COALESCE_MAX_MS - now_ms();
+            if(timeout < 0)
+                timeout = 0;
+        }
+        ret = poll(&pfd, 1, timeout);
+        if(ret > 0 && (pfd.revents & POLLIN))
+        {
+            ret = recv(uevent_fd, buf, sizeof(buf) - 1, 0);
+            if(ret > 0)
+            {
+                buf[ret] = '\0';
+                if(uevent_parse(buf, ret, &ev) == 0)
+                {
+                    last_event = now_ms();
+                    if(num == 0)
+                        burst_start = last_event;
+                    num = queue_event(&ev);
+                }
+            }
+            else if(ret < 0 && errno == ENOBUFS)
+            {
+                resync();
+                num = 0;
+                continue;
+            }
+            /* keep reading while the burst goes on, unless it has run too long */
+            if(num == 0 || now_ms() - burst_start < UEVENT_COALESCE_MAX_MS)
+                continue;
+        }
+        if(num > 0 && (now_ms() - last_event >= UEVENT_COALESCE_MS ||
+                       now_ms() - burst_start >= UEVENT_COALESCE_MAX_MS))
+        {
+            flush_pending();
+            num = 0;
+        }
+    }
+    return NULL;
+}
+
+int uevent_start()
+{
+    int rcvbuf = 4 * 1024 * 1024;
+    struct sockaddr_nl addr;
+
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if(uevent_fd < 0)
+    {
+        perror("uevent socket");
+        return -1;
+    }
+    /* a hotplug storm must not overflow the socket */
+    setsockopt(uevent_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 1;     /* kernel events */
+    if(bind(uevent_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        perror("uevent bind");
+        close(uevent_fd);
+        uevent_fd = -1;
+        return -1;
+    }
+    running = 1;
+    if(pthread_create(&listener, NULL, uevent_listen, NULL) != 0)
+    {
+        running = 0;
+        close(uevent_fd);
+        uevent_fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void uevent_stop()
+{
+    if(!running)
+    {
+        return;
+    }
+    running = 0;
+    pthread_join(listener, NULL);
+    close(uevent_fd);
+    uevent_fd = -1;
+    flush_pending();
+}
+
+/*
+ * Feed events from a file through the same coalescing and dispatch, for
+ * testing without hardware. Events are blocks of KEY=VALUE lines separated
+ * by an empty line (udevadm monitor --kernel --property output works, lines
+ * without '=' are skipped). The whole file is dispatched as one burst.
+ * @return number of events read, -1 if the file can not be opened.
+ */
+int uevent_inject_file(const char *path)
+{
+    int num = 0;
+    int len = 0;
+    char line[512];
+    char buf[UEVENT_BUF_LEN];
+    struct uevent ev;
+    FILE *fp = fopen(path, "r");
+
+    if(fp == NULL)
+    {
+        return -1;
+    }
+    while(1)
+    {
+        char *ret = fgets(line, sizeof(line), fp);
+        int l;
+
+        if(ret)
+        {
+            l = strlen(line);
+            while(l > 0 && (line[l - 1] == '\n' || line[l - 1] == '\r'))
+                line[--l] = '\0';
+        }
+        if(ret == NULL || line[0] == '\0')
+        {
+            if(len > 0 && uevent_parse(buf, len, &ev) == 0)
+            {
+                queue_event(&ev);
+                num++;
+            }
+            len = 0;
+            if(ret == NULL)
+                break;
+            continue;
+        }
+        if(strchr(line, '=') == NULL || len + l + 1 > (int) sizeof(buf))
+            continue;
+        memcpy(buf + len, line, l + 1);
+        len += l + 1;
+    }
+    fclose(fp);
+    flush_pending();
+    return num;
+}
+
+#ifdef UNIT_TEST
+static const char *action_names[] = {"add", "remove", "change", "other", "resync"};
+
+static void print_event(struct uevent *ev, void *arg)
+{
+    printf("(gen, action, subsystem, devname, devpath) = (%lu, %s, %s, %s, %s)\n",
+           uevent_get_generation(), action_names[ev->action], ev->subsystem, ev->devname, ev->devpath);
+}
+
+int main(int argc, char *argv[])
+{
+    int i;
+    char bus[64];
+
+    uevent_register_handler("", print_event, NULL);
+    if(argc > 2)
+    {
+        /* uevent <event file> <fake scsi_generic dir> [sg names] */
+        usb_topo_set_root(argv[2]);
+        printf("events: %d\n", uevent_inject_file(argv[1]));
+        for(i = 3 ; i < argc ; i++)
+        {
+            bus[0] = '\0';
+            printf("(%s, ret, usb_bus) = (%d, %s)\n", argv[i], usb_topo_get_usb_bus(argv[i], bus, sizeof(bus)), bus);
+        }
+        return 0;
+    }
+    if(uevent_start() < 0)
+    {
+        return 1;
+    }
+    printf("listening, ctrl-c to stop\n");
+    pause();
+    return 0;
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef _UEVENT_H
+#define _UEVENT_H
+
+#define UEVENT_BUF_LEN          8192
+#define UEVENT_MAX_BATCH        256     /* distinct devices coalesced into one dispatch */
+#define UEVENT_COALESCE_MS      20      /* quiet time that ends a burst */
+#define UEVENT_COALESCE_MAX_MS  500     /* a storm is dispatched at least this often */
+#define UEVENT_MAX_HANDLER      16
+
+typedef enum _UEVENT_ACTION
+{
+    UEVENT_ADD = 0,
+    UEVENT_REMOVE,
+    UEVENT_CHANGE,
+    UEVENT_OTHER,
+    UEVENT_RESYNC,                  /*!< events were lost (socket overrun), rebuild the whole view */
+} UEVENT_ACTION;
+
+struct uevent {
+    UEVENT_ACTION action;
+    char subsystem[32];
+    char devtype[32];
+    char devname[64];               /*!< "sg1", "sdb", "nvme0", empty for usb/enclosure */
+    char devpath[256];              /*!< /devices/... */
+    unsigned long long seqnum;
+};
+
+typedef void (*uevent_handler)(struct uevent *ev, void *arg);
+
+int uevent_register_handler(const char *subsystem, uevent_handler handler, void *arg);
+unsigned long uevent_get_generation();
+
+int uevent_parse(const char *buf, int len, struct uevent *ev);
+int uevent_start();
+void uevent_stop();
+int uevent_inject_file(const char *path);
+
+#endif
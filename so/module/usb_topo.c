@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "usb_topo.h"
+
+/*
+ * sg device -> scsi host -> usb port path -> hub chain, read once per sg
+ * device from its scsi_generic link and kept up to date incrementally.
+ */
+
+static char sys_path_generic[USB_TOPO_PATH_LEN] = SYS_PATH_GENERIC;
+static struct usb_node *nodes = NULL;
+static struct usb_sg *sgs = NULL;
+static pthread_rwlock_t topo_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * For tests against a fake tree of scsi_generic links.
+ */
+void usb_topo_set_root(const char *path)
+{
+    snprintf(sys_path_generic, sizeof(sys_path_generic), "%s", path);
+}
+
+static int is_usb_root(const char *name)
+{
+    return !strncmp(name, "usb", 3) && isdigit(name[3]);
+}
+
+/* "2-1", "2-1.3", not the interface "2-1.3:1.0" */
+static int is_usb_port(const char *name)
+{
+    const char *p = name;
+
+    if(!isdigit(*p))
+        return 0;
+    while(isdigit(*p))
+        p++;
+    if(*p++ != '-')
+        return 0;
+    for( ; *p ; p++)
+    {
+        if(!isdigit(*p) && *p != '.')
+            return 0;
+    }
+    return 1;
+}
+
+static int is_scsi_host(const char *name)
+{
+    return !strncmp(name, "host", 4) && isdigit(name[4]);
+}
+
+static struct usb_node *find_node(const char *name)
+{
+    struct usb_node *n;
+    for(n = nodes ; n ; n = n->next)
+    {
+        if(!strcmp(n->name, name))
+            return n;
+    }
+    return NULL;
+}
+
+static struct usb_sg *find_sg(const char *sg_name)
+{
+    struct usb_sg *sg;
+    for(sg = sgs ; sg ; sg = sg->next)
+    {
+        if(!strcmp(sg->sg_name, sg_name))
+            return sg;
+    }
+    return NULL;
+}
+
+static struct usb_node *get_node(const char *name, struct usb_node *parent)
+{
+    int i;
+    struct usb_node *n = find_node(name);
+
+    if(n)
+        return n;
+    n = calloc(1, sizeof(struct usb_node));
+    if(n == NULL)
+        return NULL;
+    snprintf(n->name, sizeof(n->name), "%s", name);
+    n->layer = -1;
+    if(!is_usb_root(name))
+    {
+        n->layer = 0;
+        for(i = 0 ; name[i] ; i++)
+        {
+            if(name[i] == '.')
+                n->layer++;
+        }
+    }
+    n->parent = parent;
+    if(parent)
+    {
+        n->sibling = parent->child;
+        parent->child = n;
+    }
+    n->next = nodes;
+    nodes = n;
+    return n;
+}
+
+static void unlink_node(struct usb_node *n)
+{
+    struct usb_node **pp;
+
+    if(n->parent)
+    {
+        for(pp = &n->parent->child ; *pp ; pp = &(*pp)->sibling)
+        {
+            if(*pp == n)
+            {
+                *pp = n->sibling;
+                break;
+            }
+        }
+    }
+    for(pp = &nodes ; *pp ; pp = &(*pp)->next)
+    {
+        if(*pp == n)
+        {
+            *pp = n->next;
+            break;
+        }
+    }
+}
+
+/* drop ports nothing is attached to any more */
+static void prune_node(struct usb_node *n)
+{
+    struct usb_node *parent;
+
+    while(n && n->child == NULL && n->sg_num == 0)
+    {
+        parent = n->parent;
+        unlink_node(n);
+        free(n);
+        n = parent;
+    }
+}
+
+/*
+ * Split the scsi_generic link into components and hook the sg device into
+ * the tree.
+ * ../../devices/pci0000:00/0000:00:14.0/usb2/2-1/2-1.3/2-1.3:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg1
+ */
+static void parse_sg_path(struct usb_sg *sg)
+{
+    int i, n = 0;
+    int host = -1;
+    char tbuf[USB_TOPO_PATH_LEN];
+    char *comp[64];
+    char *s, *e;
+    struct usb_node *parent = NULL;
+
+    snprintf(tbuf, sizeof(tbuf), "%s", sg->path);
+    for(s = strtok_r(tbuf, "/", &e) ; s && n < 64 ; s = strtok_r(NULL, "/", &e))
+    {
+        comp[n++] = s;
+    }
+    for(i = 0 ; i < n ; i++)
+    {
+        if(is_scsi_host(comp[i]))
+        {
+            host = i;
+            break;
+        }
+    }
+    sg->port = NULL;
+    sg->bus[0] = '\0';
+    sg->host[0] = '\0';
+    if(host <= 0)
+    {
+        return;
+    }
+    snprintf(sg->host, sizeof(sg->host), "%s", comp[host]);
+    snprintf(sg->bus, sizeof(sg->bus), "%s", comp[host - 1]);
+    if((s = strchr(sg->bus, ':')) != NULL)
+    {
+        *s = '\0';
+    }
+
+    for(i = 0 ; i < host ; i++)
+    {
+        if(is_usb_root(comp[i]) || (parent && is_usb_port(comp[i])))
+        {
+            parent = get_node(comp[i], parent);
+            if(parent == NULL)
+                return;
+        }
+    }
+    if(parent && parent->layer >= 0)
+    {
+        sg->port = parent;
+        parent->sg_num++;
+    }
+}
+
+/* scsi_generic link of the sg device, -1 if the path does not fit */
+static int sg_link(char *link, int len, const char *sg_name)
+{
+    int ret = snprintf(link, len, "%s/%s", sys_path_generic, sg_name);
+    return (ret < 0 || ret >= len) ? -1 : 0;
+}
+
+static struct usb_sg *add_sg(const char *sg_name)
+{
+    int ret;
+    char link[USB_TOPO_PATH_LEN];
+    struct usb_sg *sg;
+
+    if(sg_link(link, sizeof(link), sg_name) < 0)
+        return NULL;
+    sg = calloc(1, sizeof(struct usb_sg));
+    if(sg == NULL)
+        return NULL;
+    ret = readlink(link, sg->path, sizeof(sg->path) - 1);
+    if(ret < 0)
+    {
+        free(sg);
+        return NULL;
+    }
+    sg->path[ret] = '\0';
+    snprintf(sg->sg_name, sizeof(sg->sg_name), "%s", sg_name);
+    parse_sg_path(sg);
+    sg->next = sgs;
+    sgs = sg;
+    return sg;
+}
+
+static void remove_sg(struct usb_sg *sg)
+{
+    struct usb_sg **pp;
+
+    for(pp = &sgs ; *pp ; pp = &(*pp)->next)
+    {
+        if(*pp == sg)
+        {
+            *pp = sg->next;
+            break;
+        }
+    }
+    if(sg->port)
+    {
+        sg->port->sg_num--;
+        prune_node(sg->port);
+    }
+    free(sg);
+}
+
+int usb_topo_add_sg(const char *sg_name)
+{
+    struct usb_sg *sg;
+
+    pthread_rwlock_wrlock(&topo_lock);
+    if((sg = find_sg(sg_name)) != NULL)
+    {
+        remove_sg(sg);
+    }
+    sg = add_sg(sg_name);
+    pthread_rwlock_unlock(&topo_lock);
+    return sg ? 0 : -1;
+}
+
+int usb_topo_remove_sg(const char *sg_name)
+{
+    struct usb_sg *sg;
+
+    pthread_rwlock_wrlock(&topo_lock);
+    if((sg = find_sg(sg_name)) != NULL)
+    {
+        remove_sg(sg);
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return sg ? 0 : -1;
+}
+
+/*
+ * Rescan the scsi_generic directory, only sg devices that are new, gone or
+ * whose link changed touch the tree.
+ * @return number of sg devices.
+ */
+int usb_topo_refresh()
+{
+    int ret;
+    int num = 0;
+    char link[USB_TOPO_PATH_LEN];
+    char path[USB_TOPO_PATH_LEN];
+    struct dirent *de;
+    struct usb_sg *sg, *next;
+    DIR *dr = opendir(sys_path_generic);
+
+    if(dr == NULL)
+    {
+        return -1;
+    }
+    pthread_rwlock_wrlock(&topo_lock);
+    for(sg = sgs ; sg ; sg = sg->next)
+    {
+        sg->seen = 0;
+    }
+    while((de = readdir(dr)) != NULL)
+    {
+        if(de->d_name[0] == '.')
+            continue;
+        if(sg_link(link, sizeof(link), de->d_name) < 0)
+            continue;
+        ret = readlink(link, path, sizeof(path) - 1);
+        if(ret < 0)
+            continue;
+        path[ret] = '\0';
+        sg = find_sg(de->d_name);
+        if(sg && strcmp(sg->path, path))
+        {
+            remove_sg(sg);
+            sg = NULL;
+        }
+        if(sg == NULL)
+        {
+            sg = add_sg(de->d_name);
+        }
+        if(sg)
+        {
+            sg->seen = 1;
+            num++;
+        }
+    }
+    closedir(dr);
+    for(sg = sgs ; sg ; sg = next)
+    {
+        next = sg->next;
+        if(!sg->seen)
+        {
+            remove_sg(sg);
+        }
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return num;
+}
+
+/*
+ * Read lock held on success. A known sg device is answered from the tree
+ * without touching sysfs, the uevent listener keeps it current (remove/add
+ * of the sg node, usb_topo_refresh() on a resync). Only an sg device seen
+ * for the first time reads its link.
+ */
+static struct usb_sg *lookup_sg(const char *sg_name)
+{
+    struct usb_sg *sg;
+
+    pthread_rwlock_rdlock(&topo_lock);
+    if((sg = find_sg(sg_name)) != NULL)
+    {
+        return sg;
+    }
+    pthread_rwlock_unlock(&topo_lock);
+
+    pthread_rwlock_wrlock(&topo_lock);
+    if(find_sg(sg_name) == NULL)
+    {
+        add_sg(sg_name);
+    }
+    pthread_rwlock_unlock(&topo_lock);
+
+    pthread_rwlock_rdlock(&topo_lock);
+    if((sg = find_sg(sg_name)) != NULL)
+    {
+        return sg;
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return NULL;
+}
+
+int usb_topo_get_sg_path(const char *sg_name, char *buf, int buf_len)
+{
+    struct usb_sg *sg = lookup_sg(sg_name);
+
+    if(sg == NULL)
+        return -1;
+    snprintf(buf, buf_len, "%s", sg->path);
+    pthread_rwlock_unlock(&topo_lock);
+    return 0;
+}
+
+int usb_topo_get_usb_bus(const char *sg_name, char *buf, int buf_len)
+{
+    int ret = -1;
+    struct usb_sg *sg = lookup_sg(sg_name);
+
+    if(sg == NULL)
+        return -1;
+    if(sg->bus[0])
+    {
+        snprintf(buf, buf_len, "%s", sg->bus);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return ret;
+}
+
+/*
+ * usb_topo_get_usb_bus() for a group of sg devices under one read lock and
+ * one walk of the sg list. Devices the tree does not know are not added.
+ * @param rets per device 0, or -1 when it is unknown or not behind a bus.
+ * @return number of buses found.
+ */
+int usb_topo_get_usb_buses(char *sg_names[], int count, char buses[][USB_TOPO_NAME_LEN], int rets[])
+{
+    int i;
+    int num = 0;
+    struct usb_sg *sg;
+
+    for(i = 0 ; i < count ; i++)
+    {
+        rets[i] = -1;
+        buses[i][0] = '\0';
+    }
+    pthread_rwlock_rdlock(&topo_lock);
+    for(sg = sgs ; sg ; sg = sg->next)
+    {
+        if(sg->bus[0] == '\0')
+            continue;
+        for(i = 0 ; i < count ; i++)
+        {
+            if(rets[i] != 0 && !strcmp(sg->sg_name, sg_names[i]))
+            {
+                snprintf(buses[i], USB_TOPO_NAME_LEN, "%s", sg->bus);
+                rets[i] = 0;
+                num++;
+            }
+        }
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return num;
+}
+
+int usb_topo_get_layer(const char *sg_name)
+{
+    int layer = 0;
+    struct usb_sg *sg = lookup_sg(sg_name);
+
+    if(sg == NULL)
+        return 0;
+    if(sg->port)
+        layer = sg->port->layer;
+    pthread_rwlock_unlock(&topo_lock);
+    return layer;
+}
+
+int usb_topo_get_upper_usb_bus(const char *sg_name, char *buf, int buf_len)
+{
+    int ret = -1;
+    struct usb_sg *sg = lookup_sg(sg_name);
+
+    if(sg == NULL)
+        return -1;
+    if(sg->port && sg->port->parent)
+    {
+        snprintf(buf, buf_len, "%s", sg->port->parent->name);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return ret;
+}
+
+/*
+ * Enclosures up to the second hub layer hang off the root usb.
+ */
+int usb_topo_get_parent_sys_id(const char *sg_name, char *buf, int buf_len)
+{
+    if(usb_topo_get_layer(sg_name) <= 2)
+    {
+        snprintf(buf, buf_len, "%s", "root_usb");
+        return 0;
+    }
+    return usb_topo_get_upper_usb_bus(sg_name, buf, buf_len);
+}
+
+/*
+ * All sg devices behind the given usb port or hub.
+ * @return number of sg devices found, at most max are stored.
+ */
+int usb_topo_get_subtree_sgs(const char *usb_bus, char sg_names[][USB_TOPO_NAME_LEN], int max)
+{
+    int num = 0;
+    struct usb_node *top, *n;
+    struct usb_sg *sg;
+
+    pthread_rwlock_rdlock(&topo_lock);
+    top = find_node(usb_bus);
+    if(top == NULL)
+    {
+        pthread_rwlock_unlock(&topo_lock);
+        return 0;
+    }
+    for(sg = sgs ; sg ; sg = sg->next)
+    {
+        for(n = sg->port ; n && n != top ; n = n->parent)
+            ;
+        if(n == NULL)
+            continue;
+        if(num < max)
+        {
+            snprintf(sg_names[num], USB_TOPO_NAME_LEN, "%s", sg->sg_name);
+        }
+        num++;
+    }
+    pthread_rwlock_unlock(&topo_lock);
+    return num;
+}
+
+#ifdef UNIT_TEST
+static void dump_node(struct usb_node *n, int depth)
+{
+    struct usb_node *c;
+    struct usb_sg *sg;
+
+    printf("%*s%s (layer %d)", depth * 2, "", n->name, n->layer);
+    for(sg = sgs ; sg ; sg = sg->next)
+    {
+        if(sg->port == n)
+            printf(" %s", sg->sg_name);
+    }
+    printf("\n");
+    for(c = n->child ; c ; c = c->sibling)
+    {
+        dump_node(c, depth + 1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int i, num;
+    char buf[USB_TOPO_PATH_LEN];
+    char names[64][USB_TOPO_NAME_LEN];
+    struct usb_node *n;
+
+    if(argc > 1)
+    {
+        usb_topo_set_root(argv[1]);
+    }
+    printf("sg devices: %d\n", usb_topo_refresh());
+    for(n = nodes ; n ; n = n->next)
+    {
+        if(n->parent == NULL)
+            dump_node(n, 0);
+    }
+    for(i = 2 ; i < argc ; i++)
+    {
+        if(usb_topo_get_usb_bus(argv[i], buf, sizeof(buf)) == 0)
+            printf("(%s, usb_bus) = %s\n", argv[i], buf);
+        printf("(%s, layer) = %d\n", argv[i], usb_topo_get_layer(argv[i]));
+        if(usb_topo_get_upper_usb_bus(argv[i], buf, sizeof(buf)) == 0)
+            printf("(%s, upper_usb_bus) = %s\n", argv[i], buf);
+        if(usb_topo_get_parent_sys_id(argv[i], buf, sizeof(buf)) == 0)
+            printf("(%s, parent_sys_id) = %s\n", argv[i], buf);
+        num = usb_topo_get_subtree_sgs(argv[i], names, 64);
+        if(num > 0)
+        {
+            printf("(%s, subtree) =", argv[i]);
+            while(num-- > 0)
+                printf(" %s", names[num]);
+            printf("\n");
+        }
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef _USB_TOPO_H
+#define _USB_TOPO_H
+
+#define USB_TOPO_NAME_LEN   32
+#define USB_TOPO_PATH_LEN   512
+#define SYS_PATH_GENERIC    "/sys/class/scsi_generic"
+
+/*
+ * USB port path tree, built once from the scsi_generic links:
+ * usbN (root hub) -> 2-1 -> 2-1.3 ... -> sg devices behind the port.
+ */
+struct usb_node {
+    char name[USB_TOPO_NAME_LEN];       /*!< "usb2", "2-1", "2-1.3" */
+    int layer;                          /*!< '.' count of the port path, -1 for the root hub */
+    struct usb_node *parent;
+    struct usb_node *child;
+    struct usb_node *sibling;
+    struct usb_node *next;              /*!< all nodes list */
+    int sg_num;                         /*!< sg devices directly behind this port */
+};
+
+struct usb_sg {
+    char sg_name[USB_TOPO_NAME_LEN];    /*!< "sg1" */
+    char host[USB_TOPO_NAME_LEN];       /*!< "host6" */
+    char bus[USB_TOPO_NAME_LEN];        /*!< path component before the scsi host, ':' stripped */
+    char path[USB_TOPO_PATH_LEN];       /*!< scsi_generic link */
+    struct usb_node *port;              /*!< NULL when not usb attached */
+    struct usb_sg *next;
+    int seen;
+};
+
+void usb_topo_set_root(const char *sys_path_generic);
+int usb_topo_refresh();
+int usb_topo_add_sg(const char *sg_name);
+int usb_topo_remove_sg(const char *sg_name);
+
+int usb_topo_get_sg_path(const char *sg_name, char *buf, int buf_len);
+int usb_topo_get_usb_bus(const char *sg_name, char *buf, int buf_len);
+int usb_topo_get_usb_buses(char *sg_names[], int count, char buses[][USB_TOPO_NAME_LEN], int rets[]);
+int usb_topo_get_layer(const char *sg_name);
+int usb_topo_get_upper_usb_bus(const char *sg_name, char *buf, int buf_len);
+int usb_topo_get_parent_sys_id(const char *sg_name, char *buf, int buf_len);
+int usb_topo_get_subtree_sgs(const char *usb_bus, char sg_names[][USB_TOPO_NAME_LEN], int max);
+
+#endif